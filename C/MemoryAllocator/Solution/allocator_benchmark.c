@@ -0,0 +1,507 @@
+#include "mem.h"
+#include "mem_kernel.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+#include <malloc.h>
+#define HAVE_MALLINFO2
+#endif
+
+// Number of operations in each synthetic trace.
+#define TRACE_OP_COUNT 200000
+
+// How often (in operations) to sample memory use, for allocators that don't
+// track their peak.
+#define MEMORY_SAMPLE_INTERVAL 256
+
+// Memory from mem_block_alloc() is mapped separately from system malloc's, so
+// each allocator's memory use can be measured on its own. An extra page in
+// front of the memory records its size, for mem_block_free().
+static size_t reserved_bytes = 0;
+static size_t peak_reserved_bytes = 0;
+
+void* mem_block_alloc(size_t n) {
+    assert(n > 0);
+    const size_t size = n * MEM_BLOCK_SIZE;
+    uint8_t *map = mmap(NULL, size + MEM_BLOCK_SIZE, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) { return NULL; }
+    
+    *(size_t *)map = size;
+    reserved_bytes += size;
+    if (reserved_bytes > peak_reserved_bytes) { peak_reserved_bytes = reserved_bytes; }
+    return map + MEM_BLOCK_SIZE;
+}
+
+void mem_block_free(void* ptr) {
+    assert(ptr != NULL);
+    uint8_t *map = (uint8_t *)ptr - MEM_BLOCK_SIZE;
+    const size_t size = *(size_t *)map;
+    reserved_bytes -= size;
+    munmap(map, size + MEM_BLOCK_SIZE);
+}
+
+// An allocation into 'slot' if 'size' is non-zero, otherwise a free of the
+// memory in 'slot'.
+struct trace_op {
+    uint32_t slot;
+    uint32_t size;
+};
+
+struct trace {
+    char name[64];
+    struct trace_op *ops;
+    size_t op_count;
+    size_t op_capacity;
+    size_t slot_count;
+};
+
+static void trace_init(struct trace *trace, const char *name) {
+    snprintf(trace->name, sizeof(trace->name), "%s", name);
+    trace->ops = NULL;
+    trace->op_count = 0;
+    trace->op_capacity = 0;
+    trace->slot_count = 0;
+}
+
+static void trace_destroy(struct trace *trace) {
+    free(trace->ops);
+}
+
+static void trace_add(struct trace *trace, size_t slot, size_t size) {
+    if (trace->op_count == trace->op_capacity) {
+        trace->op_capacity = trace->op_capacity == 0 ? 1024 : trace->op_capacity * 2;
+        trace->ops = realloc(trace->ops, trace->op_capacity * sizeof(struct trace_op));
+        if (trace->ops == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+    
+    trace->ops[trace->op_count].slot = (uint32_t)slot;
+    trace->ops[trace->op_count].size = (uint32_t)size;
+    trace->op_count++;
+    if (slot >= trace->slot_count) { trace->slot_count = slot + 1; }
+}
+
+static void trace_alloc(struct trace *trace, size_t slot, size_t size) {
+    assert(size > 0);
+    trace_add(trace, slot, size);
+}
+
+static void trace_free(struct trace *trace, size_t slot) {
+    trace_add(trace, slot, 0);
+}
+
+static uint64_t random_state = 88172645463325252ull;
+
+static uint64_t random_next(void) {
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+// Mostly small sizes, with occasional larger ones.
+static size_t random_size(void) {
+    const uint64_t value = random_next();
+    if ((value % 16) != 0) { return (value >> 8) % 128 + 1; }
+    return (value >> 8) % 4096 + 1;
+}
+
+// Allocate a stack of objects then free them in reverse order, repeatedly.
+static void make_lifo_trace(struct trace *trace) {
+    trace_init(trace, "lifo");
+    while (trace->op_count < TRACE_OP_COUNT) {
+        const size_t depth = random_next() % 1000 + 1;
+        for (size_t i = 0; i < depth; i++) {
+            trace_alloc(trace, i, random_size());
+        }
+        for (size_t i = depth; i > 0; i--) {
+            trace_free(trace, i - 1);
+        }
+    }
+}
+
+// Keep a queue of objects, freeing the oldest as each new one is allocated.
+static void make_fifo_trace(struct trace *trace) {
+    const size_t queue_size = 1000;
+    trace_init(trace, "fifo");
+    for (size_t i = 0; trace->op_count < TRACE_OP_COUNT; i++) {
+        if (i >= queue_size) { trace_free(trace, i % queue_size); }
+        trace_alloc(trace, i % queue_size, random_size());
+    }
+    for (size_t i = 0; i < queue_size; i++) {
+        trace_free(trace, i);
+    }
+}
+
+// Free a random live object and allocate another of a random size.
+static void make_random_trace(struct trace *trace) {
+    const size_t live_count = 10000;
+    trace_init(trace, "random");
+    for (size_t i = 0; i < live_count; i++) {
+        trace_alloc(trace, i, random_size());
+    }
+    while (trace->op_count < TRACE_OP_COUNT) {
+        const size_t slot = random_next() % live_count;
+        trace_free(trace, slot);
+        trace_alloc(trace, slot, random_size());
+    }
+    for (size_t i = 0; i < live_count; i++) {
+        trace_free(trace, i);
+    }
+}
+
+// A producer allocates messages in bursts and a consumer frees them in the
+// order they were produced, at a steady rate, so the backlog grows and shrinks.
+static void make_producer_consumer_trace(struct trace *trace) {
+    const size_t max_backlog = 4096;
+    size_t produced = 0;
+    size_t consumed = 0;
+    trace_init(trace, "producer-consumer");
+    while (trace->op_count < TRACE_OP_COUNT) {
+        size_t burst = random_next() % 64;
+        while (burst > 0 && produced - consumed < max_backlog) {
+            trace_alloc(trace, produced % max_backlog, random_next() % 512 + 16);
+            produced++;
+            burst--;
+        }
+        for (size_t i = 0; i < 16 && consumed < produced; i++) {
+            trace_free(trace, consumed % max_backlog);
+            consumed++;
+        }
+    }
+    while (consumed < produced) {
+        trace_free(trace, consumed % max_backlog);
+        consumed++;
+    }
+}
+
+// Many small objects live at once, like the nodes of a tree or a list, with
+// some replaced at random.
+static void make_small_trace(struct trace *trace) {
+    const size_t live_count = 100000;
+    trace_init(trace, "small");
+    for (size_t i = 0; i < live_count; i++) {
+        trace_alloc(trace, i, random_next() % 48 + 1);
+    }
+    while (trace->op_count < TRACE_OP_COUNT) {
+        const size_t slot = random_next() % live_count;
+        trace_free(trace, slot);
+        trace_alloc(trace, slot, random_next() % 48 + 1);
+    }
+    for (size_t i = 0; i < live_count; i++) {
+        trace_free(trace, i);
+    }
+}
+
+// The mix used by test_stress() in allocator_tests.c.
+static void make_stress_trace(struct trace *trace) {
+    const size_t alloc_count = 10000;
+    trace_init(trace, "stress");
+    while (trace->op_count < TRACE_OP_COUNT) {
+        for (size_t i = 0; i < alloc_count; i++) {
+            trace_alloc(trace, i, (i % 77) + 1);
+        }
+        for (size_t i = 0; i < alloc_count; i += 3) {
+            trace_free(trace, i);
+            trace_alloc(trace, i, (i % 99) + 3);
+        }
+        for (size_t i = 0; i < alloc_count; i++) {
+            trace_free(trace, i);
+        }
+    }
+}
+
+// Load a recorded trace. Each line is either "a <slot> <size>" to allocate
+// 'size' bytes into 'slot', or "f <slot>" to free the memory in 'slot'.
+static bool load_trace(struct trace *trace, const char *path) {
+    trace_init(trace, path);
+    
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Can't open trace '%s'\n", path);
+        return false;
+    }
+    
+    bool *live = NULL;
+    size_t live_capacity = 0;
+    char line[128];
+    size_t line_number = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), file) != NULL) {
+        line_number++;
+        char op;
+        unsigned long slot = 0, size = 0;
+        const int field_count = sscanf(line, " %c %lu %lu", &op, &slot, &size);
+        if (field_count <= 0 || op == '#') { continue; }
+        
+        const bool is_alloc = (op == 'a' && field_count == 3 && size > 0 && size <= UINT32_MAX);
+        const bool is_free = (op == 'f' && field_count >= 2);
+        if ((!is_alloc && !is_free) || slot >= UINT32_MAX) {
+            ok = false;
+            break;
+        }
+        
+        if (slot >= live_capacity) {
+            const size_t new_capacity = (slot + 1) * 2;
+            live = realloc(live, new_capacity * sizeof(bool));
+            if (live == NULL) {
+                fprintf(stderr, "Out of memory\n");
+                exit(1);
+            }
+            memset(live + live_capacity, 0, (new_capacity - live_capacity) * sizeof(bool));
+            live_capacity = new_capacity;
+        }
+        
+        // Allocating into a live slot would leak, and freeing an empty one
+        // would free memory twice.
+        if (live[slot] == is_alloc) {
+            ok = false;
+            break;
+        }
+        live[slot] = is_alloc;
+        
+        if (is_alloc) {
+            trace_alloc(trace, slot, size);
+        } else {
+            trace_free(trace, slot);
+        }
+    }
+    
+    if (!ok) {
+        fprintf(stderr, "%s:%zu: invalid trace operation\n", path, line_number);
+    }
+    
+    free(live);
+    fclose(file);
+    return ok;
+}
+
+struct allocator {
+    const char *name;
+    void *(*alloc)(size_t n);
+    void (*free)(void *ptr);
+    
+    // Get the memory currently reserved by the allocator, or SIZE_MAX if it
+    // can't be measured.
+    size_t (*get_reserved)(void);
+    
+    // Get the most memory reserved since reset_peak_reserved(), or NULL if
+    // that isn't tracked and get_reserved() should be sampled instead.
+    size_t (*get_peak_reserved)(void);
+};
+
+static size_t mem_get_reserved(void) {
+    return reserved_bytes;
+}
+
+static size_t mem_get_peak_reserved(void) {
+    return peak_reserved_bytes;
+}
+
+static void reset_peak_reserved(void) {
+    peak_reserved_bytes = reserved_bytes;
+}
+
+static size_t malloc_get_reserved(void) {
+#ifdef HAVE_MALLINFO2
+    const struct mallinfo2 info = mallinfo2();
+    return info.arena + info.hblkhd;
+#else
+    return SIZE_MAX;
+#endif
+}
+
+static const struct allocator allocators[] = {
+    { "mem_alloc", mem_alloc, mem_free, mem_get_reserved, mem_get_peak_reserved },
+    { "malloc", malloc, free, malloc_get_reserved, NULL },
+};
+
+#define ALLOCATOR_COUNT (sizeof(allocators) / sizeof(allocators[0]))
+
+static double get_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t get_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void do_op(const struct allocator *allocator, void **ptrs, const struct trace_op *op) {
+    if (op->size == 0) {
+        allocator->free(ptrs[op->slot]);
+        ptrs[op->slot] = NULL;
+        return;
+    }
+    
+    uint8_t *ptr = allocator->alloc(op->size);
+    if (ptr == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    
+    // Touch the memory, as a real program would.
+    ptr[0] = 1;
+    ptrs[op->slot] = ptr;
+}
+
+static void free_remaining(const struct allocator *allocator, void **ptrs, size_t slot_count) {
+    for (size_t i = 0; i < slot_count; i++) {
+        if (ptrs[i] == NULL) { continue; }
+        allocator->free(ptrs[i]);
+        ptrs[i] = NULL;
+    }
+}
+
+static int compare_latency(const void *a, const void *b) {
+    const uint32_t left = *(const uint32_t *)a;
+    const uint32_t right = *(const uint32_t *)b;
+    return (left > right) - (left < right);
+}
+
+static uint32_t get_percentile(const uint32_t *sorted, size_t count, double percentile) {
+    size_t index = (size_t)(count * percentile / 100.0);
+    if (index >= count) { index = count - 1; }
+    return sorted[index];
+}
+
+static void run_trace(const struct trace *trace, const struct allocator *allocator) {
+    void **ptrs = calloc(trace->slot_count, sizeof(void *));
+    uint32_t *latencies = malloc(trace->op_count * sizeof(uint32_t));
+    if (ptrs == NULL || latencies == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    
+    // Latency of each operation, and peak memory. This runs first, so memory
+    // left over from the throughput run isn't counted.
+    const size_t start_reserved = allocator->get_reserved();
+    size_t peak_reserved = start_reserved;
+    reset_peak_reserved();
+    for (size_t i = 0; i < trace->op_count; i++) {
+        const uint64_t op_start = get_time_ns();
+        do_op(allocator, ptrs, &(trace->ops[i]));
+        const uint64_t op_time = get_time_ns() - op_start;
+        latencies[i] = op_time > UINT32_MAX ? UINT32_MAX : (uint32_t)op_time;
+        
+        if (allocator->get_peak_reserved == NULL && (i % MEMORY_SAMPLE_INTERVAL) == 0) {
+            const size_t reserved = allocator->get_reserved();
+            if (reserved > peak_reserved) { peak_reserved = reserved; }
+        }
+    }
+    if (allocator->get_peak_reserved != NULL) { peak_reserved = allocator->get_peak_reserved(); }
+    free_remaining(allocator, ptrs, trace->slot_count);
+    
+    // Throughput, without the cost of timing each operation.
+    const double start = get_time();
+    for (size_t i = 0; i < trace->op_count; i++) {
+        do_op(allocator, ptrs, &(trace->ops[i]));
+    }
+    const double elapsed = get_time() - start;
+    free_remaining(allocator, ptrs, trace->slot_count);
+    
+    qsort(latencies, trace->op_count, sizeof(uint32_t), compare_latency);
+    
+    printf("%-18s %-10s %8.2f %7u %7u %7u %8u %9u ", trace->name, allocator->name,
+           trace->op_count / elapsed / 1e6,
+           get_percentile(latencies, trace->op_count, 50.0),
+           get_percentile(latencies, trace->op_count, 90.0),
+           get_percentile(latencies, trace->op_count, 99.0),
+           get_percentile(latencies, trace->op_count, 99.9),
+           latencies[trace->op_count - 1]);
+    if (start_reserved == SIZE_MAX) {
+        printf("%10s\n", "n/a");
+    } else {
+        printf("%10zu\n", (peak_reserved - start_reserved) / 1024);
+    }
+    
+    free(latencies);
+    free(ptrs);
+}
+
+static void run_all(const struct trace *trace) {
+    if (trace->op_count == 0) { return; }
+    
+    // Each run has a process of its own, so it starts with empty heaps and
+    // isn't affected by memory left over from earlier runs.
+    for (size_t i = 0; i < ALLOCATOR_COUNT; i++) {
+        fflush(stdout);
+        const pid_t pid = fork();
+        if (pid < 0) {
+            fprintf(stderr, "Can't fork\n");
+            exit(1);
+        }
+        if (pid == 0) {
+            run_trace(trace, &allocators[i]);
+            fflush(stdout);
+            _exit(0);
+        }
+        
+        int status;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            fprintf(stderr, "%s run of trace '%s' failed\n", allocators[i].name, trace->name);
+            exit(1);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+#ifdef HAVE_MALLINFO2
+    // Keep the benchmark's own large arrays out of malloc's heap, so they
+    // aren't counted as memory used by the traces.
+    mallopt(M_MMAP_THRESHOLD, 128 * 1024);
+#endif
+    
+    printf("%-18s %-10s %8s %7s %7s %7s %8s %9s %10s\n", "trace", "allocator", "Mops/s",
+           "p50 ns", "p90 ns", "p99 ns", "p99.9 ns", "max ns", "peak KB");
+    
+    if (argc > 1) {
+        // Replay recorded traces.
+        for (int i = 1; i < argc; i++) {
+            struct trace trace;
+            if (!load_trace(&trace, argv[i])) {
+                trace_destroy(&trace);
+                return 1;
+            }
+            run_all(&trace);
+            trace_destroy(&trace);
+        }
+        return 0;
+    }
+    
+    void (*const generators[])(struct trace *) = {
+        make_lifo_trace,
+        make_fifo_trace,
+        make_random_trace,
+        make_producer_consumer_trace,
+        make_stress_trace,
+        make_small_trace,
+    };
+    
+    for (size_t i = 0; i < sizeof(generators) / sizeof(generators[0]); i++) {
+        struct trace trace;
+        generators[i](&trace);
+        run_all(&trace);
+        trace_destroy(&trace);
+    }
+    
+    return 0;
+}
@@ -0,0 +1,223 @@
+#include "blockmem.h"
+#include "guard.h"
+#include "mem.h"
+#include "mem_kernel.h"
+#include "mem_stats.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void* mem_block_alloc(size_t n) {
+    assert(n > 0);
+    return malloc(n * MEM_BLOCK_SIZE);
+}
+
+void mem_block_free(void* ptr) {
+    assert(ptr != NULL);
+    free(ptr);
+}
+
+// Last violation passed to record_violation().
+static const char *violation_problem;
+static void *violation_ptr;
+static size_t violation_size;
+static void *violation_call_site;
+
+static void record_violation(const char *problem, void *ptr, size_t size, void *call_site) {
+    violation_problem = problem;
+    violation_ptr = ptr;
+    violation_size = size;
+    violation_call_site = call_site;
+}
+
+static void clear_violation(void) {
+    violation_problem = NULL;
+    violation_ptr = NULL;
+    violation_size = 0;
+    violation_call_site = NULL;
+}
+
+static bool is_violation(const char *problem, void *ptr) {
+    return violation_problem != NULL && strcmp(violation_problem, problem) == 0 &&
+        violation_ptr == ptr;
+}
+
+void test_alloc_and_free(void) {
+    for (size_t i = 1; i < 1000; i++) {
+        uint8_t *ptr = mem_alloc(i);
+        assert(ptr != NULL && ((uintptr_t)ptr & 7) == 0);
+        memset(ptr, 0xAB, i);
+        mem_free(ptr);
+    }
+    
+    uint8_t *large = mem_alloc(100000);
+    memset(large, 0xAB, 100000);
+    mem_free(large);
+    
+    mem_trim();
+    assert(violation_problem == NULL);
+}
+
+void test_alloc_aligned(void) {
+    for (size_t alignment = 1; alignment <= 4096; alignment *= 2) {
+        uint8_t *ptr = mem_alloc_aligned(100, alignment);
+        assert(ptr != NULL && ((uintptr_t)ptr & (alignment - 1)) == 0);
+        memset(ptr, 0xAB, 100);
+        mem_free(ptr);
+    }
+    
+    mem_trim();
+    assert(violation_problem == NULL);
+}
+
+void test_realloc_moves(void) {
+    uint8_t *ptr = mem_realloc(NULL, 10);
+    for (size_t i = 0; i < 10; i++) {
+        ptr[i] = i;
+    }
+    
+    // The old memory goes into the quarantine, even when shrinking.
+    uint8_t *new_ptr = mem_realloc(ptr, 5);
+    assert(new_ptr != ptr);
+    ptr = mem_realloc(new_ptr, 1000);
+    assert(ptr != new_ptr);
+    for (size_t i = 0; i < 5; i++) {
+        assert(ptr[i] == i);
+    }
+    
+    mem_free(ptr);
+    mem_trim();
+    assert(violation_problem == NULL);
+}
+
+void test_buffer_overflow(void) {
+    clear_violation();
+    uint8_t *ptr = mem_alloc(13);
+    ptr[13] = 0;
+    mem_free(ptr);
+    assert(is_violation("buffer overflow", ptr));
+    assert(violation_size == 13 && violation_call_site != NULL);
+}
+
+void test_double_free(void) {
+    clear_violation();
+    void *ptr = mem_alloc(40);
+    mem_free(ptr);
+    assert(violation_problem == NULL);
+    mem_free(ptr);
+    assert(is_violation("double free", ptr));
+    assert(violation_size == 40 && violation_call_site != NULL);
+    mem_trim();
+}
+
+void test_write_after_free(void) {
+    clear_violation();
+    uint8_t *ptr = mem_alloc(100);
+    mem_free(ptr);
+    ptr[50] = 1;
+    
+    // Found when the memory leaves the quarantine.
+    mem_trim();
+    assert(is_violation("write after free", ptr));
+    assert(violation_size == 100);
+}
+
+void test_corrupted_header(void) {
+    clear_violation();
+    uint8_t *ptr = mem_alloc(100);
+    ptr[-1] ^= 1;
+    mem_free(ptr);
+    assert(is_violation("corrupted header or invalid pointer", ptr));
+    assert(violation_size == 0 && violation_call_site == NULL);
+    
+    // The memory was leaked, so it can be freed once repaired.
+    clear_violation();
+    ptr[-1] ^= 1;
+    mem_free(ptr);
+    mem_trim();
+    assert(violation_problem == NULL);
+}
+
+void test_corrupted_size_field(void) {
+    clear_violation();
+    uint8_t *ptr = mem_alloc(100);
+    struct blockmem *mem = blockmem_get_ptr_from_data_ptr(guard_get_mem(ptr));
+    mem->size_field += 64;
+    mem_free(ptr);
+    assert(is_violation("corrupted size field", ptr));
+    assert(violation_size == 100);
+    
+    clear_violation();
+    mem->size_field -= 64;
+    mem_free(ptr);
+    mem_trim();
+    assert(violation_problem == NULL);
+}
+
+void test_quarantine_delays_reuse(void) {
+    mem_trim();
+    
+    void *ptr = mem_alloc(64);
+    mem_free(ptr);
+    
+    struct mem_stats stats;
+    mem_get_stats(&stats);
+    assert(stats.quarantine_count == 1 && stats.quarantine_bytes == 64);
+    
+    void *new_ptr = mem_alloc(64);
+    assert(new_ptr != ptr);
+    mem_free(new_ptr);
+    
+    mem_trim();
+    mem_get_stats(&stats);
+    assert(stats.quarantine_count == 0 && stats.quarantine_bytes == 0);
+}
+
+void test_quarantine_limit(void) {
+    mem_trim();
+    
+    const size_t count = GUARD_QUARANTINE_MAX_COUNT + 100;
+    void **ptrs = malloc(count * sizeof(void *));
+    for (size_t i = 0; i < count; i++) {
+        ptrs[i] = mem_alloc(16);
+    }
+    for (size_t i = 0; i < count; i++) {
+        mem_free(ptrs[i]);
+    }
+    
+    struct mem_stats stats;
+    mem_get_stats(&stats);
+    assert(stats.quarantine_count == GUARD_QUARANTINE_MAX_COUNT);
+    
+    // Freeing more than the byte limit at once releases everything before it.
+    void *large = mem_alloc(GUARD_QUARANTINE_MAX_BYTES + 1);
+    mem_free(large);
+    mem_get_stats(&stats);
+    assert(stats.quarantine_count == 0);
+    
+    free(ptrs);
+    assert(violation_problem == NULL);
+}
+
+int main() {
+    mem_set_violation_handler(record_violation);
+    
+    test_alloc_and_free();
+    test_alloc_aligned();
+    test_realloc_moves();
+    test_buffer_overflow();
+    test_double_free();
+    test_write_after_free();
+    test_corrupted_header();
+    test_corrupted_size_field();
+    test_quarantine_delays_reuse();
+    test_quarantine_limit();
+    
+    printf("Tests complete\n");
+    return 0;
+}
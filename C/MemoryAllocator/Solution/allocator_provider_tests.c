@@ -0,0 +1,188 @@
+#include "mem.h"
+#include "mem_arena.h"
+#include "mem_kernel.h"
+#include "mem_pool.h"
+#include "mem_provider.h"
+#include "mem_stats.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Number of mem_block_alloc() calls not yet matched by mem_block_free().
+size_t live_mem_block_count = 0;
+
+void* mem_block_alloc(size_t n) {
+    assert(n > 0);
+    live_mem_block_count++;
+    return malloc(n * MEM_BLOCK_SIZE);
+}
+
+void mem_block_free(void* ptr) {
+    assert(ptr != NULL);
+    live_mem_block_count--;
+    free(ptr);
+}
+
+static bool is_in(void *ptr, uint8_t *start, size_t size) {
+    return (uint8_t *)ptr >= start && (uint8_t *)ptr < start + size;
+}
+
+static void use_default_provider(void) {
+    struct mem_provider provider;
+    mem_provider_init_kernel(&provider);
+    const bool set = mem_set_provider(&provider);
+    assert(set);
+    (void)set;
+}
+
+void test_kernel_provider(void) {
+    void *ptr = mem_alloc(100);
+    assert(ptr != NULL && live_mem_block_count > 0);
+    mem_free(ptr);
+    mem_trim();
+    assert(live_mem_block_count == 0);
+}
+
+void test_region_provider(void) {
+    const size_t region_size = 1024 * 1024;
+    uint8_t *mem = malloc(region_size);
+    
+    struct mem_provider provider;
+    struct mem_region region;
+    bool initialized = mem_provider_init_region(&provider, &region, mem, region_size, 1000);
+    assert(!initialized);
+    initialized = mem_provider_init_region(&provider, &region, mem, 4095, 4096);
+    assert(!initialized);
+    initialized = mem_provider_init_region(&provider, &region, mem, region_size, 4096);
+    assert(initialized);
+    (void)initialized;
+    bool set = mem_set_provider(&provider);
+    assert(set);
+    
+    // Every kind of allocation comes from the region.
+    void *small = mem_alloc(100);
+    void *large = mem_alloc(100000);
+    struct mem_pool *pool = mem_pool_create(48);
+    void *obj = mem_pool_alloc(pool);
+    struct mem_arena *arena = mem_arena_create();
+    void *arena_ptr = mem_arena_alloc(arena, 1000);
+    assert(is_in(small, mem, region_size) && is_in(large, mem, region_size));
+    assert(is_in(obj, mem, region_size) && is_in(arena_ptr, mem, region_size));
+    assert(mem_region_get_used_bytes(&region) > 100000);
+    assert(live_mem_block_count == 0);
+    
+    // The provider can't change while its memory is in use.
+    struct mem_provider kernel_provider;
+    mem_provider_init_kernel(&kernel_provider);
+    set = mem_set_provider(&kernel_provider);
+    assert(!set);
+    (void)set;
+    
+    mem_arena_destroy(arena);
+    mem_pool_free(pool, obj);
+    mem_pool_destroy(pool);
+    mem_free(large);
+    mem_free(small);
+    mem_trim();
+    assert(mem_region_get_used_bytes(&region) == 0);
+    
+    // Allocations fail once the region is used up, and freed space is merged
+    // so it can be used again.
+    void *ptrs[32];
+    size_t count = 0;
+    while (count < 32 && (ptrs[count] = mem_alloc(100000)) != NULL) {
+        count++;
+    }
+    assert(count >= 8 && count < 32);
+    for (size_t i = 0; i < count; i += 2) {
+        mem_free(ptrs[i]);
+    }
+    for (size_t i = 1; i < count; i += 2) {
+        mem_free(ptrs[i]);
+    }
+    void *whole = mem_alloc(region_size / 2);
+    assert(is_in(whole, mem, region_size));
+    mem_free(whole);
+    assert(mem_region_get_used_bytes(&region) == 0);
+    
+    use_default_provider();
+    free(mem);
+}
+
+void test_mmap_provider(void) {
+    struct mem_provider provider;
+    bool initialized = mem_provider_init_mmap(&provider, 3 * 4096);
+    assert(!initialized);
+    initialized = mem_provider_init_mmap(&provider, 64 * 1024);
+    assert(initialized);
+    (void)initialized;
+    const bool set = mem_set_provider(&provider);
+    assert(set);
+    (void)set;
+    
+    // Blocks are whole pages of the provider.
+    uint8_t *ptr = mem_alloc(100);
+    memset(ptr, 1, 100);
+    struct mem_stats stats;
+    mem_get_stats(&stats);
+    assert(stats.reserved_bytes == 64 * 1024);
+    
+    uint8_t *large = mem_alloc_aligned(200000, 4096);
+    assert(((uintptr_t)large & 4095) == 0);
+    memset(large, 1, 200000);
+    mem_get_stats(&stats);
+    assert(stats.large_count == 1 && stats.reserved_bytes % (64 * 1024) == 0);
+    
+    mem_free(large);
+    mem_free(ptr);
+    use_default_provider();
+    assert(live_mem_block_count == 0);
+}
+
+void test_hugepages_provider(void) {
+    struct mem_provider provider;
+    mem_provider_init_hugepages(&provider, MEM_HUGEPAGES_TRANSPARENT);
+    bool set = mem_set_provider(&provider);
+    assert(set);
+    
+    uint8_t *ptr = mem_alloc(100);
+    memset(ptr, 1, 100);
+    
+    // Allocations of under half a hugepage share blocks rather than taking a
+    // hugepage each.
+    void *medium = mem_alloc(500000);
+    struct mem_stats stats;
+    mem_get_stats(&stats);
+    assert(stats.large_count == 0 && stats.reserved_bytes == MEM_HUGEPAGE_SIZE);
+    
+    mem_free(medium);
+    mem_free(ptr);
+    use_default_provider();
+    
+    // There may be no hugepages reserved, in which case allocations fail.
+    mem_provider_init_hugepages(&provider, MEM_HUGEPAGES_EXPLICIT);
+    set = mem_set_provider(&provider);
+    assert(set);
+    (void)set;
+    ptr = mem_alloc(100);
+    if (ptr != NULL) {
+        memset(ptr, 1, 100);
+        mem_free(ptr);
+    }
+    use_default_provider();
+}
+
+int main() {
+    test_kernel_provider();
+    test_region_provider();
+    test_mmap_provider();
+    test_hugepages_provider();
+    
+    printf("Tests complete\n");
+    return 0;
+}
@@ -0,0 +1,245 @@
+// Linked against libmemalloc, so malloc() etc. here and in libc are the
+// shim's.
+
+#include <assert.h>
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define THREAD_COUNT 4
+
+// Too large to allocate. Volatile so the compiler doesn't warn about it.
+static volatile size_t huge_size = SIZE_MAX / 2;
+
+static bool is_aligned(void *ptr, size_t alignment) {
+    return ((uintptr_t)ptr % alignment) == 0;
+}
+
+void test_malloc(void) {
+    // malloc(0) returns memory that can be freed.
+    void *empty = malloc(0);
+    assert(empty != NULL);
+    free(empty);
+    free(NULL);
+    
+    // Memory is aligned for any type that fits in it.
+    for (size_t size = 1; size < 2000; size += 7) {
+        uint8_t *ptr = malloc(size);
+        assert(is_aligned(ptr, size < 16 ? 8 : 16));
+        assert(malloc_usable_size(ptr) >= size);
+        memset(ptr, 1, size);
+        free(ptr);
+    }
+    
+    // Aligned memory is packed without padding: 32 bytes take 48 with the
+    // header.
+    uint8_t *ptrs[100];
+    for (size_t i = 0; i < 100; i++) {
+        ptrs[i] = malloc(32);
+        assert(is_aligned(ptrs[i], 16));
+    }
+    size_t packed_count = 0;
+    for (size_t i = 1; i < 100; i++) {
+        if (ptrs[i] - ptrs[i - 1] == 48) { packed_count++; }
+    }
+    assert(packed_count >= 90);
+    (void)packed_count;
+    for (size_t i = 0; i < 100; i++) {
+        free(ptrs[i]);
+    }
+    
+    void *large = malloc(1000000);
+    assert(is_aligned(large, 16) && malloc_usable_size(large) >= 1000000);
+    memset(large, 1, 1000000);
+    free(large);
+    
+    errno = 0;
+    void *huge = malloc(huge_size);
+    const int error = errno;
+    assert(huge == NULL && error == ENOMEM);
+    (void)huge;
+    (void)error;
+}
+
+void test_calloc(void) {
+    // Reused memory is cleared.
+    uint8_t *dirty = malloc(1000);
+    memset(dirty, 0xFF, 1000);
+    free(dirty);
+    
+    uint8_t *ptr = calloc(10, 100);
+    for (size_t i = 0; i < 1000; i++) {
+        assert(ptr[i] == 0);
+    }
+    free(ptr);
+    
+    errno = 0;
+    void *huge = calloc(huge_size, 4);
+    const int error = errno;
+    assert(huge == NULL && error == ENOMEM);
+    (void)huge;
+    (void)error;
+}
+
+void test_realloc(void) {
+    uint8_t *ptr = realloc(NULL, 10);
+    memset(ptr, 3, 10);
+    
+    // Growing keeps the contents and the alignment, wherever it moves to.
+    for (size_t size = 20; size < 100000; size *= 3) {
+        ptr = realloc(ptr, size);
+        assert(ptr != NULL && is_aligned(ptr, 16));
+        for (size_t i = 0; i < 10; i++) {
+            assert(ptr[i] == 3);
+        }
+    }
+    
+    ptr = reallocarray(ptr, 10, 2);
+    assert(ptr[9] == 3);
+    void *huge = reallocarray(ptr, huge_size, 4);
+    assert(huge == NULL);
+    (void)huge;
+    
+    // A size of zero frees the memory.
+    ptr = realloc(ptr, 0);
+    assert(ptr == NULL);
+}
+
+void test_aligned(void) {
+    void *ptr = NULL;
+    int result = posix_memalign(&ptr, 3, 100);
+    assert(result == EINVAL);
+    result = posix_memalign(&ptr, 4, 100);
+    assert(result == EINVAL);
+    result = posix_memalign(&ptr, 64, 100);
+    assert(result == 0 && is_aligned(ptr, 64));
+    free(ptr);
+    result = posix_memalign(&ptr, 64, 0);
+    assert(result == 0);
+    (void)result;
+    free(ptr);
+    
+    ptr = aligned_alloc(4096, 5000);
+    assert(is_aligned(ptr, 4096));
+    free(ptr);
+    ptr = aligned_alloc(48, 100);
+    assert(ptr == NULL);
+    
+    // memalign() rounds the alignment up to a power of two.
+    ptr = memalign(48, 100);
+    assert(is_aligned(ptr, 64));
+    free(ptr);
+    
+    const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    ptr = valloc(10);
+    assert(is_aligned(ptr, page_size));
+    free(ptr);
+    ptr = pvalloc(10);
+    assert(is_aligned(ptr, page_size) && malloc_usable_size(ptr) >= page_size);
+    (void)page_size;
+    free(ptr);
+}
+
+void test_libc(void) {
+    // Memory allocated inside libc can be freed here, and the other way round.
+    char *copy = strdup("shim");
+    assert(strcmp(copy, "shim") == 0);
+    free(copy);
+    
+    FILE *file = fopen("/dev/null", "w");
+    setvbuf(file, malloc(100), _IOFBF, 100);
+    fprintf(file, "%d\n", 42);
+    fclose(file);
+    
+    // glibc's own malloc is never used.
+    const size_t glibc_bytes = mallinfo2().uordblks;
+    void *ptrs[100];
+    for (size_t i = 0; i < 100; i++) {
+        ptrs[i] = malloc(i * 100);
+    }
+    assert(mallinfo2().uordblks == glibc_bytes);
+    (void)glibc_bytes;
+    for (size_t i = 0; i < 100; i++) {
+        free(ptrs[i]);
+    }
+}
+
+static atomic_bool stop;
+
+// Allocate and free in a loop, passing memory between threads through a
+// shared slot.
+static void *churn(void *arg) {
+    static void *_Atomic shared;
+    unsigned seed = (unsigned)(uintptr_t)arg;
+    void *ptrs[64] = { NULL };
+    
+    while (!atomic_load(&stop)) {
+        seed = seed * 1103515245 + 12345;
+        const size_t i = (seed >> 8) % 64;
+        free(ptrs[i]);
+        ptrs[i] = malloc((seed >> 16) % 2000);
+        ptrs[(i + 1) % 64] = __atomic_exchange_n(&shared, ptrs[(i + 1) % 64], __ATOMIC_ACQ_REL);
+    }
+    
+    for (size_t i = 0; i < 64; i++) {
+        free(ptrs[i]);
+    }
+    free(__atomic_exchange_n(&shared, NULL, __ATOMIC_ACQ_REL));
+    return NULL;
+}
+
+void test_threads_and_fork(void) {
+    pthread_t threads[THREAD_COUNT];
+    for (size_t i = 0; i < THREAD_COUNT; i++) {
+        pthread_create(&threads[i], NULL, churn, (void *)(i + 1));
+    }
+    
+    // The child must be able to allocate even if another thread was in the
+    // middle of doing so when it forked.
+    for (int i = 0; i < 50; i++) {
+        const pid_t pid = fork();
+        if (pid == 0) {
+            char *ptrs[100];
+            for (size_t j = 0; j < 100; j++) {
+                ptrs[j] = malloc(j * 50 + 1);
+                ptrs[j][0] = 1;
+            }
+            for (size_t j = 0; j < 100; j++) {
+                free(ptrs[j]);
+            }
+            _exit(0);
+        }
+        
+        assert(pid > 0);
+        int status = 0;
+        const pid_t waited = waitpid(pid, &status, 0);
+        assert(waited == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+        (void)waited;
+    }
+    
+    atomic_store(&stop, true);
+    for (size_t i = 0; i < THREAD_COUNT; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+int main() {
+    test_malloc();
+    test_calloc();
+    test_realloc();
+    test_aligned();
+    test_libc();
+    test_threads_and_fork();
+    
+    printf("Tests complete\n");
+    return 0;
+}
@@ -1,5 +1,11 @@
+#include "heap.h"
 #include "mem.h"
+#include "mem_arena.h"
+#include "mem_heap.h"
 #include "mem_kernel.h"
+#include "mem_pool.h"
+#include "mem_profile.h"
+#include "mem_stats.h"
 
 #include <assert.h>
 #include <stdbool.h>
@@ -7,23 +13,42 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 // Set this to true in a test to simulate out of memory.
 bool memory_exhausted = false;
 
+// Number of mem_block_alloc() calls not yet matched by mem_block_free().
+size_t live_mem_block_count = 0;
+
+// Number of mem_block_alloc() calls made.
+size_t total_mem_block_count = 0;
+
 void* mem_block_alloc(size_t n) {
     assert(n > 0);
     if (memory_exhausted) {
         return NULL;
     }
+    live_mem_block_count++;
+    total_mem_block_count++;
     return malloc(n * MEM_BLOCK_SIZE);
 }
 
 void mem_block_free(void* ptr) {
     assert(ptr != NULL);
+    live_mem_block_count--;
     free(ptr);
 }
 
+// Size of the allocations tests use to keep others apart. With
+// HEAP_SMALL_PAGES these must be too large for the small pages.
+#ifdef HEAP_SMALL_PAGES
+#define GUARD_SIZE (SMALL_MAX_SIZE + 1)
+#else
+#define GUARD_SIZE 1
+#endif
+
 void test_alloc_zero(void) {
     void *ptr = mem_alloc(0);
     assert(ptr == NULL);
@@ -50,6 +75,23 @@ void test_alloc_and_free(void) {
     }
 }
 
+void test_alloc_and_free_retains_block(void) {
+    mem_trim();
+    const size_t start_live_count = live_mem_block_count;
+    const size_t start_total_count = total_mem_block_count;
+    
+    // The block emptied by each free is kept and reused by the next alloc.
+    for (size_t i = 0; i < 1000; i++) {
+        void *ptr = mem_alloc(100);
+        mem_free(ptr);
+    }
+    assert(total_mem_block_count == start_total_count + 1);
+    assert(live_mem_block_count == start_live_count + 1);
+    
+    mem_trim();
+    assert(live_mem_block_count == start_live_count);
+}
+
 void test_store_and_check(void) {
     size_t *ptrs[100];
     for (size_t i = 0; i < 100; i++) {
@@ -93,7 +135,12 @@ void test_alloc_grow(void) {
     void *p2 = mem_alloc(30);
     mem_free(p2);
     
+#if defined(HEAP_SMALL_PAGES)
+    // Each size up to SMALL_MAX_SIZE has pages of its own.
+    assert(p0 != p1 && p1 != p2);
+#else
     assert(p0 == p1 && p1 == p2);
+#endif
 }
 
 void test_stable_ptr(void) {
@@ -132,16 +179,991 @@ void test_stress(void) {
     mem_free(allocs);
 }
 
+void test_alloc_reuse_size_class(void) {
+    const size_t sizes[] = { 1, 24, 100, 512, 600, 3000 };
+    const size_t size_count = sizeof(sizes) / sizeof(sizes[0]);
+    void *ptrs[sizeof(sizes) / sizeof(sizes[0])];
+    
+    // Keep each allocation apart from the next so frees can't merge.
+    void *guards[sizeof(sizes) / sizeof(sizes[0])];
+    for (size_t i = 0; i < size_count; i++) {
+        ptrs[i] = mem_alloc(sizes[i]);
+        guards[i] = mem_alloc(GUARD_SIZE);
+    }
+    
+    for (size_t i = 0; i < size_count; i++) {
+        mem_free(ptrs[i]);
+    }
+    
+    // Freed memory is reused for allocations of the same size.
+    for (size_t i = size_count; i > 0; i--) {
+        void *new_p = mem_alloc(sizes[i - 1]);
+#if FREELIST_PLACEMENT == FREELIST_ADDRESS_ORDERED
+        // Large sizes may use lower addressed free space in another block.
+        assert(new_p == ptrs[i - 1] || sizes[i - 1] > FREELIST_SMALL_MAX_SIZE);
+#else
+        assert(new_p == ptrs[i - 1]);
+#endif
+        ptrs[i - 1] = new_p;
+    }
+    
+    for (size_t i = 0; i < size_count; i++) {
+        mem_free(ptrs[i]);
+        mem_free(guards[i]);
+    }
+}
+
+void test_no_overlap(void) {
+    const size_t alloc_count = 2000;
+    uint8_t *ptrs[2000];
+    size_t sizes[2000];
+    
+    for (size_t i = 0; i < alloc_count; i++) {
+        sizes[i] = ((i * 37) % 700) + 1;
+        ptrs[i] = mem_alloc(sizes[i]);
+        for (size_t j = 0; j < sizes[i]; j++) {
+            ptrs[i][j] = (uint8_t)i;
+        }
+    }
+    
+    // Free every other allocation and refill with different sizes.
+    for (size_t i = 0; i < alloc_count; i += 2) {
+        mem_free(ptrs[i]);
+        sizes[i] = ((i * 53) % 300) + 1;
+        ptrs[i] = mem_alloc(sizes[i]);
+        for (size_t j = 0; j < sizes[i]; j++) {
+            ptrs[i][j] = (uint8_t)i;
+        }
+    }
+    
+    for (size_t i = 0; i < alloc_count; i++) {
+        for (size_t j = 0; j < sizes[i]; j++) {
+            assert(ptrs[i][j] == (uint8_t)i);
+        }
+        mem_free(ptrs[i]);
+    }
+}
+
+void test_placement(void) {
+    void *guard = mem_alloc(GUARD_SIZE);
+    void *small_hole = mem_alloc(700);
+    void *small_guard = mem_alloc(GUARD_SIZE);
+    void *large_hole = mem_alloc(1000);
+    void *large_guard = mem_alloc(GUARD_SIZE);
+    
+    // Both holes are in the same size class; the larger was freed last.
+    mem_free(small_hole);
+    mem_free(large_hole);
+    
+    void *ptr = mem_alloc(600);
+    assert(ptr != NULL);
+#if FREELIST_PLACEMENT == FREELIST_FIRST_FIT
+    assert(ptr == large_hole);
+#elif FREELIST_PLACEMENT == FREELIST_BEST_FIT
+    assert(ptr == small_hole);
+#endif
+    
+    mem_free(ptr);
+    mem_free(large_guard);
+    mem_free(small_guard);
+    mem_free(guard);
+}
+
+void test_free_coalesce(void) {
+    // Keep the block alive while the other allocations are freed.
+    void *guard = mem_alloc(GUARD_SIZE);
+    
+    uint8_t *a = mem_alloc(96);
+    uint8_t *b = mem_alloc(96);
+    uint8_t *c = mem_alloc(96);
+    void *end_guard = mem_alloc(GUARD_SIZE);
+    assert(a < b && b < c);
+    
+    // Freeing 'b' last has to merge with free space on both sides.
+    mem_free(a);
+    mem_free(c);
+    mem_free(b);
+    
+    uint8_t *p = mem_alloc(c + 96 - a);
+    assert(p == a);
+    
+    mem_free(p);
+    mem_free(end_guard);
+    mem_free(guard);
+}
+
+void test_deferred_coalescing(void) {
+#ifdef HEAP_DEFERRED_COALESCING
+    void *guard = mem_alloc(GUARD_SIZE);
+    uint8_t *a = mem_alloc(96);
+    uint8_t *b = mem_alloc(96);
+    void *end_guard = mem_alloc(GUARD_SIZE);
+    
+    // Small frees wait on quick lists without being merged, and the same
+    // size is handed straight back out.
+    mem_free(a);
+    mem_free(b);
+    struct mem_stats stats;
+    mem_get_stats(&stats);
+    assert(stats.deferred_count == 2);
+    
+    // They're still marked as allocated, but freeing one again is caught.
+    assert(blockmem_is_deferred(blockmem_get_ptr_from_data_ptr(a)));
+    uint8_t *reused = mem_alloc(96);
+    assert(reused == b && !blockmem_is_deferred(blockmem_get_ptr_from_data_ptr(reused)));
+    (void)reused;
+    
+    // Merging them makes one larger space.
+    mem_free(b);
+    mem_trim();
+    mem_get_stats(&stats);
+    assert(stats.deferred_count == 0);
+    uint8_t *p = mem_alloc(b + 96 - a);
+    assert(p == a);
+    mem_free(p);
+    
+    // Too many waiting frees are merged automatically.
+    void *ptrs[HEAP_QUICK_MAX_COUNT + 1];
+    for (size_t i = 0; i < HEAP_QUICK_MAX_COUNT + 1; i++) {
+        ptrs[i] = mem_alloc(GUARD_SIZE);
+    }
+    for (size_t i = 0; i < HEAP_QUICK_MAX_COUNT + 1; i++) {
+        mem_free(ptrs[i]);
+    }
+    mem_get_stats(&stats);
+    assert(stats.deferred_count < HEAP_QUICK_MAX_COUNT);
+    
+    mem_free(end_guard);
+    mem_free(guard);
+#endif
+}
+
+void test_small_pages(void) {
+#ifdef HEAP_SMALL_PAGES
+    mem_trim();
+    struct mem_stats start;
+    mem_get_stats(&start);
+    
+    // Objects of the same size are packed with no header between them.
+    uint8_t *ptrs[1000];
+    for (size_t i = 0; i < 1000; i++) {
+        ptrs[i] = mem_alloc(8);
+    }
+    size_t packed_count = 0;
+    for (size_t i = 1; i < 1000; i++) {
+        if (ptrs[i] - ptrs[i - 1] == 8) { packed_count++; }
+    }
+    assert(packed_count >= 990);
+    
+    struct mem_stats stats;
+    mem_get_stats(&stats);
+    assert(stats.alloc_count == start.alloc_count + 1000);
+    assert(stats.allocated_bytes == start.allocated_bytes + 1000 * 8);
+    assert(stats.small_page_count >= start.small_page_count + 2);
+    
+    // They can be resized in place up to their object size.
+    uint8_t *resized = mem_realloc(ptrs[0], 8);
+    assert(resized == ptrs[0]);
+    (void)resized;
+    uint8_t *moved = mem_realloc(ptrs[0], 9);
+    assert(moved != NULL && moved != ptrs[0]);
+    ptrs[0] = moved;
+    
+    // A freed object is handed straight back out.
+    mem_free(ptrs[500]);
+    uint8_t *reused = mem_alloc(8);
+    assert(reused == ptrs[500]);
+    (void)reused;
+    
+    for (size_t i = 0; i < 1000; i++) {
+        mem_free(ptrs[i]);
+    }
+    mem_trim();
+    mem_get_stats(&stats);
+    assert(stats.alloc_count == start.alloc_count);
+    assert(stats.small_page_count == start.small_page_count);
+    
+    // Emptied pages are reused, for any size, rather than taking more memory.
+    const size_t reserved_bytes = stats.reserved_bytes;
+    for (size_t i = 0; i < 1000; i++) {
+        ptrs[i] = mem_alloc(16);
+    }
+    mem_get_stats(&stats);
+    assert(stats.reserved_bytes == reserved_bytes);
+    for (size_t i = 0; i < 1000; i++) {
+        mem_free(ptrs[i]);
+    }
+#endif
+}
+
+void test_realloc_null_and_zero(void) {
+    void *ptr = mem_realloc(NULL, 10);
+    assert(ptr != NULL);
+    
+    void *new_ptr = mem_realloc(ptr, 0);
+    assert(new_ptr == NULL);
+    (void)new_ptr;
+}
+
+void test_realloc_grow_in_place(void) {
+    // Nothing is allocated after 'ptr', so it can keep growing in place.
+    uint8_t *ptr = mem_alloc(16);
+    for (size_t i = 0; i < 16; i++) {
+        ptr[i] = (uint8_t)i;
+    }
+    
+#ifdef HEAP_SMALL_PAGES
+    // Small objects can't grow beyond their size, so move it into a block.
+    ptr = mem_realloc(ptr, SMALL_MAX_SIZE + 1);
+#endif
+    
+    for (size_t size = 32; size <= 2048; size *= 2) {
+        uint8_t *new_ptr = mem_realloc(ptr, size);
+        assert(new_ptr == ptr);
+    }
+    
+    for (size_t i = 0; i < 16; i++) {
+        assert(ptr[i] == (uint8_t)i);
+    }
+    
+    mem_free(ptr);
+}
+
+void test_resize(void) {
+    uint8_t *ptr = mem_alloc(100);
+    memset(ptr, 5, 100);
+    
+    // Nothing is allocated after 'ptr', so it can grow without moving.
+    bool resized = mem_resize(ptr, 1000);
+    assert(resized && mem_get_usable_size(ptr) >= 1000);
+    assert(ptr[99] == 5);
+    
+    // It can't once something is.
+    void *guard = mem_alloc(GUARD_SIZE);
+    resized = mem_resize(ptr, 100000);
+    assert(!resized);
+    resized = mem_resize(ptr, 50);
+    assert(resized);
+    
+    assert(!mem_resize(ptr, 0) && !mem_resize(NULL, 10));
+    mem_free(guard);
+    mem_free(ptr);
+    mem_heap_t *heap = mem_heap_create();
+    ptr = mem_heap_alloc(heap, 100);
+    resized = mem_heap_resize(heap, ptr, 1000);
+    assert(resized);
+    resized = mem_heap_resize(heap, ptr, 1000000);
+    assert(!resized);
+    (void)resized;
+    mem_heap_destroy(heap);
+}
+
+void test_good_size(void) {
+    const size_t sizes[] = { 1, 13, 100, 1000 };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        const size_t good_size = mem_good_size(sizes[i]);
+        assert(good_size >= sizes[i]);
+        assert(mem_good_size(good_size) == good_size);
+        
+        void *ptr = mem_alloc(sizes[i]);
+        assert(mem_get_usable_size(ptr) >= good_size);
+        mem_free(ptr);
+    }
+#if !defined(MEM_HARDENED) && !defined(HEAP_SMALL_PAGES)
+    // Heap slots always have room for free list links.
+    assert(mem_good_size(1) == mem_good_size(24) && mem_good_size(24) == 24);
+#elif !defined(MEM_HARDENED)
+    assert(mem_good_size(1) == 8);
+#endif
+    // Large allocations use whole pages, so the good size is exact.
+    const size_t large_size = 100001;
+    void *ptr = mem_alloc(large_size);
+    assert(mem_good_size(large_size) > large_size);
+    assert(mem_good_size(large_size) == mem_get_usable_size(ptr));
+    mem_free(ptr);
+}
+
+void test_realloc_move(void) {
+    uint8_t *ptr = mem_alloc(16);
+    for (size_t i = 0; i < 16; i++) {
+        ptr[i] = (uint8_t)i;
+    }
+    
+    // Block growth in place.
+    void *guard = mem_alloc(GUARD_SIZE);
+    
+    uint8_t *new_ptr = mem_realloc(ptr, 1000);
+    assert(new_ptr != ptr);
+    for (size_t i = 0; i < 16; i++) {
+        assert(new_ptr[i] == (uint8_t)i);
+    }
+    
+    mem_free(guard);
+    mem_free(new_ptr);
+}
+
+void test_realloc_aligned(void) {
+    uint8_t *ptr = mem_alloc(8);
+    memset(ptr, 7, 8);
+    
+    // The memory moves to an aligned address, and stays aligned as it grows.
+    for (size_t n = 16; n < 100000; n *= 3) {
+        uint8_t *new_ptr = mem_realloc_aligned(ptr, n, 64);
+        assert(new_ptr != NULL && ((uintptr_t)new_ptr % 64) == 0);
+        for (size_t i = 0; i < 8; i++) {
+            assert(new_ptr[i] == 7);
+        }
+        ptr = new_ptr;
+    }
+    
+    assert(mem_realloc_aligned(ptr, 100, 48) == NULL);
+    mem_free(ptr);
+}
+
+void test_realloc_shrink(void) {
+    void *guard = mem_alloc(GUARD_SIZE);
+    uint8_t *ptr = mem_alloc(1000);
+    void *end_guard = mem_alloc(GUARD_SIZE);
+    
+    // Shrinking is done in place, and the space freed can be reused.
+    void *new_ptr = mem_realloc(ptr, 100);
+    assert(new_ptr == ptr);
+    (void)new_ptr;
+    void *rest = mem_alloc(800);
+    assert((uint8_t *)rest > ptr && (uint8_t *)rest < ptr + 1000);
+    
+    mem_free(rest);
+    mem_free(ptr);
+    mem_free(end_guard);
+    mem_free(guard);
+}
+
+void test_alloc_aligned(void) {
+    const size_t alignments[] = { 8, 16, 32, 64, 4096 };
+    const size_t sizes[] = { 1, 24, 100, 5000 };
+    void *ptrs[5][4];
+    
+    for (size_t i = 0; i < 5; i++) {
+        for (size_t j = 0; j < 4; j++) {
+            uint8_t *ptr = mem_alloc_aligned(sizes[j], alignments[i]);
+            assert(ptr != NULL);
+            assert(((uintptr_t)ptr % alignments[i]) == 0);
+            for (size_t k = 0; k < sizes[j]; k++) {
+                ptr[k] = (uint8_t)(i + j);
+            }
+            ptrs[i][j] = ptr;
+        }
+    }
+    
+    for (size_t i = 0; i < 5; i++) {
+        for (size_t j = 0; j < 4; j++) {
+            const uint8_t *ptr = ptrs[i][j];
+            for (size_t k = 0; k < sizes[j]; k++) {
+                assert(ptr[k] == (uint8_t)(i + j));
+            }
+            mem_free(ptrs[i][j]);
+        }
+    }
+    
+    assert(mem_alloc_aligned(0, 16) == NULL);
+    assert(mem_alloc_aligned(16, 0) == NULL);
+    assert(mem_alloc_aligned(16, 48) == NULL);
+}
+
+void test_alloc_aligned_packed(void) {
+    // Padding between aligned allocations is small, rather than wasting
+    // whole blocks.
+    uint8_t *ptrs[20];
+    for (size_t i = 0; i < 20; i++) {
+        ptrs[i] = mem_alloc_aligned(64, 64);
+    }
+    
+    size_t packed_count = 0;
+    for (size_t i = 1; i < 20; i++) {
+        if (ptrs[i] - ptrs[i - 1] == 128) { packed_count++; }
+    }
+    assert(packed_count >= 15);
+    
+    // The padding is reused for ordinary allocations (which would go in
+    // small pages with HEAP_SMALL_PAGES).
+#ifndef HEAP_SMALL_PAGES
+    void *small = mem_alloc(40);
+    assert((uint8_t *)small > ptrs[0] && (uint8_t *)small < ptrs[19]);
+    mem_free(small);
+#endif
+    
+    for (size_t i = 0; i < 20; i++) {
+        mem_free(ptrs[i]);
+    }
+}
+
+void test_alloc_large(void) {
+    // Large allocations get memory of their own, which is returned as soon
+    // as they're freed.
+    const size_t start_count = live_mem_block_count;
+    const size_t alloc_size = 1000000;
+    uint8_t *ptr = mem_alloc(alloc_size);
+    assert(ptr != NULL);
+    assert(live_mem_block_count == start_count + 1);
+    for (size_t i = 0; i < alloc_size; i++) {
+        ptr[i] = (uint8_t)i;
+    }
+    
+    // Small allocations don't go into the large allocation's memory.
+    uint8_t *small = mem_alloc(100);
+    assert(small + 100 <= ptr || small >= ptr + alloc_size);
+    mem_free(small);
+    
+    mem_free(ptr);
+    assert(live_mem_block_count == start_count);
+    
+    void *aligned = mem_alloc_aligned(alloc_size, 4096);
+    assert(((uintptr_t)aligned % 4096) == 0);
+    assert(live_mem_block_count == start_count + 1);
+    mem_free(aligned);
+    assert(live_mem_block_count == start_count);
+}
+
+void test_realloc_large(void) {
+    const size_t start_count = live_mem_block_count;
+    
+    uint8_t *ptr = mem_alloc(1000);
+    for (size_t i = 0; i < 1000; i++) {
+        ptr[i] = (uint8_t)i;
+    }
+    
+    // Growing past the threshold moves to a large allocation.
+    ptr = mem_realloc(ptr, 200000);
+    for (size_t i = 0; i < 1000; i++) {
+        assert(ptr[i] == (uint8_t)i);
+    }
+    
+    // Shrinking a little stays in place.
+    uint8_t *shrunk = mem_realloc(ptr, 190000);
+    assert(shrunk == ptr);
+    
+    // Shrinking to a small size returns the large memory.
+    ptr = mem_realloc(ptr, 500);
+    for (size_t i = 0; i < 500; i++) {
+        assert(ptr[i] == (uint8_t)i);
+    }
+    mem_free(ptr);
+    
+    assert(live_mem_block_count == start_count);
+}
+
+void test_pool_create_zero(void) {
+    assert(mem_pool_create(0) == NULL);
+}
+
+void test_pool_store_and_check(void) {
+    const size_t start_count = live_mem_block_count;
+    struct mem_pool *pool = mem_pool_create(sizeof(size_t));
+    
+    // Enough objects to need several slabs.
+    size_t *ptrs[5000];
+    for (size_t i = 0; i < 5000; i++) {
+        ptrs[i] = mem_pool_alloc(pool);
+        assert(((uintptr_t)ptrs[i] % 8) == 0);
+    }
+    for (size_t i = 0; i < 5000; i++) {
+        *(ptrs[i]) = i;
+    }
+    for (size_t i = 0; i < 5000; i++) {
+        assert(*(ptrs[i]) == i);
+    }
+    
+    // Objects have no header, so they're packed together.
+    for (size_t i = 1; i < 100; i++) {
+        assert(ptrs[i] == ptrs[i - 1] + 1);
+    }
+    
+    for (size_t i = 0; i < 5000; i++) {
+        mem_pool_free(pool, ptrs[i]);
+    }
+    
+    mem_pool_destroy(pool);
+    assert(live_mem_block_count == start_count);
+}
+
+void test_pool_reuse(void) {
+    struct mem_pool *pool = mem_pool_create(100);
+    
+    void *ptrs[100];
+    for (size_t i = 0; i < 100; i++) {
+        ptrs[i] = mem_pool_alloc(pool);
+    }
+    
+    void *p = ptrs[42];
+    mem_pool_free(pool, p);
+    void *new_p = mem_pool_alloc(pool);
+    assert(p == new_p);
+    
+    // Objects still allocated are released with the pool.
+    mem_pool_free(pool, NULL);
+    mem_pool_destroy(pool);
+}
+
+void test_arena_alloc(void) {
+    const size_t start_count = live_mem_block_count;
+    struct mem_arena *arena = mem_arena_create();
+    assert(mem_arena_alloc(arena, 0) == NULL);
+    
+    size_t *ptrs[10000];
+    for (size_t i = 0; i < 10000; i++) {
+        ptrs[i] = mem_arena_alloc(arena, (i % 3) + 1);
+        assert(((uintptr_t)ptrs[i] % 8) == 0);
+        *(ptrs[i]) = i;
+    }
+    for (size_t i = 0; i < 10000; i++) {
+        assert(*(ptrs[i]) == i);
+    }
+    
+    // Allocations have no header, so they're packed together.
+    assert(ptrs[1] == ptrs[0] + 1);
+    
+    // Allocations bigger than a chunk get a chunk of their own.
+    uint8_t *huge = mem_arena_alloc(arena, 1000000);
+    for (size_t i = 0; i < 1000000; i++) {
+        huge[i] = 100;
+    }
+    
+    mem_arena_destroy(arena);
+    assert(live_mem_block_count == start_count);
+}
+
+void test_arena_marks(void) {
+    const size_t start_count = live_mem_block_count;
+    struct mem_arena *arena = mem_arena_create();
+    const size_t empty_count = live_mem_block_count;
+    
+    void *before = mem_arena_alloc(arena, 16);
+    const struct mem_arena_mark outer = mem_arena_save(arena);
+    void *first = mem_arena_alloc(arena, 16);
+    
+    const struct mem_arena_mark inner = mem_arena_save(arena);
+    for (size_t i = 0; i < 1000; i++) {
+        mem_arena_alloc(arena, 1000);
+    }
+    const size_t inner_count = live_mem_block_count;
+    mem_arena_restore(arena, inner);
+    assert(live_mem_block_count < inner_count);
+    
+    // Restoring a mark makes its memory available again.
+    void *second = mem_arena_alloc(arena, 16);
+    assert(second != first);
+    mem_arena_restore(arena, outer);
+    void *third = mem_arena_alloc(arena, 16);
+    assert(third == first);
+    (void)third;
+    
+    // Reset keeps one chunk and reuses it from the start.
+    mem_arena_reset(arena);
+    assert(live_mem_block_count == empty_count + 1);
+    void *after = mem_arena_alloc(arena, 16);
+    assert(after == before);
+    (void)after;
+    
+    mem_arena_destroy(arena);
+    assert(live_mem_block_count == start_count);
+}
+
+void test_heaps(void) {
+    mem_trim();
+    const size_t start_count = live_mem_block_count;
+    struct mem_stats start;
+    mem_get_stats(&start);
+    
+    mem_heap_t *heaps[2] = { mem_heap_create(), mem_heap_create() };
+    assert(mem_heap_alloc(heaps[0], 0) == NULL);
+    mem_heap_free(heaps[0], NULL);
+    
+    size_t *ptrs[2][1000];
+    for (size_t i = 0; i < 1000; i++) {
+        for (size_t h = 0; h < 2; h++) {
+            ptrs[h][i] = mem_heap_alloc(heaps[h], GUARD_SIZE + 8 + i % 200);
+            *(ptrs[h][i]) = i + h;
+        }
+    }
+    void *large = mem_heap_alloc(heaps[0], 200000);
+    memset(large, 1, 200000);
+    
+    // The heaps share no blocks with each other or with mem_alloc().
+    struct mem_stats stats[2];
+    mem_heap_get_stats(heaps[0], &stats[0]);
+    mem_heap_get_stats(heaps[1], &stats[1]);
+    assert(stats[0].alloc_count == 1000 && stats[0].large_count == 1);
+    assert(stats[1].alloc_count == 1000 && stats[1].large_count == 0);
+    for (size_t i = 0; i < 1000; i++) {
+        assert(heap_get_owner(ptrs[0][i]) != heap_get_owner(ptrs[1][i]));
+    }
+    // mem_get_stats() sees only the heaps themselves and the large allocation.
+    struct mem_stats current;
+    mem_get_stats(&current);
+    assert(current.alloc_count == start.alloc_count + 2);
+    assert(current.large_count == start.large_count + 1);
+    
+    // Freed memory is reused within its heap.
+    for (size_t i = 0; i < 1000; i++) {
+        assert(*(ptrs[0][i]) == i && *(ptrs[1][i]) == i + 1);
+        if (i % 2 == 0) { mem_heap_free(heaps[1], ptrs[1][i]); }
+    }
+    mem_heap_get_stats(heaps[1], &stats[1]);
+    assert(stats[1].alloc_count == 500 && stats[1].free_count > 0);
+    
+#ifdef HEAP_SMALL_PAGES
+    // Small objects go in small pages of the heap's own.
+    mem_heap_alloc(heaps[1], 8);
+    mem_heap_get_stats(heaps[1], &stats[1]);
+    assert(stats[1].small_page_count == 1);
+#endif
+    
+    // Destroying a heap releases everything still allocated from it.
+    mem_heap_free(heaps[0], large);
+    large = mem_heap_alloc(heaps[0], 300000);
+    mem_heap_destroy(heaps[0]);
+    mem_heap_destroy(heaps[1]);
+    mem_trim();
+    assert(live_mem_block_count == start_count);
+}
+
+void test_alloc_batch(void) {
+    mem_trim();
+    const size_t start_count = live_mem_block_count;
+    struct mem_stats start;
+    mem_get_stats(&start);
+    
+    void *ptrs[300];
+    bool allocated = mem_alloc_batch(0, 300, ptrs);
+    assert(!allocated);
+    allocated = mem_alloc_batch(100, 0, ptrs);
+    assert(allocated);
+    mem_free_batch(ptrs, 0);
+    
+    allocated = mem_alloc_batch(100, 300, ptrs);
+    assert(allocated);
+    for (size_t i = 0; i < 300; i++) {
+        memset(ptrs[i], (int)i, 100);
+    }
+    for (size_t i = 0; i < 300; i++) {
+        const uint8_t *bytes = ptrs[i];
+        for (size_t j = 0; j < 100; j++) {
+            assert(bytes[j] == (uint8_t)i);
+        }
+    }
+    
+#ifndef HEAP_DEFERRED_COALESCING
+    // The batch is carved from free space in order.
+    for (size_t i = 1; i < 300; i++) {
+        assert((uint8_t *)ptrs[i] == (uint8_t *)ptrs[i - 1] + 112);
+    }
+#endif
+    
+    // Frees can come in any order, with gaps and NULLs.
+    for (size_t i = 0; i < 300; i += 7) {
+        mem_free(ptrs[i]);
+        ptrs[i] = NULL;
+    }
+    for (size_t i = 0; i < 150; i++) {
+        void *tmp = ptrs[i];
+        ptrs[i] = ptrs[299 - i];
+        ptrs[299 - i] = tmp;
+    }
+    mem_free_batch(ptrs, 300);
+    
+    // Batches of large allocations and of memory from several blocks.
+    void *large[3];
+    allocated = mem_alloc_batch(100000, 3, large);
+    assert(allocated);
+    mem_free_batch(large, 3);
+    void *many[2000];
+    allocated = mem_alloc_batch(GUARD_SIZE + 1000, 2000, many);
+    assert(allocated);
+    mem_free_batch(many, 2000);
+    
+    mem_trim();
+    struct mem_stats stats;
+    mem_get_stats(&stats);
+    assert(stats.alloc_count == start.alloc_count && stats.large_count == start.large_count);
+    assert(live_mem_block_count == start_count);
+    
+    // Running out of memory part way through allocates nothing.
+    memory_exhausted = true;
+    allocated = mem_alloc_batch(GUARD_SIZE + 1000, 2000, many);
+    assert(!allocated);
+    (void)allocated;
+    memory_exhausted = false;
+    mem_get_stats(&stats);
+    assert(stats.alloc_count == start.alloc_count);
+}
+
+void test_stats(void) {
+    mem_trim();
+    struct mem_stats start;
+    mem_get_stats(&start);
+    
+    // Allocations in blocks, even with HEAP_SMALL_PAGES.
+    const size_t size = GUARD_SIZE > 16 ? GUARD_SIZE : 16;
+    void *ptrs[100];
+    for (size_t i = 0; i < 100; i++) {
+        ptrs[i] = mem_alloc(size);
+    }
+    void *large = mem_alloc(100000);
+    
+    struct mem_stats stats;
+    mem_get_stats(&stats);
+    assert(stats.alloc_count == start.alloc_count + 100);
+    assert(stats.large_count == start.large_count + 1);
+    const size_t data_size = size > BLOCKMEM_MIN_DATA_SIZE ? (size + 7) & ~7 : BLOCKMEM_MIN_DATA_SIZE;
+    const size_t size_class = freelist_class_for_size(data_size);
+    assert(stats.class_alloc_counts[size_class] == start.class_alloc_counts[size_class] + 100);
+    assert(stats.allocated_bytes >= start.allocated_bytes + 100 * size + 100000);
+    assert(stats.reserved_bytes >= stats.allocated_bytes + stats.free_bytes);
+    assert(stats.block_count >= 1);
+    assert(stats.search_count > start.search_count);
+    assert(stats.average_scan_count > 0.0 && stats.max_scan_count >= 1);
+    
+    // Freeing every other allocation leaves free space in many pieces.
+    for (size_t i = 0; i < 100; i += 2) {
+        mem_free(ptrs[i]);
+    }
+    mem_get_stats(&stats);
+    assert(stats.free_count >= 50);
+    assert(stats.fragmentation > 0.0 && stats.fragmentation < 1.0);
+    
+    FILE *file = tmpfile();
+    mem_dump_heap(file);
+    assert(ftell(file) > 0);
+    fclose(file);
+    
+    for (size_t i = 1; i < 100; i += 2) {
+        mem_free(ptrs[i]);
+    }
+    mem_free(large);
+    
+    mem_get_stats(&stats);
+    assert(stats.reserved_bytes == start.reserved_bytes + stats.retained_bytes);
+    mem_trim();
+    mem_get_stats(&stats);
+    assert(stats.retained_block_count == 0);
+    assert(stats.alloc_count == start.alloc_count);
+    assert(stats.large_count == start.large_count);
+    assert(stats.reserved_bytes == start.reserved_bytes);
+}
+
+static double get_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+#define POOL_SPEED_ROUND_COUNT 100000
+
+void test_pool_speed(void) {
+    // Repeat the pattern from test_store_and_check() with both allocators.
+    size_t *ptrs[100];
+    
+    double start = get_time();
+    for (size_t round = 0; round < POOL_SPEED_ROUND_COUNT; round++) {
+        for (size_t i = 0; i < 100; i++) {
+            ptrs[i] = mem_alloc(sizeof(size_t));
+            *(ptrs[i]) = i;
+        }
+        for (size_t i = 0; i < 100; i++) {
+            assert(*(ptrs[i]) == i);
+            mem_free(ptrs[i]);
+        }
+    }
+    const double mem_elapsed = get_time() - start;
+    
+    struct mem_pool *pool = mem_pool_create(sizeof(size_t));
+    start = get_time();
+    for (size_t round = 0; round < POOL_SPEED_ROUND_COUNT; round++) {
+        for (size_t i = 0; i < 100; i++) {
+            ptrs[i] = mem_pool_alloc(pool);
+            *(ptrs[i]) = i;
+        }
+        for (size_t i = 0; i < 100; i++) {
+            assert(*(ptrs[i]) == i);
+            mem_pool_free(pool, ptrs[i]);
+        }
+    }
+    const double pool_elapsed = get_time() - start;
+    mem_pool_destroy(pool);
+    
+    const double pair_count = POOL_SPEED_ROUND_COUNT * 100.0;
+    printf("mem_alloc: %.1f million alloc+free pairs/sec\n", pair_count / mem_elapsed / 1e6);
+    printf("mem_pool_alloc: %.1f million alloc+free pairs/sec\n", pair_count / pool_elapsed / 1e6);
+}
+
+#define BATCH_SPEED_ROUND_COUNT 20000
+
+void test_batch_speed(void) {
+    // Groups of 200 messages, freed in a different order from allocation.
+    void *ptrs[200];
+    
+    double start = get_time();
+    for (size_t round = 0; round < BATCH_SPEED_ROUND_COUNT; round++) {
+        for (size_t i = 0; i < 200; i++) {
+            ptrs[i] = mem_alloc(128);
+        }
+        for (size_t i = 0; i < 200; i++) {
+            mem_free(ptrs[(i * 7) % 200]);
+        }
+    }
+    const double single_elapsed = get_time() - start;
+    
+    start = get_time();
+    void *shuffled[200];
+    for (size_t round = 0; round < BATCH_SPEED_ROUND_COUNT; round++) {
+        mem_alloc_batch(128, 200, ptrs);
+        for (size_t i = 0; i < 200; i++) {
+            shuffled[i] = ptrs[(i * 7) % 200];
+        }
+        mem_free_batch(shuffled, 200);
+    }
+    const double batch_elapsed = get_time() - start;
+    
+    const double pair_count = BATCH_SPEED_ROUND_COUNT * 200.0;
+    printf("mem_alloc: %.1f million alloc+free pairs/sec\n", pair_count / single_elapsed / 1e6);
+    printf("mem_alloc_batch: %.1f million alloc+free pairs/sec\n", pair_count / batch_elapsed / 1e6);
+}
+
+// Read everything written to 'file' into 'buffer' as a string.
+static void read_file(FILE *file, char *buffer, size_t size) {
+    rewind(file);
+    const size_t length = fread(buffer, 1, size - 1, file);
+    buffer[length] = '\0';
+}
+
+static bool starts_with(const char *string, const char *prefix) {
+    return strncmp(string, prefix, strlen(prefix)) == 0;
+}
+
+// Allocate from a known function, whose return address from mem_alloc() must
+// be the first frame in the profile.
+__attribute__((noinline)) static void *alloc_from_here(size_t n) {
+    void *ptr = mem_alloc(n);
+    // Not a tail call, so this function's frame stays on the stack.
+    __asm__ volatile("" ::: "memory");
+    return ptr;
+}
+
+void test_profile(void) {
+    assert(!mem_profile_start(0));
+    
+    // With an interval of 1 byte every allocation is sampled.
+    bool started = mem_profile_start(1);
+    assert(started);
+    void *ptrs[100];
+    for (size_t i = 0; i < 100; i++) {
+        ptrs[i] = mem_alloc(64);
+    }
+    for (size_t i = 0; i < 100; i += 2) {
+        mem_free(ptrs[i]);
+    }
+    
+    // Resizing in place moves the sample to the new size.
+    void *resized = mem_realloc(ptrs[1], 32);
+    assert(resized == ptrs[1]);
+    mem_profile_stop();
+    
+    FILE *file = tmpfile();
+    char buffer[4096];
+    mem_profile_write(file, MEM_PROFILE_PPROF);
+    read_file(file, buffer, sizeof(buffer));
+    assert(starts_with(buffer, "heap profile: 50: 3168 [101: 6432] @ heap_v2/1\n"));
+    fclose(file);
+    
+    file = tmpfile();
+    mem_profile_write(file, MEM_PROFILE_TEXT);
+    read_file(file, buffer, sizeof(buffer));
+    assert(starts_with(buffer, "heap profile: about 3168 live bytes"));
+    assert(strstr(buffer, "\n3136 bytes in 49 allocations (49 samples) from:\n") != NULL);
+    fclose(file);
+    
+    for (size_t i = 1; i < 100; i += 2) {
+        mem_free(ptrs[i]);
+    }
+    
+    // Starting again clears the profile.
+    started = mem_profile_start(1);
+    assert(started);
+    mem_profile_stop();
+    file = tmpfile();
+    mem_profile_write(file, MEM_PROFILE_PPROF);
+    read_file(file, buffer, sizeof(buffer));
+    assert(starts_with(buffer, "heap profile: 0: 0 [0: 0] @ heap_v2/1\n"));
+    fclose(file);
+    
+    // Call stacks start in the caller, without the allocator's own frames.
+    started = mem_profile_start(1);
+    assert(started);
+    (void)started;
+    void *ptr = alloc_from_here(64);
+    mem_profile_stop();
+    file = tmpfile();
+    mem_profile_write(file, MEM_PROFILE_PPROF);
+    read_file(file, buffer, sizeof(buffer));
+    void *frame = NULL;
+    const int matched = sscanf(strchr(buffer, '\n') + 1, "%*[^@]@ %p", &frame);
+    const uintptr_t offset = (uintptr_t)frame - (uintptr_t)alloc_from_here;
+    assert(matched == 1 && offset > 0 && offset < 256);
+    (void)matched;
+    (void)offset;
+    fclose(file);
+    mem_free(ptr);
+}
+
+// With HEAP_DEFERRED_COALESCING, memory freed by earlier tests is merged
+// first (by an allocation too large for the quick lists), so each test starts
+// with free space laid out as it would be without deferred coalescing.
+static void run_test(void (*test)(void)) {
+#ifdef HEAP_DEFERRED_COALESCING
+    mem_free(mem_alloc(HEAP_QUICK_MAX_SIZE + 1));
+#endif
+    test();
+}
+
 int main() {
-    test_alloc_zero();
-    test_free_zero();
-    test_alloc_huge();
-    test_alloc_and_free();
-    test_store_and_check();
-    test_alloc_reuse();
-    test_alloc_grow();
-    test_stable_ptr();
-    test_stress();
+    run_test(test_alloc_zero);
+    run_test(test_free_zero);
+    run_test(test_alloc_huge);
+    run_test(test_alloc_and_free);
+    run_test(test_alloc_and_free_retains_block);
+    run_test(test_store_and_check);
+    run_test(test_alloc_reuse);
+    run_test(test_alloc_grow);
+    run_test(test_stable_ptr);
+    run_test(test_stress);
+    run_test(test_alloc_reuse_size_class);
+    run_test(test_no_overlap);
+    run_test(test_placement);
+    run_test(test_free_coalesce);
+    run_test(test_deferred_coalescing);
+    run_test(test_small_pages);
+    run_test(test_realloc_null_and_zero);
+    run_test(test_realloc_grow_in_place);
+    run_test(test_resize);
+    run_test(test_good_size);
+    run_test(test_realloc_move);
+    run_test(test_realloc_aligned);
+    run_test(test_realloc_shrink);
+    run_test(test_alloc_aligned);
+    run_test(test_alloc_aligned_packed);
+    run_test(test_alloc_large);
+    run_test(test_realloc_large);
+    run_test(test_pool_create_zero);
+    run_test(test_pool_store_and_check);
+    run_test(test_pool_reuse);
+    run_test(test_arena_alloc);
+    run_test(test_arena_marks);
+    run_test(test_heaps);
+    run_test(test_alloc_batch);
+    run_test(test_stats);
+    run_test(test_profile);
+    run_test(test_pool_speed);
+    run_test(test_batch_speed);
     
     printf("Tests complete\n");
     return 0;
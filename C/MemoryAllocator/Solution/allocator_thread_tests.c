@@ -0,0 +1,257 @@
+#include "mem.h"
+#include "mem_kernel.h"
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define THREAD_COUNT 8
+
+// Number of mem_block_alloc() calls not yet matched by mem_block_free().
+static atomic_size_t live_mem_block_count;
+
+void* mem_block_alloc(size_t n) {
+    assert(n > 0);
+    atomic_fetch_add(&live_mem_block_count, 1);
+    return malloc(n * MEM_BLOCK_SIZE);
+}
+
+void mem_block_free(void* ptr) {
+    assert(ptr != NULL);
+    atomic_fetch_sub(&live_mem_block_count, 1);
+    free(ptr);
+}
+
+static void run_threads(size_t thread_count, void *(*thread_fn)(void *)) {
+    pthread_t threads[THREAD_COUNT];
+    assert(thread_count <= THREAD_COUNT);
+    for (size_t i = 0; i < thread_count; i++) {
+        const int result = pthread_create(&threads[i], NULL, thread_fn, (void *)i);
+        assert(result == 0);
+        (void)result;
+    }
+    for (size_t i = 0; i < thread_count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+static void fill(uint8_t *ptr, size_t size, uint8_t value) {
+    for (size_t i = 0; i < size; i++) {
+        ptr[i] = value;
+    }
+}
+
+static void check(const uint8_t *ptr, size_t size, uint8_t value) {
+    for (size_t i = 0; i < size; i++) {
+        assert(ptr[i] == value);
+    }
+}
+
+static void *churn_thread(void *arg) {
+    const size_t thread_index = (size_t)arg;
+    const size_t alloc_count = 2000;
+    uint8_t *ptrs[2000];
+    size_t sizes[2000];
+    
+    for (size_t round = 0; round < 20; round++) {
+        for (size_t i = 0; i < alloc_count; i++) {
+            sizes[i] = ((i * 31 + round + thread_index) % 700) + 1;
+            if ((i % 5) == 0) {
+                ptrs[i] = mem_alloc_aligned(sizes[i], 64);
+                assert(((uintptr_t)ptrs[i] % 64) == 0);
+            } else {
+                ptrs[i] = mem_alloc(sizes[i]);
+            }
+            assert(ptrs[i] != NULL);
+            fill(ptrs[i], sizes[i], (uint8_t)(thread_index + i));
+        }
+        for (size_t i = 0; i < alloc_count; i += 3) {
+            check(ptrs[i], sizes[i], (uint8_t)(thread_index + i));
+            mem_free(ptrs[i]);
+            ptrs[i] = NULL;
+        }
+        for (size_t i = 0; i < alloc_count; i++) {
+            if (ptrs[i] == NULL) { continue; }
+            check(ptrs[i], sizes[i], (uint8_t)(thread_index + i));
+            mem_free(ptrs[i]);
+        }
+    }
+    return NULL;
+}
+
+void test_threads_churn(void) {
+    run_threads(THREAD_COUNT, churn_thread);
+}
+
+#define HANDOFF_COUNT 1000
+
+static uint8_t *handoff_ptrs[THREAD_COUNT][HANDOFF_COUNT];
+static pthread_barrier_t handoff_barrier;
+
+static size_t handoff_size(size_t i) {
+    return (i % 200) + 1;
+}
+
+static void *handoff_thread(void *arg) {
+    const size_t thread_index = (size_t)arg;
+    const size_t neighbour = (thread_index + 1) % THREAD_COUNT;
+    
+    for (size_t i = 0; i < HANDOFF_COUNT; i++) {
+        handoff_ptrs[thread_index][i] = mem_alloc(handoff_size(i));
+        fill(handoff_ptrs[thread_index][i], handoff_size(i), (uint8_t)thread_index);
+    }
+    
+    pthread_barrier_wait(&handoff_barrier);
+    
+    // Free memory allocated by another thread, which is still running.
+    // Growing it first has to move it out of the other thread's cache.
+    for (size_t i = 0; i < HANDOFF_COUNT; i++) {
+        uint8_t *ptr = mem_realloc(handoff_ptrs[neighbour][i], handoff_size(i) + 100);
+        check(ptr, handoff_size(i), (uint8_t)neighbour);
+        mem_free(ptr);
+    }
+    
+    pthread_barrier_wait(&handoff_barrier);
+    
+    // Allocating again takes back the memory freed by the other thread.
+    for (size_t i = 0; i < HANDOFF_COUNT; i++) {
+        handoff_ptrs[thread_index][i] = mem_alloc(handoff_size(i));
+        fill(handoff_ptrs[thread_index][i], handoff_size(i), (uint8_t)thread_index);
+    }
+    for (size_t i = 0; i < HANDOFF_COUNT; i++) {
+        check(handoff_ptrs[thread_index][i], handoff_size(i), (uint8_t)thread_index);
+        mem_free(handoff_ptrs[thread_index][i]);
+    }
+    return NULL;
+}
+
+void test_threads_handoff(void) {
+    pthread_barrier_init(&handoff_barrier, NULL, THREAD_COUNT);
+    run_threads(THREAD_COUNT, handoff_thread);
+    pthread_barrier_destroy(&handoff_barrier);
+}
+
+static void *handoff_alloc_thread(void *arg) {
+    const size_t thread_index = (size_t)arg;
+    for (size_t i = 0; i < HANDOFF_COUNT; i++) {
+        handoff_ptrs[thread_index][i] = mem_alloc(handoff_size(i));
+        fill(handoff_ptrs[thread_index][i], handoff_size(i), (uint8_t)thread_index);
+    }
+    return NULL;
+}
+
+static void *handoff_free_thread(void *arg) {
+    const size_t neighbour = ((size_t)arg + 1) % THREAD_COUNT;
+    for (size_t i = 0; i < HANDOFF_COUNT; i++) {
+        check(handoff_ptrs[neighbour][i], handoff_size(i), (uint8_t)neighbour);
+        mem_free(handoff_ptrs[neighbour][i]);
+    }
+    return NULL;
+}
+
+void test_threads_free_after_exit(void) {
+    // The allocating threads have exited by the time their memory is freed.
+    run_threads(THREAD_COUNT, handoff_alloc_thread);
+    run_threads(THREAD_COUNT, handoff_free_thread);
+    
+    // New threads adopt the exited threads' caches.
+    run_threads(THREAD_COUNT, churn_thread);
+}
+
+void test_threads_trim_after_exit(void) {
+    mem_trim();
+    const size_t start_count = atomic_load(&live_mem_block_count);
+    
+    // The exited threads' caches are left holding empty blocks for reuse.
+    run_threads(THREAD_COUNT, churn_thread);
+    assert(atomic_load(&live_mem_block_count) > start_count);
+    
+    mem_trim();
+    assert(atomic_load(&live_mem_block_count) == start_count);
+}
+
+#define SCALING_OP_COUNT 1000000
+
+static void *batch_handoff_thread(void *arg) {
+    const size_t thread_index = (size_t)arg;
+    const size_t neighbour = (thread_index + 1) % THREAD_COUNT;
+    
+    // Half of each thread's memory is in its cache, half in the shared heap.
+    uint8_t **ptrs = handoff_ptrs[thread_index];
+    const size_t half = HANDOFF_COUNT / 2;
+    const bool allocated = mem_alloc_batch(100, half, (void **)ptrs) &&
+        mem_alloc_batch(1000, HANDOFF_COUNT - half, (void **)(ptrs + half));
+    assert(allocated);
+    (void)allocated;
+    for (size_t i = 0; i < HANDOFF_COUNT; i++) {
+        fill(ptrs[i], 100, (uint8_t)thread_index);
+    }
+    
+    pthread_barrier_wait(&handoff_barrier);
+    
+    // Free a mix of this thread's memory and its neighbour's.
+    uint8_t *mixed[HANDOFF_COUNT];
+    for (size_t i = 0; i < HANDOFF_COUNT; i++) {
+        mixed[i] = i % 2 == 0 ? ptrs[i] : handoff_ptrs[neighbour][i];
+        check(mixed[i], 100, (uint8_t)(i % 2 == 0 ? thread_index : neighbour));
+    }
+    
+    pthread_barrier_wait(&handoff_barrier);
+    
+    mem_free_batch((void **)mixed, HANDOFF_COUNT);
+    return NULL;
+}
+
+void test_threads_batch_handoff(void) {
+    pthread_barrier_init(&handoff_barrier, NULL, THREAD_COUNT);
+    run_threads(THREAD_COUNT, batch_handoff_thread);
+    pthread_barrier_destroy(&handoff_barrier);
+}
+
+static void *scaling_thread(void *arg) {
+    (void)arg;
+    void *live[64] = { NULL };
+    for (size_t i = 0; i < SCALING_OP_COUNT; i++) {
+        const size_t slot = (i * 7) % 64;
+        mem_free(live[slot]);
+        live[slot] = mem_alloc((i % 128) + 1);
+    }
+    for (size_t i = 0; i < 64; i++) {
+        mem_free(live[i]);
+    }
+    return NULL;
+}
+
+static double get_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+void test_threads_scaling(void) {
+    for (size_t thread_count = 1; thread_count <= THREAD_COUNT; thread_count *= 2) {
+        const double start = get_time();
+        run_threads(thread_count, scaling_thread);
+        const double elapsed = get_time() - start;
+        printf("%zu thread(s): %.1f million alloc+free pairs/sec\n", thread_count,
+               (thread_count * SCALING_OP_COUNT) / elapsed / 1e6);
+    }
+}
+
+int main() {
+    test_threads_churn();
+    test_threads_handoff();
+    test_threads_free_after_exit();
+    test_threads_batch_handoff();
+    test_threads_trim_after_exit();
+    test_threads_scaling();
+    
+    printf("Tests complete\n");
+    return 0;
+}
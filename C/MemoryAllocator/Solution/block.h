@@ -6,19 +6,39 @@
 #include <stddef.h>
 #include <stdint.h>
 
+struct heap;
+
 struct block {
     struct blockmem endmem;
     struct block *prev, *next;
+    
+    // Heap that owns the block.
+    struct heap *heap;
+    
+    // Number of allocated blockmems in the block.
+    size_t alloc_count;
+    
+#ifdef HEAP_DEFERRED_COALESCING
+    // Number of those that have been freed, and are waiting on a quick list.
+    size_t deferred_count;
+#endif
+    
+    // Value of the heap's free count when the block was last emptied, if
+    // it's retained by the heap for reuse.
+    size_t retained_at;
 };
 
+// Largest amount of memory a block can occupy.
+#define BLOCK_MAX_ALLOC_SIZE (BLOCKMEM_MAX_DATA_SIZE + sizeof(struct blockmem))
+
 // Get the size of memory that needs to be allocated in order to store the
 // given amount of data.
 size_t block_alloc_size_for_data_size(size_t data_size);
 
-// Construct a block on top of the given memory.
-struct block *block_init(uint8_t *block_mem, size_t alloc_size);
+// Construct a block on top of the given memory, owned by the given heap.
+struct block *block_init(uint8_t *block_mem, size_t alloc_size, struct heap *heap);
 
-// Get block that corresponds to the given blockmem.
+// Get block that corresponds to the given blockmem. This takes constant time.
 struct block *block_get_ptr_from_mem(struct blockmem *mem);
 
 // Get the size of allocated memory occupied by the block.
@@ -30,9 +50,6 @@ void *block_get_alloc_ptr(struct block *block);
 // Get the first blockmem in the block.
 struct blockmem *block_get_first_mem(struct block *block);
 
-// Find a blockmem with at least n bytes for storing data.
-struct blockmem *block_find_mem(struct block *block, size_t n);
-
 // Query if the block has any allocated memory.
 bool block_has_allocations(struct block *block);
 
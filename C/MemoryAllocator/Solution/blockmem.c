@@ -4,13 +4,55 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#define ALLOCATED_FLAG ((size_t)1)
+#define END_FLAG ((size_t)2)
+#define PREV_FREE_FLAG ((size_t)4)
+#define DATA_SIZE_MASK ((size_t)0xFFFFFFF8)
+#define END_OFFSET_SHIFT 32
+
+// End offsets are multiples of 8, so the bottom bit of the offset is free.
+#define DEFERRED_FLAG ((size_t)1 << END_OFFSET_SHIFT)
+
+// Another thread may read the end offset of an allocated blockmem while the
+// owner of the block changes its flags, so the size field is only accessed
+// with (relaxed) atomic loads and stores. These compile to ordinary moves.
+static size_t load_size_field(const struct blockmem *mem) {
+    return __atomic_load_n(&(mem->size_field), __ATOMIC_RELAXED);
+}
+
+static void store_size_field(struct blockmem *mem, const size_t size_field) {
+    __atomic_store_n(&(mem->size_field), size_field, __ATOMIC_RELAXED);
+}
+
+static size_t get_end_offset(const struct blockmem *mem) {
+    return (load_size_field(mem) & ~DEFERRED_FLAG) >> END_OFFSET_SHIFT;
+}
+
+static void set_flag(struct blockmem *mem, const size_t flag, const bool value) {
+    if (value) {
+        store_size_field(mem, load_size_field(mem) | flag);
+    } else {
+        store_size_field(mem, load_size_field(mem) & ~flag);
+    }
+}
+
+// Copy the data size of a free blockmem into the last word of its data, so
+// the next blockmem can find it.
+static void write_boundary_tag(struct blockmem *mem) {
+    assert(!blockmem_is_allocated(mem));
+    const size_t data_size = blockmem_get_data_size(mem);
+    *(size_t *)&(mem->data[data_size - sizeof(size_t)]) = data_size;
+}
+
 size_t blockmem_alloc_size_for_data_size(const size_t data_size) {
     return sizeof(struct blockmem) + data_size;
 }
 
-void blockmem_init(struct blockmem *mem, size_t alloc_size) {
-    assert((alloc_size & 3) == 0);
-    mem->size_field = alloc_size - sizeof(struct blockmem);
+void blockmem_init(struct blockmem *mem, size_t alloc_size, size_t end_offset) {
+    assert((alloc_size & 7) == 0);
+    assert(alloc_size - sizeof(struct blockmem) <= BLOCKMEM_MAX_DATA_SIZE);
+    assert((end_offset & 7) == 0 && end_offset <= (SIZE_MAX >> END_OFFSET_SHIFT));
+    store_size_field(mem, (alloc_size - sizeof(struct blockmem)) | (end_offset << END_OFFSET_SHIFT));
 }
 
 void *blockmem_get_data_ptr(struct blockmem *mem) {
@@ -22,69 +64,108 @@ struct blockmem *blockmem_get_ptr_from_data_ptr(void *ptr) {
 }
 
 size_t blockmem_get_data_size(const struct blockmem *mem) {
-    return mem->size_field & ~3;
+    return load_size_field(mem) & DATA_SIZE_MASK;
 }
 
 void blockmem_set_data_size(struct blockmem *mem, size_t size) {
-    assert((size & 3) == 0);
-    mem->size_field = size | (mem->size_field & 3);
+    assert((size & 7) == 0 && size <= BLOCKMEM_MAX_DATA_SIZE);
+    store_size_field(mem, size | (load_size_field(mem) & ~DATA_SIZE_MASK));
+    if (!blockmem_is_end(mem) && !blockmem_is_allocated(mem)) {
+        write_boundary_tag(mem);
+    }
 }
 
 size_t blockmem_get_alloc_size(const struct blockmem *mem) {
     return blockmem_get_data_size(mem) + sizeof(struct blockmem);
 }
 
+struct blockmem *blockmem_get_end(struct blockmem *mem) {
+    return (struct blockmem *)((uint8_t *)mem + get_end_offset(mem));
+}
+
+void blockmem_init_standalone(struct blockmem *mem) {
+    // Being both allocated and the end of a block can't happen for a
+    // blockmem in a block, so this combination marks standalone memory.
+    store_size_field(mem, ALLOCATED_FLAG | END_FLAG);
+}
+
+bool blockmem_is_standalone(const struct blockmem *mem) {
+    const size_t flags = ALLOCATED_FLAG | END_FLAG;
+    return (load_size_field(mem) & flags) == flags;
+}
+
 bool blockmem_is_end(const struct blockmem *mem) {
-    return (mem->size_field & 2) != 0;
+    return (load_size_field(mem) & END_FLAG) != 0;
 }
 
 void blockmem_set_end(struct blockmem *mem, bool end) {
-    if (end) {
-        mem->size_field |= 2;
-    } else {
-        mem->size_field &= ~2;
-    }
+    set_flag(mem, END_FLAG, end);
 }
 
 bool blockmem_is_allocated(const struct blockmem *mem) {
-    return (mem->size_field & 1) != 0;
+    return (load_size_field(mem) & ALLOCATED_FLAG) != 0;
 }
 
 void blockmem_set_allocated(struct blockmem *mem, bool allocated) {
     assert(!blockmem_is_end(mem));
-    if (allocated) {
-        mem->size_field |= 1;
-    } else {
-        mem->size_field &= ~1;
+    set_flag(mem, ALLOCATED_FLAG, allocated);
+    set_flag(blockmem_next(mem), PREV_FREE_FLAG, !allocated);
+    if (!allocated) {
+        write_boundary_tag(mem);
     }
 }
 
+bool blockmem_is_deferred(const struct blockmem *mem) {
+    return (load_size_field(mem) & DEFERRED_FLAG) != 0;
+}
+
+void blockmem_set_deferred(struct blockmem *mem, bool deferred) {
+    assert(blockmem_is_allocated(mem) && !blockmem_is_end(mem));
+    set_flag(mem, DEFERRED_FLAG, deferred);
+}
+
+bool blockmem_is_prev_free(const struct blockmem *mem) {
+    return (load_size_field(mem) & PREV_FREE_FLAG) != 0;
+}
+
 struct blockmem *blockmem_next(struct blockmem *mem) {
     assert(!blockmem_is_end(mem));
     return (struct blockmem *)&(mem->data[blockmem_get_data_size(mem)]);
 }
 
+struct blockmem *blockmem_prev(struct blockmem *mem) {
+    assert(blockmem_is_prev_free(mem));
+    const size_t prev_data_size = ((const size_t *)mem)[-1];
+    struct blockmem *prev = (struct blockmem *)((uint8_t *)mem - prev_data_size) - 1;
+    assert(blockmem_get_data_size(prev) == prev_data_size && !blockmem_is_allocated(prev));
+    return prev;
+}
+
 void blockmem_split(struct blockmem *mem, size_t data_size) {
-    assert(!blockmem_is_end(mem) && !blockmem_is_allocated(mem));
+    assert(!blockmem_is_end(mem));
     
     const size_t available_data_size = blockmem_get_data_size(mem);
     assert(data_size <= available_data_size);
     
-    if (available_data_size <= (data_size + blockmem_alloc_size_for_data_size(0))) {
+    if (available_data_size < (data_size + blockmem_alloc_size_for_data_size(BLOCKMEM_MIN_DATA_SIZE))) {
         // Can't usefully split.
         return;
     }
     
     blockmem_set_data_size(mem, data_size);
-    blockmem_init(blockmem_next(mem), available_data_size - data_size);
+    
+    struct blockmem *next = blockmem_next(mem);
+    blockmem_init(next, available_data_size - data_size,
+                  get_end_offset(mem) - blockmem_get_alloc_size(mem));
+    set_flag(next, PREV_FREE_FLAG, !blockmem_is_allocated(mem));
+    blockmem_set_allocated(next, false);
 }
 
 void blockmem_merge_with_next(struct blockmem *mem) {
-    assert(!blockmem_is_end(mem) && !blockmem_is_allocated(mem));
+    assert(!blockmem_is_end(mem));
     
     struct blockmem *next = blockmem_next(mem);
-    while (!blockmem_is_end(next) && !blockmem_is_allocated(next)) {
-        blockmem_set_data_size(mem, blockmem_get_data_size(mem) + blockmem_get_alloc_size(next));
-        next = blockmem_next(mem);
-    }
+    assert(!blockmem_is_end(next) && !blockmem_is_allocated(next));
+    blockmem_set_data_size(mem, blockmem_get_data_size(mem) + blockmem_get_alloc_size(next));
+    set_flag(blockmem_next(mem), PREV_FREE_FLAG, !blockmem_is_allocated(mem));
 }
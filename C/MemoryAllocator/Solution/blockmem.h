@@ -5,14 +5,31 @@
 #include <stddef.h>
 #include <stdint.h>
 
+// The size field packs several values:
+//
+//   bits 0-2:   flags (allocated, end, previous blockmem is free)
+//   bits 3-31:  data size
+//   bit 32:     flag (deferred)
+//   bits 32-63: offset in bytes from this blockmem to the end of its block,
+//               which is a multiple of 8 so never uses bit 32
+//
+// so a block must be smaller than 4 GB.
 struct blockmem {
     size_t size_field;
     uint8_t data[0];
 };
 
+// Smallest data size of any blockmem. Free blockmems keep their free list
+// links at the start of their data and a copy of their size (the boundary
+// tag) at the end, so there must always be room for all of these.
+#define BLOCKMEM_MIN_DATA_SIZE (2 * sizeof(void *) + sizeof(size_t))
+
+// Largest data size of any blockmem.
+#define BLOCKMEM_MAX_DATA_SIZE ((size_t)0xFFFFFFF8)
+
 size_t blockmem_alloc_size_for_data_size(size_t data_size);
 
-void blockmem_init(struct blockmem *mem, size_t alloc_size);
+void blockmem_init(struct blockmem *mem, size_t alloc_size, size_t end_offset);
 
 void *blockmem_get_data_ptr(struct blockmem *mem);
 
@@ -24,18 +41,44 @@ void blockmem_set_data_size(struct blockmem *mem, size_t size);
 
 size_t blockmem_get_alloc_size(const struct blockmem *mem);
 
+// Get the end blockmem of the block containing this blockmem.
+struct blockmem *blockmem_get_end(struct blockmem *mem);
+
+// Construct a blockmem for memory that has a whole allocation from the kernel
+// to itself, rather than being part of a block. Its data size isn't stored.
+void blockmem_init_standalone(struct blockmem *mem);
+
+// Query if this blockmem was constructed by blockmem_init_standalone().
+bool blockmem_is_standalone(const struct blockmem *mem);
+
 bool blockmem_is_end(const struct blockmem *mem);
 
 void blockmem_set_end(struct blockmem *mem, bool end);
 
 bool blockmem_is_allocated(const struct blockmem *mem);
 
+// Marking a blockmem as free also writes its boundary tag; either way the
+// next blockmem is updated to record whether this one is free.
 void blockmem_set_allocated(struct blockmem *mem, bool allocated);
 
+// A deferred blockmem has been freed, but is still marked as allocated while
+// it waits on a quick list (see HEAP_DEFERRED_COALESCING).
+bool blockmem_is_deferred(const struct blockmem *mem);
+
+void blockmem_set_deferred(struct blockmem *mem, bool deferred);
+
+bool blockmem_is_prev_free(const struct blockmem *mem);
+
 struct blockmem *blockmem_next(struct blockmem *mem);
 
+// Get the previous blockmem, which must be free.
+struct blockmem *blockmem_prev(struct blockmem *mem);
+
+// Shrink a blockmem to the given data size, if there's enough space left over
+// to make a new (free) blockmem after it.
 void blockmem_split(struct blockmem *mem, size_t data_size);
 
+// Absorb the next blockmem, which must be free.
 void blockmem_merge_with_next(struct blockmem *mem);
 
 #endif
@@ -0,0 +1,389 @@
+#include "freelist.h"
+
+#include "blockmem.h"
+#include "mem_stats.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+_Static_assert(FREELIST_CLASS_COUNT == MEM_STATS_NUM_CLASSES, "mem_stats has the wrong number of classes");
+
+static struct freelist_links *get_links(struct blockmem *mem) {
+    return (struct freelist_links *)blockmem_get_data_ptr(mem);
+}
+
+static size_t floor_log2(const size_t value) {
+    assert(value != 0);
+    return (sizeof(unsigned long long) * 8 - 1) - __builtin_clzll(value);
+}
+
+static void set_nonempty(struct freelist *list, const size_t size_class, const bool nonempty) {
+    const uint64_t bit = (uint64_t)1 << (size_class % 64);
+    if (nonempty) {
+        list->nonempty[size_class / 64] |= bit;
+    } else {
+        list->nonempty[size_class / 64] &= ~bit;
+    }
+}
+
+// Find the first non-empty class at or above the given class. Returns
+// FREELIST_CLASS_COUNT if there isn't one.
+static size_t find_nonempty_class(const struct freelist *list, const size_t size_class) {
+    size_t word = size_class / 64;
+    if (word >= FREELIST_BITMAP_WORDS) { return FREELIST_CLASS_COUNT; }
+    
+    uint64_t bits = list->nonempty[word] & (~(uint64_t)0 << (size_class % 64));
+    while (bits == 0) {
+        word++;
+        if (word == FREELIST_BITMAP_WORDS) { return FREELIST_CLASS_COUNT; }
+        bits = list->nonempty[word];
+    }
+    
+    return word * 64 + __builtin_ctzll(bits);
+}
+
+#if FREELIST_USES_TREE
+
+// The tree is a treap: ordered by key, and by priority from the root down.
+// Priorities are derived from addresses, so they needn't be stored.
+
+// Query if blockmems of the given size are kept in the tree rather than the
+// class lists.
+static bool is_in_tree(const size_t data_size) {
+    return data_size > FREELIST_SMALL_MAX_SIZE;
+}
+
+static struct freelist_node *get_node(struct blockmem *mem) {
+    return (struct freelist_node *)blockmem_get_data_ptr(mem);
+}
+
+static uint64_t get_priority(const struct blockmem *mem) {
+    return (uint64_t)(uintptr_t)mem * UINT64_C(0x9E3779B97F4A7C15);
+}
+
+// Query if blockmem 'a' comes before blockmem 'b' in the tree.
+static bool is_before(const struct blockmem *a, const struct blockmem *b) {
+#if FREELIST_PLACEMENT == FREELIST_BEST_FIT
+    const size_t a_size = blockmem_get_data_size(a);
+    const size_t b_size = blockmem_get_data_size(b);
+    if (a_size != b_size) { return a_size < b_size; }
+#endif
+    return (uintptr_t)a < (uintptr_t)b;
+}
+
+static size_t get_max_size(struct blockmem *mem) {
+    return mem != NULL ? get_node(mem)->max_size : 0;
+}
+
+static void update_max_size(struct blockmem *mem) {
+    struct freelist_node *node = get_node(mem);
+    size_t max_size = blockmem_get_data_size(mem);
+    if (get_max_size(node->left) > max_size) { max_size = get_max_size(node->left); }
+    if (get_max_size(node->right) > max_size) { max_size = get_max_size(node->right); }
+    node->max_size = max_size;
+}
+
+static void rotate_right(struct blockmem **link) {
+    struct blockmem *mem = *link;
+    struct blockmem *pivot = get_node(mem)->left;
+    get_node(mem)->left = get_node(pivot)->right;
+    get_node(pivot)->right = mem;
+    update_max_size(mem);
+    update_max_size(pivot);
+    *link = pivot;
+}
+
+static void rotate_left(struct blockmem **link) {
+    struct blockmem *mem = *link;
+    struct blockmem *pivot = get_node(mem)->right;
+    get_node(mem)->right = get_node(pivot)->left;
+    get_node(pivot)->left = mem;
+    update_max_size(mem);
+    update_max_size(pivot);
+    *link = pivot;
+}
+
+static void tree_insert(struct blockmem **link, struct blockmem *mem) {
+    struct blockmem *root = *link;
+    if (root == NULL) {
+        get_node(mem)->left = NULL;
+        get_node(mem)->right = NULL;
+        update_max_size(mem);
+        *link = mem;
+        return;
+    }
+    
+    struct freelist_node *root_node = get_node(root);
+    if (is_before(mem, root)) {
+        tree_insert(&(root_node->left), mem);
+        if (get_priority(root_node->left) > get_priority(root)) {
+            rotate_right(link);
+            return;
+        }
+    } else {
+        tree_insert(&(root_node->right), mem);
+        if (get_priority(root_node->right) > get_priority(root)) {
+            rotate_left(link);
+            return;
+        }
+    }
+    update_max_size(root);
+}
+
+// Join two trees, where everything in 'a' comes before everything in 'b'.
+static struct blockmem *tree_join(struct blockmem *a, struct blockmem *b) {
+    if (a == NULL) { return b; }
+    if (b == NULL) { return a; }
+    
+    if (get_priority(a) > get_priority(b)) {
+        get_node(a)->right = tree_join(get_node(a)->right, b);
+        update_max_size(a);
+        return a;
+    } else {
+        get_node(b)->left = tree_join(a, get_node(b)->left);
+        update_max_size(b);
+        return b;
+    }
+}
+
+static void tree_remove(struct blockmem **link, struct blockmem *mem) {
+    struct blockmem *root = *link;
+    assert(root != NULL && "Not in the free list");
+    
+    struct freelist_node *root_node = get_node(root);
+    if (root == mem) {
+        *link = tree_join(root_node->left, root_node->right);
+        return;
+    }
+    
+    if (is_before(mem, root)) {
+        tree_remove(&(root_node->left), mem);
+    } else {
+        tree_remove(&(root_node->right), mem);
+    }
+    update_max_size(root);
+}
+
+// Find the blockmem in the tree chosen by the placement policy for n bytes,
+// or NULL if none are large enough.
+static struct blockmem *tree_find(struct blockmem *root, const size_t n, size_t *scan_count) {
+#if FREELIST_PLACEMENT == FREELIST_BEST_FIT
+    // Find the first blockmem at least n bytes long.
+    struct blockmem *best = NULL;
+    struct blockmem *mem = root;
+    while (mem != NULL) {
+        (*scan_count)++;
+        if (blockmem_get_data_size(mem) >= n) {
+            best = mem;
+            mem = get_node(mem)->left;
+        } else {
+            mem = get_node(mem)->right;
+        }
+    }
+    return best;
+#else
+    // Find the lowest addressed blockmem at least n bytes long, skipping
+    // subtrees that have nothing that large.
+    if (get_max_size(root) < n) { return NULL; }
+    
+    struct blockmem *mem = root;
+    while (true) {
+        (*scan_count)++;
+        struct freelist_node *node = get_node(mem);
+        if (get_max_size(node->left) >= n) {
+            mem = node->left;
+        } else if (blockmem_get_data_size(mem) >= n) {
+            return mem;
+        } else {
+            mem = node->right;
+            assert(get_max_size(mem) >= n);
+        }
+    }
+#endif
+}
+
+#endif
+
+void freelist_init(struct freelist *list) {
+    for (size_t i = 0; i < FREELIST_BITMAP_WORDS; i++) {
+        list->nonempty[i] = 0;
+    }
+    for (size_t i = 0; i < FREELIST_CLASS_COUNT; i++) {
+        list->heads[i] = NULL;
+#if FREELIST_PLACEMENT == FREELIST_NEXT_FIT
+        list->rovers[i] = NULL;
+#endif
+    }
+#if FREELIST_USES_TREE
+    list->tree_root = NULL;
+#endif
+    list->take_count = 0;
+    list->scan_count = 0;
+    list->max_scan_count = 0;
+}
+
+size_t freelist_class_for_size(const size_t data_size) {
+    assert(data_size >= BLOCKMEM_MIN_DATA_SIZE && (data_size & 7) == 0);
+    if (data_size <= FREELIST_SMALL_MAX_SIZE) {
+        return (data_size - BLOCKMEM_MIN_DATA_SIZE) / 8;
+    }
+    
+    const size_t size_class = FREELIST_SMALL_CLASS_COUNT +
+        floor_log2(data_size) - floor_log2(FREELIST_SMALL_MAX_SIZE);
+    assert(size_class < FREELIST_CLASS_COUNT);
+    return size_class;
+}
+
+size_t freelist_class_max_size(const size_t size_class) {
+    assert(size_class < FREELIST_CLASS_COUNT);
+    if (size_class < FREELIST_SMALL_CLASS_COUNT) {
+        return BLOCKMEM_MIN_DATA_SIZE + size_class * 8;
+    }
+    
+    const size_t shift = size_class - FREELIST_SMALL_CLASS_COUNT + floor_log2(FREELIST_SMALL_MAX_SIZE) + 1;
+    if (shift >= sizeof(size_t) * 8) { return SIZE_MAX & ~(size_t)7; }
+    return ((size_t)1 << shift) - 8;
+}
+
+static void record_take(struct freelist *list, const size_t scan_count) {
+    list->take_count++;
+    list->scan_count += scan_count;
+    if (scan_count > list->max_scan_count) { list->max_scan_count = scan_count; }
+}
+
+void freelist_insert(struct freelist *list, struct blockmem *mem) {
+    assert(!blockmem_is_end(mem) && !blockmem_is_allocated(mem));
+    
+    const size_t data_size = blockmem_get_data_size(mem);
+#if FREELIST_USES_TREE
+    if (is_in_tree(data_size)) {
+        tree_insert(&(list->tree_root), mem);
+        return;
+    }
+#endif
+    
+    const size_t size_class = freelist_class_for_size(data_size);
+    struct freelist_links *links = get_links(mem);
+    links->prev = NULL;
+    links->next = list->heads[size_class];
+    if (links->next != NULL) {
+        get_links(links->next)->prev = mem;
+    }
+    
+    list->heads[size_class] = mem;
+    set_nonempty(list, size_class, true);
+}
+
+void freelist_remove(struct freelist *list, struct blockmem *mem) {
+    assert(!blockmem_is_end(mem) && !blockmem_is_allocated(mem));
+    
+    const size_t data_size = blockmem_get_data_size(mem);
+#if FREELIST_USES_TREE
+    if (is_in_tree(data_size)) {
+        tree_remove(&(list->tree_root), mem);
+        return;
+    }
+#endif
+    
+    const size_t size_class = freelist_class_for_size(data_size);
+    struct freelist_links *links = get_links(mem);
+#if FREELIST_PLACEMENT == FREELIST_NEXT_FIT
+    if (list->rovers[size_class] == mem) {
+        list->rovers[size_class] = links->next;
+    }
+#endif
+    if (links->prev != NULL) {
+        get_links(links->prev)->next = links->next;
+    } else {
+        assert(list->heads[size_class] == mem);
+        list->heads[size_class] = links->next;
+        if (links->next == NULL) {
+            set_nonempty(list, size_class, false);
+        }
+    }
+    if (links->next != NULL) {
+        get_links(links->next)->prev = links->prev;
+    }
+}
+
+#if !FREELIST_USES_TREE
+
+// Find a blockmem in a class list with at least n bytes for storing data, or
+// NULL if there isn't one.
+static struct blockmem *find_in_class(struct freelist *list, const size_t size_class,
+                                      const size_t n, size_t *scan_count) {
+#if FREELIST_PLACEMENT == FREELIST_NEXT_FIT
+    // Start where the last search stopped, wrapping around to the head.
+    struct blockmem *start = list->rovers[size_class];
+    if (start == NULL) { start = list->heads[size_class]; }
+    
+    struct blockmem *mem = start;
+    while (mem != NULL) {
+        (*scan_count)++;
+        if (blockmem_get_data_size(mem) >= n) {
+            list->rovers[size_class] = get_links(mem)->next;
+            return mem;
+        }
+        
+        mem = get_links(mem)->next;
+        if (mem == NULL && start != list->heads[size_class]) { mem = list->heads[size_class]; }
+        if (mem == start) { break; }
+    }
+    return NULL;
+#else
+    struct blockmem *mem;
+    for (mem = list->heads[size_class]; mem != NULL; mem = get_links(mem)->next) {
+        (*scan_count)++;
+        if (blockmem_get_data_size(mem) >= n) { return mem; }
+    }
+    return NULL;
+#endif
+}
+
+#endif
+
+struct blockmem *freelist_take(struct freelist *list, const size_t n) {
+    size_t size_class = freelist_class_for_size(n);
+    size_t scan_count = 0;
+    struct blockmem *mem = NULL;
+    
+#if FREELIST_USES_TREE
+    // Only the exact size classes have lists, and every blockmem in any of
+    // them at or above n's class is large enough.
+    if (!is_in_tree(n)) {
+        size_class = find_nonempty_class(list, size_class);
+        if (size_class != FREELIST_CLASS_COUNT) {
+            mem = list->heads[size_class];
+            scan_count++;
+        }
+    }
+    if (mem == NULL) {
+        mem = tree_find(list->tree_root, n, &scan_count);
+    }
+#else
+    if (size_class >= FREELIST_SMALL_CLASS_COUNT) {
+        // Large classes cover a range of sizes, so look for a blockmem that
+        // fits in this class before moving on to a larger class.
+        mem = find_in_class(list, size_class, n, &scan_count);
+        size_class++;
+    }
+    
+    if (mem == NULL) {
+        // Every blockmem in any of the remaining classes is large enough.
+        size_class = find_nonempty_class(list, size_class);
+        if (size_class != FREELIST_CLASS_COUNT) {
+            mem = find_in_class(list, size_class, n, &scan_count);
+            assert(mem != NULL);
+        }
+    }
+#endif
+    
+    record_take(list, scan_count);
+    if (mem == NULL) { return NULL; }
+    
+    assert(blockmem_get_data_size(mem) >= n);
+    freelist_remove(list, mem);
+    return mem;
+}
@@ -0,0 +1,101 @@
+#ifndef FREELIST_H
+#define FREELIST_H
+
+#include "blockmem.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Free blockmems with data sizes up to this are kept in exact size classes
+// (one class per multiple of 8); larger ones are kept in power of two classes.
+#define FREELIST_SMALL_MAX_SIZE 512
+
+// Placement policies, for choosing between free blockmems larger than
+// FREELIST_SMALL_MAX_SIZE. Smaller blockmems are always kept in exact size
+// classes, so any blockmem from the first non-empty class is the best fit.
+//
+//   FIRST_FIT:       the first blockmem that fits in a power of two class
+//                    list, most recently freed first.
+//   NEXT_FIT:        like FIRST_FIT, but each search of a class list starts
+//                    where the last one stopped.
+//   BEST_FIT:        the smallest blockmem that fits, from a tree keyed by size.
+//   ADDRESS_ORDERED: the lowest addressed blockmem that fits, from a tree
+//                    keyed by address.
+#define FREELIST_FIRST_FIT 0
+#define FREELIST_NEXT_FIT 1
+#define FREELIST_BEST_FIT 2
+#define FREELIST_ADDRESS_ORDERED 3
+
+#ifndef FREELIST_PLACEMENT
+#define FREELIST_PLACEMENT FREELIST_FIRST_FIT
+#endif
+
+#define FREELIST_USES_TREE \
+    (FREELIST_PLACEMENT == FREELIST_BEST_FIT || FREELIST_PLACEMENT == FREELIST_ADDRESS_ORDERED)
+
+#define FREELIST_SMALL_CLASS_COUNT \
+    ((FREELIST_SMALL_MAX_SIZE - BLOCKMEM_MIN_DATA_SIZE) / 8 + 1)
+
+#define FREELIST_CLASS_COUNT (FREELIST_SMALL_CLASS_COUNT + 64)
+
+#define FREELIST_BITMAP_WORDS ((FREELIST_CLASS_COUNT + 63) / 64)
+
+// Links stored in the data of a free blockmem.
+struct freelist_links {
+    struct blockmem *prev, *next;
+};
+
+// Links stored in the data of a free blockmem in the tree used by the
+// BEST_FIT and ADDRESS_ORDERED policies. Only blockmems larger than
+// FREELIST_SMALL_MAX_SIZE are in the tree, so there's always room for these.
+struct freelist_node {
+    struct blockmem *left, *right;
+    
+    // Largest data size of any blockmem in this subtree.
+    size_t max_size;
+};
+
+// Segregated lists of free blockmems, keyed by size class.
+struct freelist {
+    // One bit per class, set if the class list is non-empty.
+    uint64_t nonempty[FREELIST_BITMAP_WORDS];
+    struct blockmem *heads[FREELIST_CLASS_COUNT];
+    
+#if FREELIST_PLACEMENT == FREELIST_NEXT_FIT
+    // Where the next search of each class list starts, or NULL for the head.
+    struct blockmem *rovers[FREELIST_CLASS_COUNT];
+#endif
+    
+#if FREELIST_USES_TREE
+    // Free blockmems too large for the exact size classes. These classes'
+    // lists are unused.
+    struct blockmem *tree_root;
+#endif
+    
+    // Number of calls to freelist_take(), and of blockmems they looked at.
+    size_t take_count;
+    size_t scan_count;
+    size_t max_scan_count;
+};
+
+// Construct an empty free list.
+void freelist_init(struct freelist *list);
+
+// Get the size class used for blockmems with the given data size.
+size_t freelist_class_for_size(size_t data_size);
+
+// Get the largest data size in the given size class.
+size_t freelist_class_max_size(size_t size_class);
+
+// Add a free blockmem to the list for its size class.
+void freelist_insert(struct freelist *list, struct blockmem *mem);
+
+// Remove a free blockmem from the list for its size class.
+void freelist_remove(struct freelist *list, struct blockmem *mem);
+
+// Remove and return a free blockmem with at least n bytes for storing data,
+// or NULL if there isn't one.
+struct blockmem *freelist_take(struct freelist *list, size_t n);
+
+#endif
@@ -0,0 +1,260 @@
+#include "guard.h"
+
+#include "mem_stats.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef MEM_THREAD_SAFE
+#include <pthread.h>
+#endif
+
+// Stored immediately before the data of guarded memory.
+struct guard_header {
+    // Size requested by the caller.
+    size_t size;
+    
+    // Usable size of the memory around the guard, to check its size field.
+    size_t mem_size;
+    
+    // Return address of the call to mem_alloc() etc.
+    void *call_site;
+    
+    // Offset in bytes from the start of the memory to the data.
+    size_t offset;
+    
+    // Checksum of the fields above and the address of the header, XORed
+    // with FREED_KEY once the memory has been freed.
+    uint64_t checksum;
+};
+
+#define CHECKSUM_KEY ((uint64_t)0x9E3779B97F4A7C15)
+#define FREED_KEY ((uint64_t)0xF4EEDF4EEDF4EEDF)
+#define CANARY_KEY ((uint64_t)0xCA4A41CA4A41CA4A)
+#define POISON_BYTE 0xDF
+
+struct quarantine_entry {
+    void *ptr;
+    size_t size;
+};
+
+// FIFO ring of freed memory.
+static struct quarantine_entry quarantine[GUARD_QUARANTINE_MAX_COUNT];
+static size_t quarantine_first;
+static size_t quarantine_count;
+static size_t quarantine_bytes;
+
+#ifdef MEM_THREAD_SAFE
+static pthread_mutex_t quarantine_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK_QUARANTINE() pthread_mutex_lock(&quarantine_mutex)
+#define UNLOCK_QUARANTINE() pthread_mutex_unlock(&quarantine_mutex)
+#else
+#define LOCK_QUARANTINE()
+#define UNLOCK_QUARANTINE()
+#endif
+
+static void (*violation_handler)(const char *problem, void *ptr, size_t size, void *call_site);
+
+static uint64_t mix(uint64_t value) {
+    value ^= value >> 33;
+    value *= (uint64_t)0xFF51AFD7ED558CCD;
+    value ^= value >> 33;
+    value *= (uint64_t)0xC4CEB9FE1A85EC53;
+    value ^= value >> 33;
+    return value;
+}
+
+static struct guard_header *get_header(void *ptr) {
+    return (struct guard_header *)ptr - 1;
+}
+
+static uint64_t get_checksum(const struct guard_header *header) {
+    uint64_t checksum = mix((uintptr_t)header ^ CHECKSUM_KEY);
+    checksum = mix(checksum ^ header->size);
+    checksum = mix(checksum ^ header->mem_size);
+    checksum = mix(checksum ^ (uintptr_t)header->call_site);
+    return mix(checksum ^ header->offset);
+}
+
+static bool is_allocated(const struct guard_header *header) {
+    return header->checksum == get_checksum(header);
+}
+
+static bool is_freed(const struct guard_header *header) {
+    return header->checksum == (get_checksum(header) ^ FREED_KEY);
+}
+
+// The canary isn't aligned, since it directly follows the requested size.
+static uint64_t read_canary(void *ptr) {
+    uint64_t canary;
+    memcpy(&canary, (uint8_t *)ptr + get_header(ptr)->size, sizeof(canary));
+    return canary;
+}
+
+static void write_canary(void *ptr) {
+    const uint64_t canary = get_header(ptr)->checksum ^ CANARY_KEY;
+    memcpy((uint8_t *)ptr + get_header(ptr)->size, &canary, sizeof(canary));
+}
+
+static size_t get_poison_size(size_t size) {
+    return size < GUARD_POISON_MAX_SIZE ? size : GUARD_POISON_MAX_SIZE;
+}
+
+static bool is_poisoned(const uint8_t *ptr, size_t size) {
+    for (size_t i = 0; i < get_poison_size(size); i++) {
+        if (ptr[i] != POISON_BYTE) { return false; }
+    }
+    return true;
+}
+
+static size_t get_offset(size_t alignment) {
+    if (alignment < 8) { alignment = 8; }
+    return (sizeof(struct guard_header) + (alignment - 1)) & ~(alignment - 1);
+}
+
+size_t guard_get_extra_size(size_t alignment) {
+    return get_offset(alignment) + sizeof(uint64_t);
+}
+
+void *guard_init(void *mem, size_t mem_size, size_t n, size_t alignment, void *call_site) {
+    const size_t offset = get_offset(alignment);
+    void *ptr = (uint8_t *)mem + offset;
+    
+    struct guard_header *header = get_header(ptr);
+    header->size = n;
+    header->mem_size = mem_size;
+    header->call_site = call_site;
+    header->offset = offset;
+    header->checksum = get_checksum(header);
+    write_canary(ptr);
+    return ptr;
+}
+
+bool guard_check(void *ptr) {
+    const struct guard_header *header = get_header(ptr);
+    if (is_freed(header)) {
+        guard_report("double free", ptr);
+        return false;
+    }
+    if (!is_allocated(header)) {
+        guard_report("corrupted header or invalid pointer", ptr);
+        return false;
+    }
+    if (read_canary(ptr) != (header->checksum ^ CANARY_KEY)) {
+        guard_report("buffer overflow", ptr);
+        return false;
+    }
+    return true;
+}
+
+void *guard_get_mem(void *ptr) {
+    return (uint8_t *)ptr - get_header(ptr)->offset;
+}
+
+size_t guard_get_mem_size(void *ptr) {
+    return get_header(ptr)->mem_size;
+}
+
+size_t guard_get_size(void *ptr) {
+    return get_header(ptr)->size;
+}
+
+// Take the oldest entry off the quarantine. Must be called with the lock held.
+static struct quarantine_entry take_oldest(void) {
+    const struct quarantine_entry entry = quarantine[quarantine_first];
+    quarantine_first = (quarantine_first + 1) % GUARD_QUARANTINE_MAX_COUNT;
+    quarantine_count--;
+    quarantine_bytes -= entry.size;
+    return entry;
+}
+
+// Get the memory to release for an entry taken off the quarantine. Memory
+// changed since it was freed can't be trusted, so is reported and leaked.
+static void *release_entry(struct quarantine_entry entry) {
+    if (!is_freed(get_header(entry.ptr))) {
+        guard_report("header changed after free", entry.ptr);
+        return NULL;
+    }
+    if (!is_poisoned(entry.ptr, entry.size)) {
+        guard_report("write after free", entry.ptr);
+        return NULL;
+    }
+    return guard_get_mem(entry.ptr);
+}
+
+void *guard_quarantine(void *ptr) {
+    struct guard_header *header = get_header(ptr);
+    header->checksum ^= FREED_KEY;
+    memset(ptr, POISON_BYTE, get_poison_size(header->size));
+    
+    // Make room by taking off the oldest entry in the same critical section,
+    // so other threads can't overfill the ring.
+    struct quarantine_entry oldest = { NULL, 0 };
+    LOCK_QUARANTINE();
+    if (quarantine_count == GUARD_QUARANTINE_MAX_COUNT) { oldest = take_oldest(); }
+    const size_t index = (quarantine_first + quarantine_count) % GUARD_QUARANTINE_MAX_COUNT;
+    quarantine[index].ptr = ptr;
+    quarantine[index].size = header->size;
+    quarantine_count++;
+    quarantine_bytes += header->size;
+    UNLOCK_QUARANTINE();
+    
+    return oldest.ptr != NULL ? release_entry(oldest) : NULL;
+}
+
+void *guard_evict(bool all) {
+    while (true) {
+        LOCK_QUARANTINE();
+        if (quarantine_count == 0 || (!all && quarantine_bytes <= GUARD_QUARANTINE_MAX_BYTES)) {
+            UNLOCK_QUARANTINE();
+            return NULL;
+        }
+        const struct quarantine_entry entry = take_oldest();
+        UNLOCK_QUARANTINE();
+        
+        void *mem = release_entry(entry);
+        if (mem != NULL) { return mem; }
+    }
+}
+
+void guard_set_handler(void (*handler)(const char *problem, void *ptr, size_t size, void *call_site)) {
+    violation_handler = handler;
+}
+
+void guard_report(const char *problem, void *ptr) {
+    const struct guard_header *header = get_header(ptr);
+    const bool trusted = is_allocated(header) || is_freed(header);
+    const size_t size = trusted ? header->size : 0;
+    void *call_site = trusted ? header->call_site : NULL;
+    
+    if (violation_handler != NULL) {
+        violation_handler(problem, ptr, size, call_site);
+        return;
+    }
+    
+    if (trusted) {
+        fprintf(stderr, "mem: %s at %p (%zu bytes allocated from %p)\n", problem, ptr, size, call_site);
+    } else {
+        fprintf(stderr, "mem: %s at %p\n", problem, ptr);
+    }
+    abort();
+}
+
+void guard_add_stats(struct mem_stats *stats) {
+    LOCK_QUARANTINE();
+    stats->quarantine_count += quarantine_count;
+    stats->quarantine_bytes += quarantine_bytes;
+    UNLOCK_QUARANTINE();
+}
+
+void guard_lock(void) {
+    LOCK_QUARANTINE();
+}
+
+void guard_unlock(void) {
+    UNLOCK_QUARANTINE();
+}
@@ -0,0 +1,83 @@
+#ifndef GUARD_H
+#define GUARD_H
+
+#include "mem_stats.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// With MEM_HARDENED defined, mem.c wraps every allocation in a guard: a
+// checksummed header in front of the data, recording the requested size and
+// where it was allocated from, and a canary after it. Freed memory is
+// poisoned and held in a FIFO quarantine before being released, so it isn't
+// reused straight away.
+
+// Freed memory is released once the quarantine holds more than either of
+// these limits.
+#ifndef GUARD_QUARANTINE_MAX_COUNT
+#define GUARD_QUARANTINE_MAX_COUNT 1024
+#endif
+
+#ifndef GUARD_QUARANTINE_MAX_BYTES
+#define GUARD_QUARANTINE_MAX_BYTES (1024 * 1024)
+#endif
+
+// Only this many bytes at the start of freed memory are poisoned (and
+// checked when leaving the quarantine), to bound the cost of large frees.
+#ifndef GUARD_POISON_MAX_SIZE
+#define GUARD_POISON_MAX_SIZE 4096
+#endif
+
+// Get the number of bytes needed on top of the requested size for guarded
+// memory with the given alignment.
+size_t guard_get_extra_size(size_t alignment);
+
+// Construct a guard in 'mem', which has 'mem_size' usable bytes and room for
+// 'n' bytes plus guard_get_extra_size(alignment). Returns the (aligned)
+// pointer to give out.
+void *guard_init(void *mem, size_t mem_size, size_t n, size_t alignment, void *call_site);
+
+// Check the header and canary of guarded memory that's about to be freed or
+// resized, reporting any problem. Returns false if there was one.
+bool guard_check(void *ptr);
+
+// Get the memory passed to guard_init().
+void *guard_get_mem(void *ptr);
+
+// Get the usable size of the memory passed to guard_init().
+size_t guard_get_mem_size(void *ptr);
+
+// Get the size requested for guarded memory.
+size_t guard_get_size(void *ptr);
+
+// Poison checked memory and add it to the quarantine. If the quarantine was
+// full, returns the memory passed to guard_init() for the oldest entry, so it
+// can be released; otherwise returns NULL.
+void *guard_quarantine(void *ptr);
+
+// Take the oldest memory off the quarantine while it holds more than
+// GUARD_QUARANTINE_MAX_BYTES (or while it holds anything, if 'all' is set),
+// returning the memory passed to guard_init() so it can be released. Returns
+// NULL once there is nothing more to release.
+//
+// Memory that was changed while in the quarantine is reported and never
+// released.
+void *guard_evict(bool all);
+
+// Set the function called by guard_report(). NULL restores the default,
+// which prints the problem to stderr and aborts.
+void guard_set_handler(void (*handler)(const char *problem, void *ptr, size_t size, void *call_site));
+
+// Report a problem with guarded memory, along with its size and the call
+// site that allocated it, if the header can be trusted.
+void guard_report(const char *problem, void *ptr);
+
+// Add the memory in the quarantine to 'stats'.
+void guard_add_stats(struct mem_stats *stats);
+
+// Take and release the lock on the quarantine (with MEM_THREAD_SAFE), so that
+// fork() can't copy it while it's held.
+void guard_lock(void);
+void guard_unlock(void);
+
+#endif
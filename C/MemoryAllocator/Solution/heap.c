@@ -0,0 +1,660 @@
+#include "heap.h"
+
+#include "block.h"
+#include "blockmem.h"
+#include "freelist.h"
+#include "mem_kernel.h"
+#include "pages.h"
+#include "small.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+static bool is_power_of_two(size_t value) {
+    return value != 0 && (value & (value - 1)) == 0;
+}
+
+static size_t data_size_for_size(size_t n) {
+    // Round up to nearest multiple of 8, leaving room for free list links.
+    n = (n + 7) & ~7;
+    if (n < BLOCKMEM_MIN_DATA_SIZE) { n = BLOCKMEM_MIN_DATA_SIZE; }
+    return n;
+}
+
+// Add a block whose memory is one free blockmem to the front of the list.
+static void add_block(struct heap *heap, struct block *block) {
+    block->prev = NULL;
+    block->next = heap->first_block;
+    if (heap->first_block != NULL) { heap->first_block->prev = block; }
+    heap->first_block = block;
+    
+    freelist_insert(&(heap->freelist), block_get_first_mem(block));
+}
+
+static struct block *alloc_block(struct heap *heap, size_t n) {
+    const size_t alloc_size = pages_round_size(block_alloc_size_for_data_size(n));
+    if (alloc_size == 0 || alloc_size > BLOCK_MAX_ALLOC_SIZE) { return NULL; }
+    
+    void *block_mem = pages_alloc(alloc_size);
+    if (block_mem == NULL) { return NULL; }
+    
+    struct block *block = block_init(block_mem, alloc_size, heap);
+    assert(block != NULL);
+    
+    add_block(heap, block);
+    return block;
+}
+
+// Take a retained block with room for n bytes of data and put it back in use.
+static struct block *reuse_block(struct heap *heap, size_t n) {
+    struct block **link = &(heap->retained_blocks);
+    while (*link != NULL) {
+        struct block *block = *link;
+        if (blockmem_get_data_size(block_get_first_mem(block)) >= n) {
+            *link = block->next;
+            heap->retained_count--;
+            heap->retained_bytes -= block_get_alloc_size(block);
+            add_block(heap, block);
+            return block;
+        }
+        link = &(block->next);
+    }
+    return NULL;
+}
+
+// Release retained blocks that haven't been reused for a while.
+static void release_old_blocks(struct heap *heap) {
+    struct block **link = &(heap->retained_blocks);
+    while (*link != NULL) {
+        struct block *block = *link;
+        if (heap->free_count - block->retained_at > HEAP_RETAIN_DECAY_FREES) {
+            *link = block->next;
+            heap->retained_count--;
+            heap->retained_bytes -= block_get_alloc_size(block);
+            pages_free(block_get_alloc_ptr(block), block_get_alloc_size(block));
+        } else {
+            link = &(block->next);
+        }
+    }
+}
+
+static void free_block(struct heap *heap, struct block *block) {
+    assert(!block_has_allocations(block));
+    
+    // With nothing allocated the block is a single free blockmem.
+    struct blockmem *mem = block_get_first_mem(block);
+    assert(blockmem_next(mem) == &(block->endmem));
+    freelist_remove(&(heap->freelist), mem);
+    
+    if (block->prev != NULL) { block->prev->next = block->next; }
+    if (block->next != NULL) { block->next->prev = block->prev; }
+    if (block == heap->first_block) { heap->first_block = block->next; }
+    
+    release_old_blocks(heap);
+    
+    // Keep the block for reuse if there's room, so alternately allocating
+    // and freeing doesn't call the kernel every time. One block is kept
+    // whatever its size, for providers with large pages.
+    const size_t alloc_size = block_get_alloc_size(block);
+    if (heap->retained_count < HEAP_RETAIN_MAX_BLOCKS &&
+        (heap->retained_count == 0 || heap->retained_bytes + alloc_size <= HEAP_RETAIN_MAX_BYTES)) {
+        block->prev = NULL;
+        block->next = heap->retained_blocks;
+        block->retained_at = heap->free_count;
+        heap->retained_blocks = block;
+        heap->retained_count++;
+        heap->retained_bytes += alloc_size;
+        return;
+    }
+    
+    pages_free(block_get_alloc_ptr(block), alloc_size);
+}
+
+// Try to split an allocated blockmem so that rest of the space can be used.
+static void trim_mem(struct heap *heap, struct blockmem *mem, const size_t data_size) {
+    assert(blockmem_is_allocated(mem));
+    
+    const size_t old_data_size = blockmem_get_data_size(mem);
+    blockmem_split(mem, data_size);
+    if (blockmem_get_data_size(mem) == old_data_size) { return; }
+    
+    struct blockmem *rest = blockmem_next(mem);
+    struct blockmem *next = blockmem_next(rest);
+    if (!blockmem_is_end(next) && !blockmem_is_allocated(next)) {
+        freelist_remove(&(heap->freelist), next);
+        blockmem_merge_with_next(rest);
+    }
+    
+    freelist_insert(&(heap->freelist), rest);
+}
+
+// Allocate a free blockmem (already taken off the free lists), returning any
+// space beyond 'n' bytes to the free lists.
+static void *allocate_mem(struct heap *heap, struct blockmem *mem, const size_t n) {
+    blockmem_set_allocated(mem, true);
+    block_get_ptr_from_mem(mem)->alloc_count++;
+    trim_mem(heap, mem, n);
+    return blockmem_get_data_ptr(mem);
+}
+
+#ifdef HEAP_DEFERRED_COALESCING
+
+static struct blockmem **get_quick_next(struct blockmem *mem) {
+    return (struct blockmem **)blockmem_get_data_ptr(mem);
+}
+
+static size_t get_quick_class(const size_t data_size) {
+    assert(data_size >= BLOCKMEM_MIN_DATA_SIZE && data_size <= HEAP_QUICK_MAX_SIZE);
+    return (data_size - BLOCKMEM_MIN_DATA_SIZE) / 8;
+}
+
+static void push_quick(struct heap *heap, struct blockmem *mem) {
+    const size_t quick_class = get_quick_class(blockmem_get_data_size(mem));
+    blockmem_set_deferred(mem, true);
+    block_get_ptr_from_mem(mem)->deferred_count++;
+    *get_quick_next(mem) = heap->quick_lists[quick_class];
+    heap->quick_lists[quick_class] = mem;
+    heap->quick_count++;
+}
+
+// Take a blockmem with a data size of exactly n bytes off the quick lists.
+static struct blockmem *pop_quick(struct heap *heap, const size_t n) {
+    const size_t quick_class = get_quick_class(n);
+    struct blockmem *mem = heap->quick_lists[quick_class];
+    if (mem == NULL) { return NULL; }
+    
+    heap->quick_lists[quick_class] = *get_quick_next(mem);
+    heap->quick_count--;
+    blockmem_set_deferred(mem, false);
+    block_get_ptr_from_mem(mem)->deferred_count--;
+    return mem;
+}
+
+#endif
+
+// Take a free blockmem with at least n bytes for storing data off the free
+// lists, allocating a new block if necessary.
+static struct blockmem *take_free_mem(struct heap *heap, const size_t n) {
+#ifdef HEAP_DEFERRED_COALESCING
+    // The quick lists can never satisfy a larger request, and may hold the
+    // space it needs, so merge them first.
+    if (n > HEAP_QUICK_MAX_SIZE && heap->quick_count != 0) { heap_coalesce(heap); }
+#endif
+    
+    // Try to find space in existing blocks.
+    struct blockmem *mem = freelist_take(&(heap->freelist), n);
+    if (mem != NULL) { return mem; }
+    
+#ifdef HEAP_DEFERRED_COALESCING
+    // Merging memory on the quick lists may make enough space.
+    if (heap->quick_count != 0) {
+        heap_coalesce(heap);
+        mem = freelist_take(&(heap->freelist), n);
+        if (mem != NULL) { return mem; }
+    }
+#endif
+    
+    // No space available, so reuse an empty block or allocate a new one.
+    if (reuse_block(heap, n) == NULL && alloc_block(heap, n) == NULL) { return NULL; }
+    
+    mem = freelist_take(&(heap->freelist), n);
+    assert(mem != NULL);
+    return mem;
+}
+
+void heap_init(struct heap *heap) {
+    heap->first_block = NULL;
+    freelist_init(&(heap->freelist));
+    heap->retained_blocks = NULL;
+    heap->retained_count = 0;
+    heap->retained_bytes = 0;
+    heap->free_count = 0;
+#ifdef HEAP_DEFERRED_COALESCING
+    for (size_t i = 0; i < HEAP_QUICK_CLASS_COUNT; i++) {
+        heap->quick_lists[i] = NULL;
+    }
+    heap->quick_count = 0;
+#endif
+#ifdef HEAP_SMALL_PAGES
+    small_init(&(heap->small_pages));
+#endif
+}
+
+void *heap_alloc(struct heap *heap, size_t n) {
+    if (n == 0 || n > BLOCKMEM_MAX_DATA_SIZE) { return NULL; }
+    
+#ifdef HEAP_SMALL_PAGES
+    if (n <= SMALL_MAX_SIZE) { return small_alloc(&(heap->small_pages), heap, n); }
+#endif
+    
+    n = data_size_for_size(n);
+    
+#ifdef HEAP_DEFERRED_COALESCING
+    // Memory on the quick lists is still marked as allocated, so it can be
+    // handed out as it is.
+    if (n <= HEAP_QUICK_MAX_SIZE) {
+        struct blockmem *quick_mem = pop_quick(heap, n);
+        if (quick_mem != NULL) { return blockmem_get_data_ptr(quick_mem); }
+    }
+#endif
+    
+    struct blockmem *mem = take_free_mem(heap, n);
+    if (mem == NULL) { return NULL; }
+    
+    return allocate_mem(heap, mem, n);
+}
+
+void *heap_alloc_aligned(struct heap *heap, size_t n, const size_t alignment) {
+    if (!is_power_of_two(alignment)) { return NULL; }
+    
+    // Data is always 8-byte aligned.
+    if (alignment <= 8) { return heap_alloc(heap, n); }
+    
+    if (n == 0 || n > BLOCKMEM_MAX_DATA_SIZE) { return NULL; }
+    
+    n = data_size_for_size(n);
+    
+    // Any space skipped to reach an aligned address becomes a free blockmem
+    // of its own, so it must either be empty or large enough to hold one.
+    const size_t min_padding_size = blockmem_alloc_size_for_data_size(BLOCKMEM_MIN_DATA_SIZE);
+    if (BLOCKMEM_MAX_DATA_SIZE - n < alignment + min_padding_size) { return NULL; }
+    const size_t search_size = n + alignment + min_padding_size;
+    
+    struct blockmem *mem = take_free_mem(heap, search_size);
+    if (mem == NULL) { return NULL; }
+    
+    const uintptr_t data_address = (uintptr_t)blockmem_get_data_ptr(mem);
+    uintptr_t aligned_address = (data_address + (alignment - 1)) & ~(uintptr_t)(alignment - 1);
+    while (aligned_address != data_address && aligned_address - data_address < min_padding_size) {
+        aligned_address += alignment;
+    }
+    
+    if (aligned_address != data_address) {
+        // Split the padding off the front and put it back on the free lists;
+        // it will merge back when the aligned memory is freed.
+        const size_t padding_size = aligned_address - data_address;
+        struct blockmem *padding = mem;
+        blockmem_split(padding, padding_size - sizeof(struct blockmem));
+        mem = blockmem_next(padding);
+        assert(blockmem_get_data_ptr(mem) == (void *)aligned_address);
+        freelist_insert(&(heap->freelist), padding);
+    }
+    
+    return allocate_mem(heap, mem, n);
+}
+
+// Allocate up to 'count' blockmems of n bytes of data from the front of a
+// free blockmem (already taken off the free lists), returning the rest of it
+// to the free lists. Returns the number allocated, which is at least one.
+static size_t carve_mems(struct heap *heap, struct blockmem *mem, size_t n, size_t count,
+                         void **ptrs) {
+    struct block *block = block_get_ptr_from_mem(mem);
+    const size_t stride = blockmem_alloc_size_for_data_size(n);
+    size_t carved = 0;
+    for (;;) {
+        blockmem_set_allocated(mem, true);
+        ptrs[carved++] = blockmem_get_data_ptr(mem);
+        if (carved == count || blockmem_get_data_size(mem) < n + stride) { break; }
+        
+        blockmem_split(mem, n);
+        mem = blockmem_next(mem);
+    }
+    
+    block->alloc_count += carved;
+    trim_mem(heap, mem, n);
+    return carved;
+}
+
+bool heap_alloc_batch(struct heap *heap, size_t n, size_t count, void **ptrs) {
+    if (n == 0 || n > BLOCKMEM_MAX_DATA_SIZE) { return false; }
+    
+    size_t done = 0;
+#ifdef HEAP_SMALL_PAGES
+    if (n <= SMALL_MAX_SIZE) {
+        for (; done < count; done++) {
+            ptrs[done] = small_alloc(&(heap->small_pages), heap, n);
+            if (ptrs[done] == NULL) { break; }
+        }
+    } else
+#endif
+    {
+        n = data_size_for_size(n);
+        
+#ifdef HEAP_DEFERRED_COALESCING
+        if (n <= HEAP_QUICK_MAX_SIZE) {
+            struct blockmem *quick_mem;
+            while (done < count && (quick_mem = pop_quick(heap, n)) != NULL) {
+                ptrs[done++] = blockmem_get_data_ptr(quick_mem);
+            }
+        }
+#endif
+        
+        const size_t stride = blockmem_alloc_size_for_data_size(n);
+        const size_t max_run_count = HEAP_BATCH_MAX_SIZE / stride > 0 ? HEAP_BATCH_MAX_SIZE / stride : 1;
+        while (done < count) {
+            // Look for one free blockmem with room for the rest of the batch,
+            // then for room for at least one, before adding a block.
+            const size_t run_count = count - done < max_run_count ? count - done : max_run_count;
+            const size_t run_size = run_count * stride - sizeof(struct blockmem);
+            struct blockmem *mem = freelist_take(&(heap->freelist), run_size);
+            if (mem == NULL && run_count > 1) { mem = freelist_take(&(heap->freelist), n); }
+            if (mem == NULL) { mem = take_free_mem(heap, run_size); }
+            if (mem == NULL) { break; }
+            
+            done += carve_mems(heap, mem, n, count - done, ptrs + done);
+        }
+    }
+    
+    if (done == count) { return true; }
+    
+    // Out of memory, so give back what was allocated.
+    while (done > 0) {
+        heap_free(heap, ptrs[--done]);
+    }
+    return false;
+}
+
+// Mark an allocated blockmem in 'block' as free, merge it with its neighbours
+// and put it on the free lists. The block's allocation count must already
+// have been updated.
+static void release_mem(struct heap *heap, struct block *block, struct blockmem *mem) {
+    blockmem_set_allocated(mem, false);
+    
+    // Merge with neighbouring free blockmems. Free blockmems are always
+    // merged, so there is at most one on each side.
+    struct blockmem *next = blockmem_next(mem);
+    if (!blockmem_is_end(next) && !blockmem_is_allocated(next)) {
+        freelist_remove(&(heap->freelist), next);
+        blockmem_merge_with_next(mem);
+    }
+    
+    if (blockmem_is_prev_free(mem)) {
+        struct blockmem *prev = blockmem_prev(mem);
+        freelist_remove(&(heap->freelist), prev);
+        blockmem_merge_with_next(prev);
+        mem = prev;
+    }
+    
+    freelist_insert(&(heap->freelist), mem);
+    
+    // Free the block if nothing is allocated in it.
+    if (!block_has_allocations(block)) {
+        free_block(heap, block);
+    }
+}
+
+// Mark an allocated blockmem as free, merge it with its neighbours and put it
+// on the free lists.
+static void free_mem(struct heap *heap, struct blockmem *mem) {
+    struct block *block = block_get_ptr_from_mem(mem);
+    assert(block->alloc_count > 0);
+    block->alloc_count--;
+    release_mem(heap, block, mem);
+}
+
+void heap_free(struct heap *heap, void *ptr) {
+#ifdef HEAP_SMALL_PAGES
+    if (small_is_allocation(ptr)) {
+        assert(small_get_owner(ptr) == heap && "Freed to wrong heap");
+        heap->free_count++;
+        small_free(&(heap->small_pages), ptr);
+        return;
+    }
+#endif
+    
+    struct blockmem *mem = blockmem_get_ptr_from_data_ptr(ptr);
+    assert(blockmem_is_allocated(mem) && !blockmem_is_deferred(mem) && "Already freed");
+    assert(block_get_ptr_from_mem(mem)->heap == heap && "Freed to wrong heap");
+    heap->free_count++;
+    
+#ifdef HEAP_DEFERRED_COALESCING
+    if (blockmem_get_data_size(mem) <= HEAP_QUICK_MAX_SIZE) {
+        push_quick(heap, mem);
+        
+        // A block whose memory has all been freed is merged straight away,
+        // so it can be retained or released.
+        struct block *block = block_get_ptr_from_mem(mem);
+        if (heap->quick_count > HEAP_QUICK_MAX_COUNT || block->deferred_count == block->alloc_count) {
+            heap_coalesce(heap);
+        }
+        return;
+    }
+#endif
+    
+    free_mem(heap, mem);
+}
+
+void heap_free_batch(struct heap *heap, void **ptrs, size_t count) {
+    size_t i = 0;
+    while (i < count) {
+        void *ptr = ptrs[i++];
+        
+#ifdef HEAP_SMALL_PAGES
+        if (small_is_allocation(ptr)) {
+            heap_free(heap, ptr);
+            continue;
+        }
+#endif
+        
+        struct blockmem *mem = blockmem_get_ptr_from_data_ptr(ptr);
+        assert(blockmem_is_allocated(mem) && !blockmem_is_deferred(mem) && "Already freed");
+        assert(block_get_ptr_from_mem(mem)->heap == heap && "Freed to wrong heap");
+        
+#ifdef HEAP_DEFERRED_COALESCING
+        if (blockmem_get_data_size(mem) <= HEAP_QUICK_MAX_SIZE) {
+            heap_free(heap, ptr);
+            continue;
+        }
+#endif
+        
+        // Absorb the allocations straight after this one that are also being
+        // freed, so the whole run is merged and put on the free lists once.
+        size_t run_count = 1;
+        struct blockmem *last = mem;
+        while (i < count) {
+            struct blockmem *next = blockmem_next(last);
+            if (blockmem_is_end(next) || blockmem_get_data_ptr(next) != ptrs[i]) { break; }
+            assert(blockmem_is_allocated(next) && !blockmem_is_deferred(next) && "Already freed");
+#ifdef HEAP_DEFERRED_COALESCING
+            if (blockmem_get_data_size(next) <= HEAP_QUICK_MAX_SIZE) { break; }
+#endif
+            last = next;
+            run_count++;
+            i++;
+        }
+        if (last != mem) {
+            const uint8_t *run_end = (uint8_t *)blockmem_next(last);
+            blockmem_set_data_size(mem, run_end - (uint8_t *)blockmem_get_data_ptr(mem));
+        }
+        
+        struct block *block = block_get_ptr_from_mem(mem);
+        assert(block->alloc_count >= run_count);
+        block->alloc_count -= run_count;
+        heap->free_count += run_count;
+        release_mem(heap, block, mem);
+    }
+}
+
+void heap_coalesce(struct heap *heap) {
+#ifdef HEAP_DEFERRED_COALESCING
+    for (size_t i = 0; i < HEAP_QUICK_CLASS_COUNT; i++) {
+        // Reverse the list, so memory is merged in the order it was freed.
+        struct blockmem *oldest = NULL;
+        struct blockmem *mem = heap->quick_lists[i];
+        heap->quick_lists[i] = NULL;
+        while (mem != NULL) {
+            struct blockmem *next = *get_quick_next(mem);
+            *get_quick_next(mem) = oldest;
+            oldest = mem;
+            mem = next;
+        }
+        
+        for (mem = oldest; mem != NULL; ) {
+            struct blockmem *next = *get_quick_next(mem);
+            blockmem_set_deferred(mem, false);
+            block_get_ptr_from_mem(mem)->deferred_count--;
+            free_mem(heap, mem);
+            mem = next;
+        }
+    }
+    heap->quick_count = 0;
+#else
+    (void)heap;
+#endif
+}
+
+bool heap_resize(struct heap *heap, void *ptr, size_t n) {
+    if (n == 0 || n > BLOCKMEM_MAX_DATA_SIZE) { return false; }
+    
+#ifdef HEAP_SMALL_PAGES
+    // Small objects can't grow beyond their page's object size.
+    if (small_is_allocation(ptr)) {
+        assert(small_get_owner(ptr) == heap && "Resized in wrong heap");
+        return n <= small_get_usable_size(ptr);
+    }
+#endif
+    
+    n = data_size_for_size(n);
+    
+    struct blockmem *mem = blockmem_get_ptr_from_data_ptr(ptr);
+    assert(blockmem_is_allocated(mem));
+    assert(block_get_ptr_from_mem(mem)->heap == heap && "Resized in wrong heap");
+    
+    if (n > blockmem_get_data_size(mem)) {
+        // Grow into the next blockmem, if it's free and large enough.
+        struct blockmem *next = blockmem_next(mem);
+        if (blockmem_is_end(next) || blockmem_is_allocated(next)) { return false; }
+        if (blockmem_get_data_size(mem) + blockmem_get_alloc_size(next) < n) { return false; }
+        
+        freelist_remove(&(heap->freelist), next);
+        blockmem_merge_with_next(mem);
+    }
+    
+    trim_mem(heap, mem, n);
+    return true;
+}
+
+// Release a list of blocks to the page provider.
+static void release_blocks(struct block *block) {
+    while (block != NULL) {
+        struct block *next = block->next;
+        pages_free(block_get_alloc_ptr(block), block_get_alloc_size(block));
+        block = next;
+    }
+}
+
+void heap_trim(struct heap *heap) {
+    // Merging deferred frees may leave more blocks empty.
+    heap_coalesce(heap);
+    
+#ifdef HEAP_SMALL_PAGES
+    small_trim(&(heap->small_pages));
+#endif
+    
+    release_blocks(heap->retained_blocks);
+    heap->retained_blocks = NULL;
+    heap->retained_count = 0;
+    heap->retained_bytes = 0;
+}
+
+void heap_destroy(struct heap *heap) {
+#ifdef HEAP_SMALL_PAGES
+    small_release_all(&(heap->small_pages));
+#endif
+    
+    // Memory on the quick lists and free lists is all inside the blocks, so
+    // there's nothing to unlink first.
+    release_blocks(heap->first_block);
+    release_blocks(heap->retained_blocks);
+    heap_init(heap);
+}
+
+size_t heap_get_usable_size(void *ptr) {
+#ifdef HEAP_SMALL_PAGES
+    if (small_is_allocation(ptr)) { return small_get_usable_size(ptr); }
+#endif
+    return blockmem_get_data_size(blockmem_get_ptr_from_data_ptr(ptr));
+}
+
+size_t heap_get_good_size(size_t n) {
+#ifdef HEAP_SMALL_PAGES
+    // Small objects are packed at their size rounded up to 8 bytes.
+    if (n <= SMALL_MAX_SIZE) { return (n + 7) & ~(size_t)7; }
+#endif
+    return data_size_for_size(n);
+}
+
+struct heap *heap_get_owner(void *ptr) {
+#ifdef HEAP_SMALL_PAGES
+    if (small_is_allocation(ptr)) { return small_get_owner(ptr); }
+#endif
+    return block_get_ptr_from_mem(blockmem_get_ptr_from_data_ptr(ptr))->heap;
+}
+
+void heap_add_stats(struct heap *heap, struct mem_stats *stats) {
+    for (struct block *block = heap->first_block; block != NULL; block = block->next) {
+        stats->block_count++;
+        stats->reserved_bytes += block_get_alloc_size(block);
+        
+        struct blockmem *mem;
+        for (mem = block_get_first_mem(block); !blockmem_is_end(mem); mem = blockmem_next(mem)) {
+            const size_t data_size = blockmem_get_data_size(mem);
+            if (blockmem_is_allocated(mem) && !blockmem_is_deferred(mem)) {
+                stats->alloc_count++;
+                stats->allocated_bytes += data_size;
+                stats->class_alloc_counts[freelist_class_for_size(data_size)]++;
+                continue;
+            }
+            
+            // Memory on the quick lists looks allocated, but has been freed.
+            if (blockmem_is_deferred(mem)) {
+                stats->deferred_count++;
+                stats->deferred_bytes += data_size;
+            }
+            stats->free_count++;
+            stats->free_bytes += data_size;
+            if (data_size > stats->largest_free_size) { stats->largest_free_size = data_size; }
+        }
+    }
+    
+#ifdef HEAP_SMALL_PAGES
+    small_add_stats(&(heap->small_pages), stats);
+#endif
+    
+    stats->retained_block_count += heap->retained_count;
+    stats->retained_bytes += heap->retained_bytes;
+    stats->reserved_bytes += heap->retained_bytes;
+    
+    stats->search_count += heap->freelist.take_count;
+    stats->scan_count += heap->freelist.scan_count;
+    if (heap->freelist.max_scan_count > stats->max_scan_count) {
+        stats->max_scan_count = heap->freelist.max_scan_count;
+    }
+}
+
+void heap_dump(struct heap *heap, FILE *file) {
+    for (struct block *block = heap->first_block; block != NULL; block = block->next) {
+        uint8_t *block_ptr = block_get_alloc_ptr(block);
+        fprintf(file, "block %p: %zu bytes, %zu allocations\n", (void *)block_ptr,
+                block_get_alloc_size(block), block->alloc_count);
+        
+        struct blockmem *mem;
+        for (mem = block_get_first_mem(block); !blockmem_is_end(mem); mem = blockmem_next(mem)) {
+            const char *state = blockmem_is_deferred(mem) ? "deferred" :
+                blockmem_is_allocated(mem) ? "used" : "free";
+            fprintf(file, "  +%-8zu %s %zu\n", (size_t)((uint8_t *)mem - block_ptr),
+                    state, blockmem_get_data_size(mem));
+        }
+    }
+    
+    fprintf(file, "retained: %zu blocks, %zu bytes\n", heap->retained_count, heap->retained_bytes);
+#ifdef HEAP_DEFERRED_COALESCING
+    fprintf(file, "quick lists: %zu blockmems\n", heap->quick_count);
+#endif
+#ifdef HEAP_SMALL_PAGES
+    small_dump(&(heap->small_pages), file);
+#endif
+}
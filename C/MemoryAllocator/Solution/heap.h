@@ -0,0 +1,145 @@
+#ifndef HEAP_H
+#define HEAP_H
+
+#include "block.h"
+#include "freelist.h"
+#include "mem_kernel.h"
+#include "mem_stats.h"
+#include "small.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Blocks left empty by heap_free() are kept for reuse, up to these limits per
+// heap, rather than going straight back to the page provider. Define
+// HEAP_RETAIN_MAX_BLOCKS as 0 to release empty blocks immediately.
+#ifndef HEAP_RETAIN_MAX_BLOCKS
+#define HEAP_RETAIN_MAX_BLOCKS 4
+#endif
+
+#ifndef HEAP_RETAIN_MAX_BYTES
+#define HEAP_RETAIN_MAX_BYTES (64 * MEM_BLOCK_SIZE)
+#endif
+
+// Retained blocks that haven't been reused after this many calls to
+// heap_free() are released the next time a block becomes empty.
+#ifndef HEAP_RETAIN_DECAY_FREES
+#define HEAP_RETAIN_DECAY_FREES 100000
+#endif
+
+// heap_alloc_batch() looks for space for up to this many bytes of a batch at
+// once.
+#ifndef HEAP_BATCH_MAX_SIZE
+#define HEAP_BATCH_MAX_SIZE (16 * MEM_BLOCK_SIZE)
+#endif
+
+// With HEAP_DEFERRED_COALESCING defined, heap_free() doesn't merge freed
+// memory of up to HEAP_QUICK_MAX_SIZE bytes with its neighbours. Instead it
+// goes on a 'quick list' for its exact size and is handed straight back out
+// by heap_alloc(). Quick lists are merged into the free lists when an
+// allocation can't otherwise be satisfied, or when they hold more than
+// HEAP_QUICK_MAX_COUNT blockmems.
+#ifndef HEAP_QUICK_MAX_SIZE
+#define HEAP_QUICK_MAX_SIZE 256
+#endif
+
+#ifndef HEAP_QUICK_MAX_COUNT
+#define HEAP_QUICK_MAX_COUNT 1024
+#endif
+
+#define HEAP_QUICK_CLASS_COUNT ((HEAP_QUICK_MAX_SIZE - BLOCKMEM_MIN_DATA_SIZE) / 8 + 1)
+
+// With HEAP_SMALL_PAGES defined, heap_alloc() puts allocations of up to
+// SMALL_MAX_SIZE bytes in pages of same-sized objects (see small.h) rather
+// than in blockmems, saving the size field and the rounding up to
+// BLOCKMEM_MIN_DATA_SIZE.
+
+// A set of blocks and the free blockmems within them. A zeroed heap is
+// empty, so static heaps need no initialisation.
+struct heap {
+    struct block *first_block;
+    
+    // Every free blockmem in every block of the heap, keyed by size class.
+    struct freelist freelist;
+    
+    // Empty blocks kept for reuse, most recently emptied first. These aren't
+    // in the block list and their memory isn't on the free lists.
+    struct block *retained_blocks;
+    size_t retained_count;
+    size_t retained_bytes;
+    
+    // Number of calls to heap_free(), used to age retained blocks.
+    size_t free_count;
+    
+#ifdef HEAP_DEFERRED_COALESCING
+    // Freed blockmems waiting to be merged, by exact data size. These are
+    // still marked as allocated, so nothing merges with them.
+    struct blockmem *quick_lists[HEAP_QUICK_CLASS_COUNT];
+    size_t quick_count;
+#endif
+    
+#ifdef HEAP_SMALL_PAGES
+    struct small_pages small_pages;
+#endif
+};
+
+// Construct an empty heap.
+void heap_init(struct heap *heap);
+
+// Returns a pointer to contiguous memory of size at least 'n' bytes from the
+// heap. Returns NULL if no memory is available or 'n' is zero.
+void *heap_alloc(struct heap *heap, size_t n);
+
+// Releases memory allocated by heap_alloc() from the same heap.
+void heap_free(struct heap *heap, void *ptr);
+
+// Allocate 'count' pieces of memory of at least 'n' bytes each from the heap,
+// storing pointers to them in 'ptrs'. Neighbouring pieces are carved from the
+// same free blockmem where possible. Returns false, allocating nothing, if no
+// memory is available or 'n' is zero.
+bool heap_alloc_batch(struct heap *heap, size_t n, size_t count, void **ptrs);
+
+// Like heap_alloc(), but the returned pointer is a multiple of 'alignment',
+// which must be a power of two. The result can be used with heap_free() etc.
+void *heap_alloc_aligned(struct heap *heap, size_t n, size_t alignment);
+
+// Releases memory allocated by heap_alloc() etc. from the same heap. Runs of
+// pieces that are next to each other in memory and in 'ptrs' (e.g. when
+// 'ptrs' is sorted by address) are merged and put on the free lists together.
+void heap_free_batch(struct heap *heap, void **ptrs, size_t count);
+
+// Resize memory allocated by heap_alloc() from the same heap to at least 'n'
+// bytes without moving it. Returns false (leaving the memory unchanged) if
+// that isn't possible.
+bool heap_resize(struct heap *heap, void *ptr, size_t n);
+
+// Merge any freed memory waiting on quick lists (see
+// HEAP_DEFERRED_COALESCING) into the free lists.
+void heap_coalesce(struct heap *heap);
+
+// Release every retained empty block to the page provider, and any empty
+// small pages (see HEAP_SMALL_PAGES) for use by other heaps.
+void heap_trim(struct heap *heap);
+
+// Release every block of the heap to the page provider at once, whatever is
+// still allocated in it, leaving the heap empty.
+void heap_destroy(struct heap *heap);
+
+// Get the number of bytes usable in memory returned by heap_alloc().
+size_t heap_get_usable_size(void *ptr);
+
+// Get the number of bytes heap_alloc() gives at least for 'n' (at least 1).
+size_t heap_get_good_size(size_t n);
+
+// Get the heap that memory returned by heap_alloc() came from.
+struct heap *heap_get_owner(void *ptr);
+
+// Add the blocks, blockmems and free list searches of the heap to 'stats'.
+// Doesn't calculate averages or fragmentation.
+void heap_add_stats(struct heap *heap, struct mem_stats *stats);
+
+// Print a map of every block in the heap and the blockmems in it to 'file'.
+void heap_dump(struct heap *heap, FILE *file);
+
+#endif
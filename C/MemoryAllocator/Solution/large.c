@@ -0,0 +1,144 @@
+#include "large.h"
+
+#include "blockmem.h"
+#include "mem_kernel.h"
+#include "pages.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Stored immediately before the data of a large allocation.
+struct large_header {
+    // Memory returned by pages_alloc().
+    void *block_mem;
+    
+    // Number of bytes usable after the header.
+    size_t data_size;
+    
+    // Size of the memory returned by pages_alloc().
+    size_t alloc_size;
+    
+    // Neighbours in a large_list, if the allocation is in one.
+    struct large_header *prev;
+    struct large_header *next;
+    
+    // Marks this as a large allocation, for large_is_allocation().
+    struct blockmem mem;
+};
+
+// Totals over live large allocations, for large_add_stats(). These are
+// updated by any thread without a lock, so are accessed atomically.
+static size_t live_count;
+static size_t live_reserved_bytes;
+static size_t live_data_bytes;
+
+static void add_to_totals(const struct large_header *header) {
+    __atomic_fetch_add(&live_count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&live_reserved_bytes, header->alloc_size, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&live_data_bytes, header->data_size, __ATOMIC_RELAXED);
+}
+
+static void remove_from_totals(const struct large_header *header) {
+    __atomic_fetch_sub(&live_count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&live_reserved_bytes, header->alloc_size, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&live_data_bytes, header->data_size, __ATOMIC_RELAXED);
+}
+
+static struct large_header *get_header(void *ptr) {
+    return (struct large_header *)ptr - 1;
+}
+
+void *large_alloc(const size_t n, const size_t alignment) {
+    assert(alignment != 0 && (alignment & (alignment - 1)) == 0);
+    
+    // Memory from the kernel is at least 8-byte aligned, so this is the most
+    // that can be needed to reach an aligned address after the header.
+    const size_t extra_size = sizeof(struct large_header) + (alignment > 8 ? alignment - 8 : 0);
+    if (n > SIZE_MAX - extra_size) { return NULL; }
+    
+    const size_t alloc_size = pages_round_size(n + extra_size);
+    if (alloc_size == 0) { return NULL; }
+    uint8_t *block_mem = pages_alloc(alloc_size);
+    if (block_mem == NULL) { return NULL; }
+    
+    const uintptr_t data_address = ((uintptr_t)(block_mem + sizeof(struct large_header)) + (alignment - 1))
+        & ~(uintptr_t)(alignment - 1);
+    uint8_t *data = (uint8_t *)data_address;
+    
+    struct large_header *header = get_header(data);
+    header->block_mem = block_mem;
+    header->alloc_size = alloc_size;
+    header->data_size = (block_mem + header->alloc_size) - data;
+    header->prev = NULL;
+    header->next = NULL;
+    blockmem_init_standalone(&(header->mem));
+    assert(header->data_size >= n);
+    assert(blockmem_get_data_ptr(&(header->mem)) == data);
+    add_to_totals(header);
+    return data;
+}
+
+void large_free(void *ptr) {
+    assert(large_is_allocation(ptr));
+    struct large_header *header = get_header(ptr);
+    remove_from_totals(header);
+    pages_free(header->block_mem, header->alloc_size);
+}
+
+bool large_is_allocation(void *ptr) {
+    return blockmem_is_standalone(blockmem_get_ptr_from_data_ptr(ptr));
+}
+
+size_t large_get_usable_size(void *ptr) {
+    assert(large_is_allocation(ptr));
+    return get_header(ptr)->data_size;
+}
+
+size_t large_get_good_size(size_t n) {
+    if (n > SIZE_MAX - sizeof(struct large_header)) { return n; }
+    
+    const size_t alloc_size = pages_round_size(n + sizeof(struct large_header));
+    return alloc_size != 0 ? alloc_size - sizeof(struct large_header) : n;
+}
+
+void large_add_stats(struct mem_stats *stats) {
+    stats->large_count += __atomic_load_n(&live_count, __ATOMIC_RELAXED);
+    stats->reserved_bytes += __atomic_load_n(&live_reserved_bytes, __ATOMIC_RELAXED);
+    stats->allocated_bytes += __atomic_load_n(&live_data_bytes, __ATOMIC_RELAXED);
+}
+
+void large_list_add(struct large_list *list, void *ptr) {
+    struct large_header *header = get_header(ptr);
+    header->prev = NULL;
+    header->next = list->first;
+    if (list->first != NULL) { list->first->prev = header; }
+    list->first = header;
+}
+
+void large_list_remove(struct large_list *list, void *ptr) {
+    struct large_header *header = get_header(ptr);
+    if (header->prev != NULL) { header->prev->next = header->next; }
+    if (header->next != NULL) { header->next->prev = header->prev; }
+    if (header == list->first) { list->first = header->next; }
+}
+
+void large_list_free_all(struct large_list *list) {
+    struct large_header *header = list->first;
+    while (header != NULL) {
+        struct large_header *next = header->next;
+        remove_from_totals(header);
+        pages_free(header->block_mem, header->alloc_size);
+        header = next;
+    }
+    list->first = NULL;
+}
+
+void large_list_add_stats(struct large_list *list, struct mem_stats *stats) {
+    for (struct large_header *header = list->first; header != NULL; header = header->next) {
+        stats->large_count++;
+        stats->reserved_bytes += header->alloc_size;
+        stats->allocated_bytes += header->data_size;
+    }
+}
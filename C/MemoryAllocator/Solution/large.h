@@ -0,0 +1,56 @@
+#ifndef LARGE_H
+#define LARGE_H
+
+#include "mem_kernel.h"
+#include "mem_stats.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Allocations of at least this many bytes get memory of their own straight
+// from the page provider, rather than sharing blocks with other allocations.
+#define LARGE_MIN_SIZE (16 * MEM_BLOCK_SIZE)
+
+// Returns a pointer to contiguous memory of size at least 'n' bytes, at an
+// address that is a multiple of 'alignment' (a power of two). Returns NULL if
+// no memory is available.
+void *large_alloc(size_t n, size_t alignment);
+
+// Releases memory allocated by large_alloc() back to the page provider.
+void large_free(void *ptr);
+
+// Query if memory was allocated by large_alloc(). 'ptr' must have come from
+// either large_alloc() or heap_alloc().
+bool large_is_allocation(void *ptr);
+
+// Get the number of bytes usable in memory returned by large_alloc().
+size_t large_get_usable_size(void *ptr);
+
+// Get the number of bytes usable in memory returned by large_alloc(n, 8),
+// without allocating it.
+size_t large_get_good_size(size_t n);
+
+// Add the live large allocations to 'stats'.
+void large_add_stats(struct mem_stats *stats);
+
+struct large_header;
+
+// Large allocations that are released together, e.g. those of one heap from
+// mem_heap_create(). A zeroed list is empty.
+struct large_list {
+    struct large_header *first;
+};
+
+// Add memory returned by large_alloc() to 'list'.
+void large_list_add(struct large_list *list, void *ptr);
+
+// Remove memory from 'list', before releasing it with large_free().
+void large_list_remove(struct large_list *list, void *ptr);
+
+// Release every allocation in 'list', leaving it empty.
+void large_list_free_all(struct large_list *list);
+
+// Add the allocations in 'list' to 'stats'.
+void large_list_add_stats(struct large_list *list, struct mem_stats *stats);
+
+#endif
@@ -0,0 +1,198 @@
+// Replaces malloc() and the functions related to it with mem_alloc() etc., so
+// that unmodified programs can be run on this allocator with
+//
+//   LD_PRELOAD=/path/to/libmemalloc.so program
+//
+// Built with MEM_THREAD_SAFE, which also makes fork() safe. Memory comes
+// straight from mmap() through the mmap page provider.
+
+#include "mem.h"
+#include "mem_kernel.h"
+#include "mem_provider.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+// Every other symbol in the library is hidden, so it can't clash with the
+// program's own.
+#define SHIM_EXPORT __attribute__((visibility("default")))
+
+// Page size of the mmap provider. Larger pages mean fewer calls to mmap() and
+// fewer mappings (which Linux limits to vm.max_map_count), at the cost of at
+// least one page per thread.
+#ifndef SHIM_PAGE_SIZE
+#define SHIM_PAGE_SIZE ((size_t)64 * 1024)
+#endif
+
+// The default provider is never used, since the mmap provider is set before
+// the first allocation.
+void* mem_block_alloc(size_t n) {
+    (void)n;
+    return NULL;
+}
+
+void mem_block_free(void* ptr) {
+    (void)ptr;
+}
+
+static bool initialized;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
+static void init(void) {
+    struct mem_provider provider;
+    const bool set = mem_provider_init_mmap(&provider, SHIM_PAGE_SIZE) && mem_set_provider(&provider);
+    assert(set);
+    (void)set;
+    __atomic_store_n(&initialized, true, __ATOMIC_RELEASE);
+}
+
+static void ensure_initialized(void) {
+    if (__builtin_expect(!__atomic_load_n(&initialized, __ATOMIC_ACQUIRE), false)) {
+        pthread_once(&init_once, init);
+    }
+}
+
+static bool is_power_of_two(size_t value) {
+    return value != 0 && (value & (value - 1)) == 0;
+}
+
+// Alignment of memory from malloc(). As in glibc, this is enough for any type
+// (max_align_t), except that smaller allocations only get 8 bytes, which is
+// enough for any type that fits in them.
+static size_t get_malloc_alignment(size_t size) {
+    return size < _Alignof(max_align_t) ? sizeof(size_t) : _Alignof(max_align_t);
+}
+
+static bool is_aligned(void *ptr, size_t alignment) {
+    return ((uintptr_t)ptr & (alignment - 1)) == 0;
+}
+
+// Round a size up to 8 more than a multiple of 16. With the 8-byte blockmem
+// header, every blockmem is then a multiple of 16 bytes, so memory carved
+// after a 16-byte aligned allocation is aligned too, with no padding. Zero
+// is rounded up as well, since malloc(0) etc. must return memory that can be
+// freed, unlike mem_alloc(0).
+static size_t round_size(size_t size) {
+    if (size > SIZE_MAX - 23) { return size; }
+    return ((size + 7) & ~(size_t)15) + 8;
+}
+
+static void *alloc_mem(size_t size, size_t alignment) {
+    ensure_initialized();
+    size = round_size(size);
+    
+    // Only the first allocation in a block (or after free memory that
+    // wasn't rounded, such as alignment padding) can be misaligned, so the
+    // aligned path, which searches for enough space to pad, is rarely taken.
+    void *ptr = alignment <= _Alignof(max_align_t) ? mem_alloc(size) : NULL;
+    if (ptr != NULL && !is_aligned(ptr, alignment)) {
+        mem_free(ptr);
+        ptr = NULL;
+    }
+    if (ptr == NULL) { ptr = mem_alloc_aligned(size, alignment); }
+    
+    if (ptr == NULL) { errno = ENOMEM; }
+    return ptr;
+}
+
+SHIM_EXPORT void *malloc(size_t size) {
+    return alloc_mem(size, get_malloc_alignment(size));
+}
+
+SHIM_EXPORT void free(void *ptr) {
+    mem_free(ptr);
+}
+
+SHIM_EXPORT void *calloc(size_t count, size_t size) {
+    if (size != 0 && count > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    
+    void *ptr = alloc_mem(count * size, get_malloc_alignment(count * size));
+    if (ptr != NULL) { memset(ptr, 0, count * size); }
+    return ptr;
+}
+
+SHIM_EXPORT void *realloc(void *ptr, size_t size) {
+    if (ptr == NULL) { return alloc_mem(size, get_malloc_alignment(size)); }
+    
+    // Like glibc, a size of zero frees the memory.
+    if (size == 0) {
+        mem_free(ptr);
+        return NULL;
+    }
+    
+    const size_t alignment = get_malloc_alignment(size);
+    if (is_aligned(ptr, alignment) && mem_resize(ptr, round_size(size))) { return ptr; }
+    
+    void *new_ptr = alloc_mem(size, alignment);
+    if (new_ptr == NULL) { return NULL; }
+    
+    const size_t old_size = mem_get_usable_size(ptr);
+    memcpy(new_ptr, ptr, old_size < size ? old_size : size);
+    mem_free(ptr);
+    return new_ptr;
+}
+
+SHIM_EXPORT void *reallocarray(void *ptr, size_t count, size_t size) {
+    if (size != 0 && count > SIZE_MAX / size) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return realloc(ptr, count * size);
+}
+
+SHIM_EXPORT int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    if (!is_power_of_two(alignment) || alignment % sizeof(void *) != 0) { return EINVAL; }
+    
+    void *ptr = alloc_mem(size, alignment);
+    if (ptr == NULL) { return ENOMEM; }
+    
+    *memptr = ptr;
+    return 0;
+}
+
+SHIM_EXPORT void *aligned_alloc(size_t alignment, size_t size) {
+    if (!is_power_of_two(alignment)) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return alloc_mem(size, alignment < get_malloc_alignment(size) ? get_malloc_alignment(size) : alignment);
+}
+
+SHIM_EXPORT void *memalign(size_t alignment, size_t size) {
+    // glibc rounds the alignment up to a power of two.
+    size_t power = get_malloc_alignment(size);
+    while (power < alignment) {
+        if (power > SIZE_MAX / 2) {
+            errno = EINVAL;
+            return NULL;
+        }
+        power *= 2;
+    }
+    return alloc_mem(size, power);
+}
+
+SHIM_EXPORT void *valloc(size_t size) {
+    return alloc_mem(size, (size_t)sysconf(_SC_PAGESIZE));
+}
+
+SHIM_EXPORT void *pvalloc(size_t size) {
+    const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    if (size > SIZE_MAX - (page_size - 1)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return alloc_mem((size + (page_size - 1)) & ~(page_size - 1), page_size);
+}
+
+SHIM_EXPORT size_t malloc_usable_size(void *ptr) {
+    return mem_get_usable_size(ptr);
+}
@@ -1,63 +1,798 @@
 #include "mem.h"
 
-#include "block.h"
-#include "mem_kernel.h"
+#include "guard.h"
+#include "heap.h"
+#include "large.h"
+#include "mem_heap.h"
+#include "mem_profile.h"
+#include "mem_provider.h"
+#include "mem_stats.h"
+#include "pages.h"
+#include "profile.h"
+#include "small.h"
 
 #include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 
-static struct block* first_block;
+#ifdef MEM_THREAD_SAFE
+#include <pthread.h>
+#include <stdatomic.h>
+#endif
 
-static size_t div_round_up(size_t a, size_t b) {
-    return (a + (b - 1)) / b;
+// Heap used by every thread. Without MEM_THREAD_SAFE this is the only heap.
+static struct heap shared_heap;
+
+#ifdef MEM_THREAD_SAFE
+
+// Allocations up to this size are served by the calling thread's cache.
+#define THREAD_CACHE_MAX_SIZE FREELIST_SMALL_MAX_SIZE
+
+// Memory freed by a thread other than its owner, stored in the memory itself
+// while it waits for the owner to release it.
+struct remote_free {
+    struct remote_free *next;
+};
+
+// Per-thread cache of small allocations. Only the owning thread touches the
+// heap, so the common path takes no lock.
+struct thread_cache {
+    // Must be first, so the owner of a block or small page leads back to its
+    // cache.
+    struct heap heap;
+    
+    // Lock-free stack of memory freed by other threads.
+    _Atomic(struct remote_free *) remote_frees;
+    
+    // Next cache left behind by a thread that has exited.
+    struct thread_cache *next_abandoned;
+};
+
+static pthread_mutex_t shared_heap_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Caches of exited threads, waiting to be adopted by new threads. Caches are
+// never released, since other threads may still be freeing into them.
+static struct thread_cache *abandoned_caches;
+
+static pthread_once_t thread_cache_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t thread_cache_key;
+static __thread struct thread_cache *thread_cache;
+
+static void release_remote_frees(struct thread_cache *cache) {
+    if (atomic_load_explicit(&(cache->remote_frees), memory_order_relaxed) == NULL) {
+        return;
+    }
+    
+    struct remote_free *remote = atomic_exchange_explicit(&(cache->remote_frees), NULL,
+                                                          memory_order_acquire);
+    while (remote != NULL) {
+        struct remote_free *next = remote->next;
+        heap_free(&(cache->heap), remote);
+        remote = next;
+    }
 }
 
-void* mem_alloc(size_t n) {
-    if (n == 0) { return NULL; }
+static void push_remote_free(struct thread_cache *cache, void *ptr) {
+    struct remote_free *remote = ptr;
+    struct remote_free *head = atomic_load_explicit(&(cache->remote_frees), memory_order_relaxed);
+    do {
+        remote->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&(cache->remote_frees), &head, remote,
+                                                    memory_order_release, memory_order_relaxed));
+}
+
+static void abandon_thread_cache(void *arg) {
+    struct thread_cache *cache = arg;
+    release_remote_frees(cache);
+    thread_cache = NULL;
+    
+    pthread_mutex_lock(&shared_heap_mutex);
+    cache->next_abandoned = abandoned_caches;
+    abandoned_caches = cache;
+    pthread_mutex_unlock(&shared_heap_mutex);
+}
+
+static void create_thread_cache_key(void) {
+    const int result = pthread_key_create(&thread_cache_key, abandon_thread_cache);
+    assert(result == 0);
+    (void)result;
+}
+
+static struct thread_cache *get_thread_cache(void) {
+    if (thread_cache != NULL) { return thread_cache; }
+    
+    pthread_once(&thread_cache_key_once, create_thread_cache_key);
+    
+    pthread_mutex_lock(&shared_heap_mutex);
+    struct thread_cache *cache = abandoned_caches;
+    if (cache != NULL) {
+        abandoned_caches = cache->next_abandoned;
+    } else {
+        cache = heap_alloc(&shared_heap, sizeof(struct thread_cache));
+        if (cache != NULL) {
+            heap_init(&(cache->heap));
+            atomic_init(&(cache->remote_frees), NULL);
+        }
+    }
+    pthread_mutex_unlock(&shared_heap_mutex);
+    
+    if (cache == NULL) { return NULL; }
+    
+    // pthread_setspecific() may allocate, which must find the cache already
+    // in place.
+    cache->next_abandoned = NULL;
+    thread_cache = cache;
+    pthread_setspecific(thread_cache_key, cache);
+    return cache;
+}
+
+static void *alloc_from_heap(size_t n, size_t alignment) {
+    if (n <= THREAD_CACHE_MAX_SIZE) {
+        struct thread_cache *cache = get_thread_cache();
+        if (cache != NULL) {
+            release_remote_frees(cache);
+            return heap_alloc_aligned(&(cache->heap), n, alignment);
+        }
+    }
+    
+    pthread_mutex_lock(&shared_heap_mutex);
+    void *ptr = heap_alloc_aligned(&shared_heap, n, alignment);
+    pthread_mutex_unlock(&shared_heap_mutex);
+    return ptr;
+}
+
+static void free_to_heap(void *ptr) {
+    // The owner of a block can't change while any of its memory is
+    // allocated, so this is safe without a lock.
+    struct heap *heap = heap_get_owner(ptr);
+    
+    if (heap == &shared_heap) {
+        pthread_mutex_lock(&shared_heap_mutex);
+        heap_free(&shared_heap, ptr);
+        pthread_mutex_unlock(&shared_heap_mutex);
+        return;
+    }
+    
+    struct thread_cache *cache = (struct thread_cache *)heap;
+    if (cache == thread_cache) {
+        heap_free(heap, ptr);
+    } else {
+        push_remote_free(cache, ptr);
+    }
+}
+
+#ifndef MEM_HARDENED
+
+static bool alloc_batch_from_heap(size_t n, size_t count, void **ptrs) {
+    if (n <= THREAD_CACHE_MAX_SIZE) {
+        struct thread_cache *cache = get_thread_cache();
+        if (cache != NULL) {
+            release_remote_frees(cache);
+            return heap_alloc_batch(&(cache->heap), n, count, ptrs);
+        }
+    }
+    
+    pthread_mutex_lock(&shared_heap_mutex);
+    const bool allocated = heap_alloc_batch(&shared_heap, n, count, ptrs);
+    pthread_mutex_unlock(&shared_heap_mutex);
+    return allocated;
+}
+
+static void free_batch_to_heaps(void **ptrs, size_t count) {
+    size_t i = 0;
+    while (i < count) {
+        // Free each run of memory from the same heap together.
+        struct heap *heap = heap_get_owner(ptrs[i]);
+        size_t end = i + 1;
+        while (end < count && heap_get_owner(ptrs[end]) == heap) {
+            end++;
+        }
+        
+        struct thread_cache *cache = (struct thread_cache *)heap;
+        if (heap == &shared_heap) {
+            pthread_mutex_lock(&shared_heap_mutex);
+            heap_free_batch(&shared_heap, ptrs + i, end - i);
+            pthread_mutex_unlock(&shared_heap_mutex);
+        } else if (cache == thread_cache) {
+            heap_free_batch(heap, ptrs + i, end - i);
+        } else {
+            for (size_t j = i; j < end; j++) {
+                push_remote_free(cache, ptrs[j]);
+            }
+        }
+        i = end;
+    }
+}
+
+static bool resize_in_heap(void *ptr, size_t n) {
+    struct heap *heap = heap_get_owner(ptr);
+    
+    if (heap == &shared_heap) {
+        pthread_mutex_lock(&shared_heap_mutex);
+        const bool resized = heap_resize(&shared_heap, ptr, n);
+        pthread_mutex_unlock(&shared_heap_mutex);
+        return resized;
+    }
+    
+    // Another thread's cache can't be changed from this thread.
+    return (struct thread_cache *)heap == thread_cache && heap_resize(heap, ptr, n);
+}
+
+#endif
+
+static void trim_heaps(void) {
+    pthread_mutex_lock(&shared_heap_mutex);
+    heap_trim(&shared_heap);
+    
+    // No thread can adopt an abandoned cache while the lock is held, so
+    // their heaps can be changed from here.
+    for (struct thread_cache *cache = abandoned_caches; cache != NULL;
+         cache = cache->next_abandoned) {
+        release_remote_frees(cache);
+        heap_trim(&(cache->heap));
+    }
+    pthread_mutex_unlock(&shared_heap_mutex);
     
-    // Round up to nearest multiple of 8.
-    n = (n + 7) & ~7;
+    if (thread_cache != NULL) {
+        release_remote_frees(thread_cache);
+        heap_trim(&(thread_cache->heap));
+    }
+}
+
+static void add_heap_stats(struct mem_stats *stats) {
+    pthread_mutex_lock(&shared_heap_mutex);
+    heap_add_stats(&shared_heap, stats);
+    pthread_mutex_unlock(&shared_heap_mutex);
+    
+    if (thread_cache != NULL) { heap_add_stats(&(thread_cache->heap), stats); }
+}
+
+// fork() copies only the calling thread, so a lock held by any other thread
+// would never be released in the child. Every lock is taken around fork(),
+// in the order they nest.
+static void lock_all(void) {
+    profile_lock();
+    guard_lock();
+    pthread_mutex_lock(&shared_heap_mutex);
+    small_lock();
+}
+
+static void unlock_all(void) {
+    small_unlock();
+    pthread_mutex_unlock(&shared_heap_mutex);
+    guard_unlock();
+    profile_unlock();
+}
+
+__attribute__((constructor)) static void register_fork_handlers(void) {
+    pthread_atfork(lock_all, unlock_all, unlock_all);
+}
+
+static void dump_heaps(FILE *file) {
+    pthread_mutex_lock(&shared_heap_mutex);
+    fprintf(file, "shared heap:\n");
+    heap_dump(&shared_heap, file);
+    pthread_mutex_unlock(&shared_heap_mutex);
     
-    // Try to find space in existing blocks.
-    for (struct block *b = first_block; b != NULL; b = b->next) {
-        struct blockmem *mem = block_find_mem(b, n);
-        if (mem != NULL) { return blockmem_get_data_ptr(mem); }
+    if (thread_cache != NULL) {
+        fprintf(file, "thread cache:\n");
+        heap_dump(&(thread_cache->heap), file);
     }
+}
+
+#else
+
+static void *alloc_from_heap(size_t n, size_t alignment) {
+    return heap_alloc_aligned(&shared_heap, n, alignment);
+}
+
+static void free_to_heap(void *ptr) {
+    heap_free(&shared_heap, ptr);
+}
+
+#ifndef MEM_HARDENED
+
+static bool alloc_batch_from_heap(size_t n, size_t count, void **ptrs) {
+    return heap_alloc_batch(&shared_heap, n, count, ptrs);
+}
+
+static void free_batch_to_heaps(void **ptrs, size_t count) {
+    heap_free_batch(&shared_heap, ptrs, count);
+}
+
+static bool resize_in_heap(void *ptr, size_t n) {
+    return heap_resize(&shared_heap, ptr, n);
+}
+
+#endif
+
+static void trim_heaps(void) {
+    heap_trim(&shared_heap);
+}
+
+static void add_heap_stats(struct mem_stats *stats) {
+    heap_add_stats(&shared_heap, stats);
+}
+
+static void dump_heaps(FILE *file) {
+    heap_dump(&shared_heap, file);
+}
+
+#endif
+
+// Return address of the public function. Guards record it with each
+// allocation, and the profiler starts each call stack there, so the
+// allocator's own frames are left out.
+#define CALL_SITE __builtin_return_address(0)
+
+// Set between mem_profile_start() and mem_profile_stop(). When it's clear,
+// profiling costs one predictable branch per call.
+static bool profiling;
+
+static bool is_profiling(void) {
+    return __builtin_expect(__atomic_load_n(&profiling, __ATOMIC_RELAXED), false);
+}
+
+// Large allocations take whole pages from the provider, so with large pages
+// (e.g. hugepages) anything under half a page goes in the heaps instead.
+static size_t get_large_min_size(void) {
+    const size_t half_page_size = pages_get_size() / 2;
+    return half_page_size > LARGE_MIN_SIZE ? half_page_size : LARGE_MIN_SIZE;
+}
+
+static void *alloc_mem(size_t n, size_t alignment) {
+    // Large allocations skip the heaps (and their locks) entirely.
+    if (n >= get_large_min_size()) { return large_alloc(n, alignment); }
     
-    // No space available, so allocate a new block.
-    const size_t block_min_alloc_size = block_alloc_size_for_data_size(n);
-    const size_t mem_block_count = div_round_up(block_min_alloc_size, MEM_BLOCK_SIZE);
-    void *block_mem = mem_block_alloc(mem_block_count);
-    if (block_mem == NULL) { return NULL; }
+    return alloc_from_heap(n, alignment);
+}
+
+// Small allocations have no header, so must be ruled out before looking for
+// one.
+static bool is_large(void *ptr) {
+#ifdef HEAP_SMALL_PAGES
+    if (small_is_allocation(ptr)) { return false; }
+#endif
+    return large_is_allocation(ptr);
+}
+
+static void free_mem(void *ptr) {
+    if (is_large(ptr)) {
+        large_free(ptr);
+    } else {
+        free_to_heap(ptr);
+    }
+}
+
+static size_t get_usable_size(void *ptr) {
+    return is_large(ptr) ? large_get_usable_size(ptr) : heap_get_usable_size(ptr);
+}
+
+#ifdef MEM_HARDENED
+
+static void *alloc_guarded(size_t n, size_t alignment, void *call_site) {
+    const size_t extra_size = guard_get_extra_size(alignment);
+    if (n > SIZE_MAX - extra_size) { return NULL; }
+    
+    void *mem = alloc_mem(n + extra_size, alignment);
+    if (mem == NULL) { return NULL; }
+    
+    return guard_init(mem, get_usable_size(mem), n, alignment, call_site);
+}
+
+static bool check_guarded(void *ptr) {
+    if (!guard_check(ptr)) { return false; }
     
-    struct block *block = block_init(block_mem, mem_block_count * MEM_BLOCK_SIZE);
-    assert(block != NULL);
+    // A corrupted size field would send walks over the blockmems astray.
+    if (get_usable_size(guard_get_mem(ptr)) != guard_get_mem_size(ptr)) {
+        guard_report("corrupted size field", ptr);
+        return false;
+    }
+    return true;
+}
+
+static void release_quarantine(bool all) {
+    void *mem;
+    while ((mem = guard_evict(all)) != NULL) {
+        free_mem(mem);
+    }
+}
+
+static void free_guarded(void *ptr) {
+    if (!check_guarded(ptr)) { return; }
     
-    // Add new block to front of list.
-    block->next = first_block;
-    first_block = block;
+    void *mem = guard_quarantine(ptr);
+    if (mem != NULL) { free_mem(mem); }
+    release_quarantine(false);
+}
+
+#endif
+
+static void *alloc_aligned(size_t n, size_t alignment, void *call_site) {
+    if (n == 0 || alignment == 0 || (alignment & (alignment - 1)) != 0) { return NULL; }
     
-    struct blockmem *mem = block_find_mem(block, n);
-    assert(mem != NULL);
+#ifdef MEM_HARDENED
+    void *ptr = alloc_guarded(n, alignment, call_site);
+#else
+    void *ptr = alloc_mem(n, alignment);
+#endif
     
-    return blockmem_get_data_ptr(mem);
+    if (is_profiling() && ptr != NULL) { profile_alloc(ptr, n, call_site); }
+    return ptr;
+}
+
+void* mem_alloc(size_t n) {
+    return alloc_aligned(n, sizeof(size_t), CALL_SITE);
+}
+
+void* mem_alloc_aligned(size_t n, size_t alignment) {
+    return alloc_aligned(n, alignment, CALL_SITE);
 }
 
 void mem_free(void* ptr) {
     if (ptr == NULL) { return; }
     
-    struct blockmem *mem = blockmem_get_ptr_from_data_ptr(ptr);
-    assert(blockmem_is_allocated(mem) && "Already freed");
-    blockmem_set_allocated(mem, false);
+    if (is_profiling()) { profile_free(ptr); }
+    
+#ifdef MEM_HARDENED
+    free_guarded(ptr);
+#else
+    free_mem(ptr);
+#endif
+}
+
+// Allocate a batch one piece at a time, for allocations that are guarded,
+// profiled or large.
+static bool alloc_each(size_t n, size_t count, void **ptrs, void *call_site) {
+    for (size_t i = 0; i < count; i++) {
+        ptrs[i] = alloc_aligned(n, sizeof(size_t), call_site);
+        if (ptrs[i] == NULL) {
+            while (i > 0) {
+                mem_free(ptrs[--i]);
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+bool mem_alloc_batch(size_t n, size_t count, void** ptrs) {
+    if (n == 0) { return false; }
+    
+#ifdef MEM_HARDENED
+    return alloc_each(n, count, ptrs, CALL_SITE);
+#else
+    if (is_profiling() || n >= get_large_min_size()) {
+        return alloc_each(n, count, ptrs, CALL_SITE);
+    }
+    return alloc_batch_from_heap(n, count, ptrs);
+#endif
+}
+
+#if !defined(MEM_HARDENED) && !defined(HEAP_DEFERRED_COALESCING)
+
+// Sort pointers by address. Quicksort, finishing small ranges with insertion
+// sort; unlike qsort() the comparisons are inlined.
+static void sort_ptrs(void **ptrs, size_t count) {
+    while (count > 16) {
+        void **mid = ptrs + count / 2;
+        void *tmp = *mid;
+        *mid = ptrs[0];
+        ptrs[0] = tmp;
+        
+        const uintptr_t pivot = (uintptr_t)ptrs[0];
+        size_t low = 1;
+        size_t high = count - 1;
+        for (;;) {
+            while (low <= high && (uintptr_t)ptrs[low] < pivot) { low++; }
+            while (low <= high && (uintptr_t)ptrs[high] > pivot) { high--; }
+            if (low >= high) { break; }
+            tmp = ptrs[low];
+            ptrs[low++] = ptrs[high];
+            ptrs[high--] = tmp;
+        }
+        ptrs[0] = ptrs[high];
+        ptrs[high] = (void *)pivot;
+        
+        // Recurse into the smaller side, so the stack stays shallow.
+        if (high < count - high - 1) {
+            sort_ptrs(ptrs, high);
+            ptrs += high + 1;
+            count -= high + 1;
+        } else {
+            sort_ptrs(ptrs + high + 1, count - high - 1);
+            count = high;
+        }
+    }
+    
+    for (size_t i = 1; i < count; i++) {
+        void *ptr = ptrs[i];
+        size_t j = i;
+        while (j > 0 && (uintptr_t)ptrs[j - 1] > (uintptr_t)ptr) {
+            ptrs[j] = ptrs[j - 1];
+            j--;
+        }
+        ptrs[j] = ptr;
+    }
+}
+
+#endif
+
+void mem_free_batch(void** ptrs, size_t count) {
+#ifndef MEM_HARDENED
+    if (!is_profiling()) {
+        // In address order, memory from the same heap is together and
+        // neighbouring allocations can be merged as they're freed. Quick
+        // lists take small frees without merging, so sorting costs more than
+        // it saves there.
+#ifndef HEAP_DEFERRED_COALESCING
+        sort_ptrs(ptrs, count);
+#endif
+        
+        size_t i = 0;
+        while (i < count) {
+            if (ptrs[i] == NULL) {
+                i++;
+            } else if (is_large(ptrs[i])) {
+                large_free(ptrs[i]);
+                i++;
+            } else {
+                size_t end = i + 1;
+                while (end < count && ptrs[end] != NULL && !is_large(ptrs[end])) {
+                    end++;
+                }
+                free_batch_to_heaps(ptrs + i, end - i);
+                i = end;
+            }
+        }
+        return;
+    }
+#endif
+    
+    for (size_t i = 0; i < count; i++) {
+        mem_free(ptrs[i]);
+    }
+}
+
+#ifdef MEM_HARDENED
+
+static void *realloc_guarded(void *ptr, size_t n, size_t alignment, void *call_site) {
+    if (!check_guarded(ptr)) { return NULL; }
+    
+    // Always move, so that stale pointers to the old memory are caught by
+    // the quarantine.
+    void *new_ptr = alloc_aligned(n, alignment, call_site);
+    if (new_ptr == NULL) { return NULL; }
+    
+    const size_t old_size = guard_get_size(ptr);
+    memcpy(new_ptr, ptr, old_size < n ? old_size : n);
+    mem_free(ptr);
+    return new_ptr;
+}
+
+#endif
+
+// Large allocations can only shrink within their own memory. They must stay
+// large, and are moved rather than left wasting over half of it.
+static bool resize_large(void *ptr, size_t n) {
+    const size_t usable_size = large_get_usable_size(ptr);
+    return n >= get_large_min_size() && n <= usable_size && n >= usable_size / 2;
+}
+
+#ifndef MEM_HARDENED
+
+static bool resize_in_place(void *ptr, size_t n, void *call_site) {
+    const bool resized = is_large(ptr) ? resize_large(ptr, n)
+                                       : n < get_large_min_size() && resize_in_heap(ptr, n);
+    if (resized && is_profiling()) {
+        profile_free(ptr);
+        profile_alloc(ptr, n, call_site);
+    }
+    return resized;
+}
+
+#endif
+
+static void *realloc_aligned(void *ptr, size_t n, size_t alignment, void *call_site) {
+    if (ptr == NULL) { return alloc_aligned(n, alignment, call_site); }
+    if (alignment == 0 || (alignment & (alignment - 1)) != 0) { return NULL; }
+    
+    if (n == 0) {
+        mem_free(ptr);
+        return NULL;
+    }
+    
+#ifdef MEM_HARDENED
+    return realloc_guarded(ptr, n, alignment, call_site);
+#else
+    if (((uintptr_t)ptr & (alignment - 1)) == 0 && resize_in_place(ptr, n, call_site)) { return ptr; }
+    
+    // Fall back to moving the memory.
+    void *new_ptr = alloc_aligned(n, alignment, call_site);
+    if (new_ptr == NULL) { return NULL; }
+    
+    const size_t old_size = get_usable_size(ptr);
+    memcpy(new_ptr, ptr, old_size < n ? old_size : n);
+    mem_free(ptr);
+    return new_ptr;
+#endif
+}
+
+bool mem_resize(void* ptr, size_t n) {
+    if (ptr == NULL || n == 0) { return false; }
+    
+#ifdef MEM_HARDENED
+    // The guard records the size asked for, so memory always moves.
+    return false;
+#else
+    return resize_in_place(ptr, n, CALL_SITE);
+#endif
+}
+
+void* mem_realloc(void* ptr, size_t n) {
+    return realloc_aligned(ptr, n, sizeof(size_t), CALL_SITE);
+}
+
+void* mem_realloc_aligned(void* ptr, size_t n, size_t alignment) {
+    return realloc_aligned(ptr, n, alignment, CALL_SITE);
+}
+
+size_t mem_get_usable_size(void* ptr) {
+    if (ptr == NULL) { return 0; }
+    
+#ifdef MEM_HARDENED
+    return guard_get_size(ptr);
+#else
+    return get_usable_size(ptr);
+#endif
+}
+
+size_t mem_good_size(size_t n) {
+#ifdef MEM_HARDENED
+    // Guards check that only the size asked for is used.
+    return n;
+#else
+    if (n == 0) { return 0; }
+    if (n >= get_large_min_size()) { return large_get_good_size(n); }
     
-    // Try to merge this with subsequent blocks.
-    blockmem_merge_with_next(mem);
+    // Heap slots are multiples of 8 bytes, with room for free list links.
+    return heap_get_good_size(n);
+#endif
+}
+
+void mem_trim(void) {
+#ifdef MEM_HARDENED
+    release_quarantine(true);
+#endif
+    trim_heaps();
+}
+
+#ifdef MEM_HARDENED
+void mem_set_violation_handler(void (*handler)(const char *problem, void *ptr,
+                                               size_t size, void *call_site)) {
+    guard_set_handler(handler);
+}
+#endif
+
+bool mem_set_provider(const struct mem_provider* provider) {
+    mem_trim();
+    return pages_set_provider(provider);
+}
+
+bool mem_profile_start(size_t sample_interval) {
+    if (!profile_start(sample_interval)) { return false; }
     
-    // Free the block if nothing is allocated in it.
-    struct block *block = block_get_ptr_from_mem(mem);
-    if (!block_has_allocations(block)) {
-        if (block->prev != NULL) { block->prev->next = block->next; }
-        if (block->next != NULL) { block->next->prev = block->prev; }
-        if (block == first_block) { first_block = block->next; }
-        mem_block_free(block_get_alloc_ptr(block));
+    __atomic_store_n(&profiling, true, __ATOMIC_RELAXED);
+    return true;
+}
+
+void mem_profile_stop(void) {
+    __atomic_store_n(&profiling, false, __ATOMIC_RELAXED);
+}
+
+void mem_profile_write(FILE* file, enum mem_profile_format format) {
+    profile_write(file, format);
+}
+
+// Fill in the averages and fragmentation from the totals.
+static void finish_stats(struct mem_stats *stats) {
+    if (stats->free_bytes != 0) {
+        stats->fragmentation = 1.0 - (double)stats->largest_free_size / stats->free_bytes;
+    }
+    if (stats->search_count != 0) {
+        stats->average_scan_count = (double)stats->scan_count / stats->search_count;
     }
 }
+
+void mem_get_stats(struct mem_stats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    add_heap_stats(stats);
+    large_add_stats(stats);
+#ifdef HEAP_SMALL_PAGES
+    small_add_reserved_stats(stats);
+#endif
+#ifdef MEM_HARDENED
+    guard_add_stats(stats);
+#endif
+    finish_stats(stats);
+}
+
+void mem_dump_heap(FILE* file) {
+    dump_heaps(file);
+    
+    // Large allocations aren't kept in a list, so only their totals are known.
+    struct mem_stats stats;
+    memset(&stats, 0, sizeof(stats));
+    large_add_stats(&stats);
+    fprintf(file, "large allocations: %zu, %zu bytes\n", stats.large_count, stats.reserved_bytes);
+    
+#ifdef HEAP_SMALL_PAGES
+    memset(&stats, 0, sizeof(stats));
+    small_add_reserved_stats(&stats);
+    fprintf(file, "small pages: %zu bytes reserved\n", stats.reserved_bytes);
+#endif
+}
+
+struct mem_heap {
+    struct heap heap;
+    
+    // Large allocations don't use the heap's blocks, so are tracked
+    // separately to be released with it.
+    struct large_list large_allocs;
+};
+
+mem_heap_t* mem_heap_create(void) {
+    struct mem_heap *heap = mem_alloc(sizeof(struct mem_heap));
+    if (heap == NULL) { return NULL; }
+    
+    heap_init(&(heap->heap));
+    heap->large_allocs.first = NULL;
+    return heap;
+}
+
+void mem_heap_destroy(mem_heap_t* heap) {
+    large_list_free_all(&(heap->large_allocs));
+    heap_destroy(&(heap->heap));
+    mem_free(heap);
+}
+
+void* mem_heap_alloc(mem_heap_t* heap, size_t n) {
+    if (n == 0) { return NULL; }
+    
+    if (n >= get_large_min_size()) {
+        void *ptr = large_alloc(n, sizeof(size_t));
+        if (ptr != NULL) { large_list_add(&(heap->large_allocs), ptr); }
+        return ptr;
+    }
+    
+    return heap_alloc(&(heap->heap), n);
+}
+
+void mem_heap_free(mem_heap_t* heap, void* ptr) {
+    if (ptr == NULL) { return; }
+    
+    if (is_large(ptr)) {
+        large_list_remove(&(heap->large_allocs), ptr);
+        large_free(ptr);
+    } else {
+        heap_free(&(heap->heap), ptr);
+    }
+}
+
+bool mem_heap_resize(mem_heap_t* heap, void* ptr, size_t n) {
+    if (ptr == NULL || n == 0) { return false; }
+    
+    if (is_large(ptr)) { return resize_large(ptr, n); }
+    
+    return n < get_large_min_size() && heap_resize(&(heap->heap), ptr, n);
+}
+
+void mem_heap_get_stats(mem_heap_t* heap, struct mem_stats* stats) {
+    memset(stats, 0, sizeof(*stats));
+    heap_add_stats(&(heap->heap), stats);
+    large_list_add_stats(&(heap->large_allocs), stats);
+    finish_stats(stats);
+}
@@ -1,8 +1,13 @@
 #ifndef MEM_H
 #define MEM_H
 
+#include <stdbool.h>
 #include <stddef.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 // Returns a pointer to contiguous memory of size at least 'n' bytes. Returns NULL
 // if no memory is available or 'n' is zero.
 void* mem_alloc(size_t n);
@@ -10,4 +15,71 @@ void* mem_alloc(size_t n);
 // Releases memory allocated by mem_alloc(). Does nothing if 'ptr' is NULL.
 void mem_free(void* ptr);
 
+// Allocates 'count' pieces of contiguous memory of size at least 'n' bytes
+// each, storing pointers to them in 'ptrs'. Cheaper than calling mem_alloc()
+// 'count' times, since the pieces are carved from free space together.
+// Returns false, allocating nothing, if no memory is available or 'n' is zero.
+bool mem_alloc_batch(size_t n, size_t count, void** ptrs);
+
+// Releases 'count' pieces of memory allocated by mem_alloc() etc., skipping
+// any NULL pointers. Cheaper than calling mem_free() 'count' times, since
+// 'ptrs' is sorted by address (changing its order) and neighbouring pieces
+// are merged together.
+void mem_free_batch(void** ptrs, size_t count);
+
+// Returns a pointer to contiguous memory of size at least 'n' bytes, at an
+// address that is a multiple of 'alignment'. Returns NULL if no memory is
+// available, 'n' is zero or 'alignment' isn't a power of two. Release the
+// memory with mem_free().
+void* mem_alloc_aligned(size_t n, size_t alignment);
+
+// Returns a pointer to contiguous memory of size at least 'n' bytes.
+// Attempts to grow space allocated in 'ptr', if not NULL. Returns NULL
+// if no memory is available or 'n' is zero.
+//
+// The contents of 'ptr' are kept (up to 'n' bytes), moving them only if the
+// memory can't be resized in place. If 'n' is zero 'ptr' is released; if no
+// memory is available 'ptr' is left unchanged. Alignment from
+// mem_alloc_aligned() isn't kept if the memory moves.
+void* mem_realloc(void* ptr, size_t n);
+
+// Grows or shrinks memory from mem_alloc() etc. to at least 'n' bytes without
+// moving it. Returns false, leaving the memory unchanged, if that isn't
+// possible or 'n' is zero. Lets a container try to grow in place before
+// moving its contents itself (e.g. with move constructors rather than
+// memcpy()).
+bool mem_resize(void* ptr, size_t n);
+
+// As mem_realloc(), but the memory returned is at a multiple of 'alignment',
+// so it moves if 'ptr' isn't. Returns NULL if 'alignment' isn't a power of
+// two.
+void* mem_realloc_aligned(void* ptr, size_t n, size_t alignment);
+
+// Get the number of bytes usable in memory returned by mem_alloc() etc., which
+// may be more than was asked for. Returns 0 if 'ptr' is NULL.
+size_t mem_get_usable_size(void* ptr);
+
+// Get the number of bytes mem_alloc(n) would make usable, without allocating
+// them; this is at least 'n'. A container sizing its storage can ask for this
+// much rather than 'n', to use space that would otherwise be lost to rounding.
+size_t mem_good_size(size_t n);
+
+// Returns empty blocks kept for reuse by mem_alloc() to the kernel. With
+// MEM_THREAD_SAFE this covers the shared heap and the calling thread's cache;
+// with MEM_HARDENED it first releases everything in the quarantine.
+void mem_trim(void);
+
+#ifdef MEM_HARDENED
+// Set the function called when mem_free() etc. find that memory has been
+// misused (e.g. "double free" or "buffer overflow"), with the size and call
+// site of the allocation if they're known. The default prints the problem to
+// stderr and aborts; if the handler returns, the memory is leaked.
+void mem_set_violation_handler(void (*handler)(const char *problem, void *ptr,
+                                               size_t size, void *call_site));
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,113 @@
+#include "mem_arena.h"
+
+#include "mem.h"
+#include "mem_kernel.h"
+#include "pages.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Chunks are this many pages, unless an allocation needs more.
+#define ARENA_CHUNK_BLOCK_COUNT 16
+
+// Stored at the start of each chunk of pages, followed by allocations.
+struct mem_arena_chunk {
+    // Chunk allocated before this one.
+    struct mem_arena_chunk *prev;
+    
+    uint8_t *end;
+};
+
+struct mem_arena {
+    // Newest chunk, which allocations are taken from.
+    struct mem_arena_chunk *chunk;
+    
+    // Start of the unused space in the newest chunk.
+    uint8_t *top;
+};
+
+static uint8_t *get_chunk_start(struct mem_arena_chunk *chunk) {
+    return (uint8_t *)(chunk + 1);
+}
+
+static bool add_chunk(struct mem_arena *arena, const size_t n) {
+    size_t chunk_size = sizeof(struct mem_arena_chunk) + n;
+    if (chunk_size < ARENA_CHUNK_BLOCK_COUNT * MEM_BLOCK_SIZE) {
+        chunk_size = ARENA_CHUNK_BLOCK_COUNT * MEM_BLOCK_SIZE;
+    }
+    chunk_size = pages_round_size(chunk_size);
+    if (chunk_size == 0) { return false; }
+    
+    uint8_t *chunk_mem = pages_alloc(chunk_size);
+    if (chunk_mem == NULL) { return false; }
+    
+    struct mem_arena_chunk *chunk = (struct mem_arena_chunk *)chunk_mem;
+    chunk->prev = arena->chunk;
+    chunk->end = chunk_mem + chunk_size;
+    
+    arena->chunk = chunk;
+    arena->top = get_chunk_start(chunk);
+    return true;
+}
+
+struct mem_arena* mem_arena_create(void) {
+    struct mem_arena *arena = mem_alloc(sizeof(struct mem_arena));
+    if (arena == NULL) { return NULL; }
+    
+    arena->chunk = NULL;
+    arena->top = NULL;
+    return arena;
+}
+
+void mem_arena_destroy(struct mem_arena* arena) {
+    mem_arena_restore(arena, (struct mem_arena_mark){ NULL, NULL });
+    mem_free(arena);
+}
+
+void* mem_arena_alloc(struct mem_arena* arena, size_t n) {
+    if (n == 0 || n > SIZE_MAX - sizeof(struct mem_arena_chunk) - 7) { return NULL; }
+    
+    // Round up to nearest multiple of 8, so the next allocation is aligned.
+    n = (n + 7) & ~(size_t)7;
+    
+    if (arena->chunk == NULL || (size_t)(arena->chunk->end - arena->top) < n) {
+        if (!add_chunk(arena, n)) { return NULL; }
+    }
+    
+    void *ptr = arena->top;
+    arena->top += n;
+    return ptr;
+}
+
+void mem_arena_reset(struct mem_arena* arena) {
+    if (arena->chunk == NULL) { return; }
+    
+    struct mem_arena_chunk *first_chunk = arena->chunk;
+    while (first_chunk->prev != NULL) {
+        first_chunk = first_chunk->prev;
+    }
+    
+    mem_arena_restore(arena, (struct mem_arena_mark){ first_chunk, get_chunk_start(first_chunk) });
+}
+
+struct mem_arena_mark mem_arena_save(struct mem_arena* arena) {
+    struct mem_arena_mark mark = { arena->chunk, arena->top };
+    return mark;
+}
+
+void mem_arena_restore(struct mem_arena* arena, struct mem_arena_mark mark) {
+    if (arena->chunk == mark.chunk) {
+        assert((uint8_t *)mark.top <= arena->top && "Mark was already released");
+    }
+    
+    while (arena->chunk != mark.chunk) {
+        assert(arena->chunk != NULL && "Mark isn't from this arena or was already released");
+        struct mem_arena_chunk *prev = arena->chunk->prev;
+        pages_free(arena->chunk, arena->chunk->end - (uint8_t *)arena->chunk);
+        arena->chunk = prev;
+    }
+    
+    arena->top = mark.top;
+}
@@ -0,0 +1,43 @@
+#ifndef MEM_ARENA_H
+#define MEM_ARENA_H
+
+#include <stddef.h>
+
+// An arena hands out memory by bumping a pointer through pages from the page
+// provider. Individual allocations can't be freed; instead everything
+// allocated since a mark (or since the arena was created) is released
+// together, at a cost proportional to the number of pages. An arena must only
+// be used by one thread at a time.
+struct mem_arena;
+
+struct mem_arena_chunk;
+
+// Position in an arena, as returned by mem_arena_save().
+struct mem_arena_mark {
+    struct mem_arena_chunk* chunk;
+    void* top;
+};
+
+// Create an empty arena. Returns NULL if no memory is available.
+struct mem_arena* mem_arena_create(void);
+
+// Releases an arena and all memory allocated from it.
+void mem_arena_destroy(struct mem_arena* arena);
+
+// Returns a pointer to 8-byte aligned contiguous memory of size at least 'n'
+// bytes from the arena. Returns NULL if no memory is available or 'n' is
+// zero.
+void* mem_arena_alloc(struct mem_arena* arena, size_t n);
+
+// Releases all memory allocated from the arena. The first page(s) are kept
+// for reuse.
+void mem_arena_reset(struct mem_arena* arena);
+
+// Get the current position in the arena, to pass to mem_arena_restore().
+struct mem_arena_mark mem_arena_save(struct mem_arena* arena);
+
+// Releases all memory allocated from the arena since 'mark' was saved. Marks
+// nest: restoring a mark invalidates any saved after it.
+void mem_arena_restore(struct mem_arena* arena, struct mem_arena_mark mark);
+
+#endif
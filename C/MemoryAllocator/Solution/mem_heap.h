@@ -0,0 +1,50 @@
+#ifndef MEM_HEAP_H
+#define MEM_HEAP_H
+
+#include "mem_stats.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A heap of its own, separate from the one behind mem_alloc(). Its
+// allocations never share blocks with any other heap's, so a subsystem or
+// tenant can keep its memory together and can't fragment anyone else's, and
+// destroying the heap releases everything in it at a cost proportional to the
+// number of blocks. A heap must only be used by one thread at a time.
+//
+// Allocations from a heap must be released with mem_heap_free(), not
+// mem_free(). They aren't checked by MEM_HARDENED or sampled by the heap
+// profiler, and mem_get_stats() only counts them if they're large.
+typedef struct mem_heap mem_heap_t;
+
+// Create an empty heap. Returns NULL if no memory is available.
+mem_heap_t* mem_heap_create(void);
+
+// Releases a heap and all memory allocated from it.
+void mem_heap_destroy(mem_heap_t* heap);
+
+// Returns a pointer to 8-byte aligned contiguous memory of size at least 'n'
+// bytes from the heap. Returns NULL if no memory is available or 'n' is zero.
+void* mem_heap_alloc(mem_heap_t* heap, size_t n);
+
+// Releases memory allocated by mem_heap_alloc() from the same heap. Does
+// nothing if 'ptr' is NULL.
+void mem_heap_free(mem_heap_t* heap, void* ptr);
+
+// Grows or shrinks memory from mem_heap_alloc() to at least 'n' bytes without
+// moving it, as mem_resize() does. Returns false if that isn't possible.
+bool mem_heap_resize(mem_heap_t* heap, void* ptr, size_t n);
+
+// Fill 'stats' with a snapshot of the heap, as mem_get_stats() does for
+// mem_alloc().
+void mem_heap_get_stats(mem_heap_t* heap, struct mem_stats* stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -3,8 +3,15 @@
 
 #include <stddef.h>
 
-// Size of a block, as used by mem_block_alloc().
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Size of a block, as used by mem_block_alloc(). Can be set at build time to
+// a larger power of two.
+#ifndef MEM_BLOCK_SIZE
 #define MEM_BLOCK_SIZE 4096
+#endif
 
 // Returns a pointer to contiguous memory of size at least 'n' blocks.
 // 'n' must be greater than 0. Returns NULL if no memory is available.
@@ -13,4 +20,8 @@ void* mem_block_alloc(size_t n);
 // Releases memory allocated by mem_block_alloc(). 'ptr' MUST NOT be NULL.
 void mem_block_free(void* ptr);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
@@ -0,0 +1,117 @@
+#include "mem_pool.h"
+
+#include "mem.h"
+#include "mem_kernel.h"
+#include "pages.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Slabs are this many pages, or enough to hold POOL_MIN_SLAB_OBJECT_COUNT
+// objects if that's more.
+#define POOL_SLAB_BLOCK_COUNT 4
+#define POOL_MIN_SLAB_OBJECT_COUNT 8
+
+// Stored at the start of each slab, followed by its objects.
+struct pool_slab {
+    struct pool_slab *next;
+};
+
+// A free object, linked to the next through its own memory.
+struct pool_free_obj {
+    struct pool_free_obj *next;
+};
+
+struct mem_pool {
+    size_t obj_size;
+    size_t slab_size;
+    
+    // Every slab allocated by the pool, newest first.
+    struct pool_slab *slabs;
+    
+    // Freed objects, most recently freed first.
+    struct pool_free_obj *free_objs;
+    
+    // Space in the newest slab that hasn't been handed out yet. New slabs
+    // are used up in order, so their free objects needn't be linked.
+    uint8_t *unused_begin;
+    uint8_t *unused_end;
+};
+
+static bool add_slab(struct mem_pool *pool) {
+    uint8_t *slab_mem = pages_alloc(pool->slab_size);
+    if (slab_mem == NULL) { return false; }
+    
+    struct pool_slab *slab = (struct pool_slab *)slab_mem;
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    
+    pool->unused_begin = slab_mem + sizeof(struct pool_slab);
+    pool->unused_end = slab_mem + pool->slab_size;
+    return true;
+}
+
+struct mem_pool* mem_pool_create(size_t obj_size) {
+    if (obj_size == 0) { return NULL; }
+    
+    // Round up to a multiple of 8, which is always enough for a free link.
+    if (obj_size > SIZE_MAX / (2 * POOL_MIN_SLAB_OBJECT_COUNT)) { return NULL; }
+    obj_size = (obj_size + 7) & ~(size_t)7;
+    
+    size_t slab_size = sizeof(struct pool_slab) + POOL_MIN_SLAB_OBJECT_COUNT * obj_size;
+    if (slab_size < POOL_SLAB_BLOCK_COUNT * MEM_BLOCK_SIZE) {
+        slab_size = POOL_SLAB_BLOCK_COUNT * MEM_BLOCK_SIZE;
+    }
+    slab_size = pages_round_size(slab_size);
+    if (slab_size == 0) { return NULL; }
+    
+    struct mem_pool *pool = mem_alloc(sizeof(struct mem_pool));
+    if (pool == NULL) { return NULL; }
+    
+    pool->obj_size = obj_size;
+    pool->slab_size = slab_size;
+    pool->slabs = NULL;
+    pool->free_objs = NULL;
+    pool->unused_begin = NULL;
+    pool->unused_end = NULL;
+    return pool;
+}
+
+void mem_pool_destroy(struct mem_pool* pool) {
+    struct pool_slab *slab = pool->slabs;
+    while (slab != NULL) {
+        struct pool_slab *next = slab->next;
+        pages_free(slab, pool->slab_size);
+        slab = next;
+    }
+    
+    mem_free(pool);
+}
+
+void* mem_pool_alloc(struct mem_pool* pool) {
+    struct pool_free_obj *obj = pool->free_objs;
+    if (obj != NULL) {
+        pool->free_objs = obj->next;
+        return obj;
+    }
+    
+    if ((size_t)(pool->unused_end - pool->unused_begin) < pool->obj_size) {
+        if (!add_slab(pool)) { return NULL; }
+    }
+    
+    void *ptr = pool->unused_begin;
+    pool->unused_begin += pool->obj_size;
+    return ptr;
+}
+
+void mem_pool_free(struct mem_pool* pool, void* ptr) {
+    if (ptr == NULL) { return; }
+    
+    assert(((uintptr_t)ptr % 8) == 0 && "Not allocated from a pool");
+    
+    struct pool_free_obj *obj = ptr;
+    obj->next = pool->free_objs;
+    pool->free_objs = obj;
+}
@@ -0,0 +1,32 @@
+#ifndef MEM_PROFILE_H
+#define MEM_PROFILE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+enum mem_profile_format {
+    // Call stacks with their estimated live bytes, largest first, with
+    // symbols where they can be found.
+    MEM_PROFILE_TEXT,
+    
+    // Legacy heap profile format, as read by pprof (the numbers are the raw
+    // samples, which pprof scales up itself).
+    MEM_PROFILE_PPROF
+};
+
+// Start sampling calls to mem_alloc() etc., recording the call stack for
+// roughly one allocation in every 'sample_interval' bytes, and tracking each
+// sampled allocation until it's freed. This clears any previous profile.
+// Returns false if there is no memory for the profile or 'sample_interval' is
+// zero. Until this is called, profiling costs one branch per call.
+bool mem_profile_start(size_t sample_interval);
+
+// Stop sampling. The profile is kept for mem_profile_write(), but
+// allocations freed from now on are no longer removed from it.
+void mem_profile_stop(void);
+
+// Write the live sampled allocations, grouped by call stack, to 'file'.
+void mem_profile_write(FILE* file, enum mem_profile_format format);
+
+#endif
@@ -0,0 +1,210 @@
+#include "mem_provider.h"
+
+#include "pages.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+static bool is_power_of_two(size_t value) {
+    return value != 0 && (value & (value - 1)) == 0;
+}
+
+void mem_provider_init_kernel(struct mem_provider* provider) {
+    *provider = pages_kernel_provider;
+}
+
+// Map 'size' bytes at an address that is a multiple of 'alignment', by
+// mapping enough to be sure of an aligned range and unmapping the rest.
+static void *map_aligned(size_t size, size_t alignment) {
+    const size_t system_page_size = (size_t)sysconf(_SC_PAGESIZE);
+    const size_t extra_size = alignment > system_page_size ? alignment - system_page_size : 0;
+    if (size > SIZE_MAX - extra_size) { return NULL; }
+    
+    uint8_t *map = mmap(NULL, size + extra_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) { return NULL; }
+    
+    uint8_t *aligned = (uint8_t *)(((uintptr_t)map + (alignment - 1)) & ~(uintptr_t)(alignment - 1));
+    if (aligned != map) { munmap(map, aligned - map); }
+    const size_t tail_size = (map + size + extra_size) - (aligned + size);
+    if (tail_size != 0) { munmap(aligned + size, tail_size); }
+    return aligned;
+}
+
+static void *mmap_alloc(void *context, size_t size) {
+    return map_aligned(size, (size_t)(uintptr_t)context);
+}
+
+static void mmap_free(void *context, void *ptr, size_t size) {
+    (void)context;
+    munmap(ptr, size);
+}
+
+bool mem_provider_init_mmap(struct mem_provider* provider, size_t page_size) {
+    const size_t system_page_size = (size_t)sysconf(_SC_PAGESIZE);
+    if (!is_power_of_two(page_size) || page_size < system_page_size || page_size < 4096) {
+        return false;
+    }
+    
+    provider->alloc = mmap_alloc;
+    provider->free = mmap_free;
+    // The alignment is all mmap_alloc() needs, so it's stored in the pointer.
+    provider->context = (void *)(uintptr_t)page_size;
+    provider->page_size = page_size;
+    return true;
+}
+
+static void *transparent_hugepages_alloc(void *context, size_t size) {
+    (void)context;
+    void *ptr = map_aligned(size, MEM_HUGEPAGE_SIZE);
+#ifdef MADV_HUGEPAGE
+    // Only a hint: the memory is still usable if hugepages aren't enabled.
+    if (ptr != NULL) { madvise(ptr, size, MADV_HUGEPAGE); }
+#endif
+    return ptr;
+}
+
+static void *explicit_hugepages_alloc(void *context, size_t size) {
+    (void)context;
+#ifdef MAP_HUGETLB
+    // Hugepage mappings are always aligned to the hugepage size.
+    void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (21 << MAP_HUGE_SHIFT), -1, 0);
+    return ptr != MAP_FAILED ? ptr : NULL;
+#else
+    (void)size;
+    return NULL;
+#endif
+}
+
+void mem_provider_init_hugepages(struct mem_provider* provider, enum mem_hugepages mode) {
+    provider->alloc = mode == MEM_HUGEPAGES_EXPLICIT ? explicit_hugepages_alloc : transparent_hugepages_alloc;
+    provider->free = mmap_free;
+    provider->context = NULL;
+    provider->page_size = MEM_HUGEPAGE_SIZE;
+}
+
+// Free space in a region, stored at its start.
+struct mem_region_space {
+    size_t size;
+    
+    // Next free space, at a higher address.
+    struct mem_region_space *next;
+};
+
+// Regions may be shared with other processes, so are locked with a spin lock
+// rather than a mutex.
+static void lock_region(struct mem_region *region) {
+    while (__atomic_test_and_set(&(region->locked), __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&(region->locked), __ATOMIC_RELAXED)) {}
+    }
+}
+
+static void unlock_region(struct mem_region *region) {
+    __atomic_clear(&(region->locked), __ATOMIC_RELEASE);
+}
+
+static void *region_alloc(void *context, size_t size) {
+    struct mem_region *region = context;
+    lock_region(region);
+    
+    struct mem_region_space **link = &(region->free_spaces);
+    while (*link != NULL && (*link)->size < size) {
+        link = &((*link)->next);
+    }
+    
+    struct mem_region_space *space = *link;
+    if (space == NULL) {
+        unlock_region(region);
+        return NULL;
+    }
+    
+    // Take the memory from the front, leaving the rest free.
+    if (space->size == size) {
+        *link = space->next;
+    } else {
+        struct mem_region_space *rest = (struct mem_region_space *)((uint8_t *)space + size);
+        rest->size = space->size - size;
+        rest->next = space->next;
+        *link = rest;
+    }
+    
+    region->used_bytes += size;
+    unlock_region(region);
+    return space;
+}
+
+static void region_free(void *context, void *ptr, size_t size) {
+    struct mem_region *region = context;
+    assert((uint8_t *)ptr >= region->start && (uint8_t *)ptr + size <= region->end);
+    lock_region(region);
+    
+    // Keep the free spaces in address order, so neighbours can be merged.
+    struct mem_region_space *prev = NULL;
+    struct mem_region_space *next = region->free_spaces;
+    while (next != NULL && (void *)next < ptr) {
+        prev = next;
+        next = next->next;
+    }
+    
+    struct mem_region_space *space = ptr;
+    space->size = size;
+    space->next = next;
+    if (next != NULL && (uint8_t *)space + space->size == (uint8_t *)next) {
+        space->size += next->size;
+        space->next = next->next;
+    }
+    
+    if (prev != NULL && (uint8_t *)prev + prev->size == (uint8_t *)space) {
+        prev->size += space->size;
+        prev->next = space->next;
+    } else if (prev != NULL) {
+        prev->next = space;
+    } else {
+        region->free_spaces = space;
+    }
+    
+    region->used_bytes -= size;
+    unlock_region(region);
+}
+
+bool mem_provider_init_region(struct mem_provider* provider, struct mem_region* region,
+                              void* mem, size_t size, size_t page_size) {
+    if (!is_power_of_two(page_size) || page_size < 4096) { return false; }
+    if ((uintptr_t)mem > UINTPTR_MAX - size) { return false; }
+    
+    // Only whole, aligned pages are handed out.
+    const uintptr_t start = ((uintptr_t)mem + (page_size - 1)) & ~(uintptr_t)(page_size - 1);
+    const uintptr_t end = ((uintptr_t)mem + size) & ~(uintptr_t)(page_size - 1);
+    if (end <= start) { return false; }
+    
+    region->start = (uint8_t *)start;
+    region->end = (uint8_t *)end;
+    region->free_spaces = (struct mem_region_space *)start;
+    region->free_spaces->size = end - start;
+    region->free_spaces->next = NULL;
+    region->page_size = page_size;
+    region->used_bytes = 0;
+    region->locked = false;
+    
+    provider->alloc = region_alloc;
+    provider->free = region_free;
+    provider->context = region;
+    provider->page_size = page_size;
+    return true;
+}
+
+size_t mem_region_get_used_bytes(struct mem_region* region) {
+    lock_region(region);
+    const size_t used_bytes = region->used_bytes;
+    unlock_region(region);
+    return used_bytes;
+}
@@ -0,0 +1,77 @@
+#ifndef MEM_PROVIDER_H
+#define MEM_PROVIDER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Source of the memory behind mem_alloc(), pools, arenas and the profiler.
+// Until mem_set_provider() is called this is mem_block_alloc() from
+// mem_kernel.h.
+struct mem_provider {
+    // Returns 'size' bytes, a multiple of 'page_size', or NULL if there are
+    // none. Must be safe to call from any thread with MEM_THREAD_SAFE.
+    void* (*alloc)(void* context, size_t size);
+    
+    // Releases memory returned by alloc(), given the size it was allocated
+    // with.
+    void (*free)(void* context, void* ptr, size_t size);
+    
+    void* context;
+    
+    // Every request is rounded up to a multiple of this, so it's the smallest
+    // block the heaps use. A power of two of at least 4096.
+    size_t page_size;
+};
+
+// Take memory from 'provider' from now on, after releasing any empty blocks
+// kept for reuse (see mem_trim()). Returns false, leaving the provider
+// unchanged, if memory from the current one is still in use or the page size
+// isn't valid. Call this before other threads start allocating.
+bool mem_set_provider(const struct mem_provider* provider);
+
+// The default: mem_block_alloc() and mem_block_free(), with a page size of
+// MEM_BLOCK_SIZE.
+void mem_provider_init_kernel(struct mem_provider* provider);
+
+// Anonymous memory from mmap(), aligned to 'page_size'. Returns false if
+// 'page_size' isn't a power of two multiple of the system's page size.
+bool mem_provider_init_mmap(struct mem_provider* provider, size_t page_size);
+
+#define MEM_HUGEPAGE_SIZE ((size_t)2 * 1024 * 1024)
+
+enum mem_hugepages {
+    // Memory aligned to 2 MB and marked with madvise(MADV_HUGEPAGE), which
+    // the kernel backs with hugepages when it can and normal pages otherwise.
+    MEM_HUGEPAGES_TRANSPARENT,
+    
+    // Memory from the kernel's pool of reserved 2 MB hugepages (see
+    // /proc/sys/vm/nr_hugepages). Allocations fail once the pool is empty.
+    MEM_HUGEPAGES_EXPLICIT
+};
+
+// Memory in 2 MB hugepages, which cuts TLB misses for large heaps. Every
+// heap block and large allocation takes at least one whole hugepage.
+void mem_provider_init_hugepages(struct mem_provider* provider, enum mem_hugepages mode);
+
+// Space in a fixed region of memory, handed out first fit. The list of free
+// space is kept in the region itself. Treat the fields as private.
+struct mem_region {
+    unsigned char* start;
+    unsigned char* end;
+    struct mem_region_space* free_spaces;
+    size_t page_size;
+    size_t used_bytes;
+    bool locked;
+};
+
+// Hand out the 'size' bytes at 'mem' (e.g. shared memory or memory reserved
+// up front), in pages of 'page_size' bytes. 'region' must outlive every
+// allocation from it. Returns false if 'page_size' isn't a power of two of at
+// least 4096 or the memory doesn't hold a whole page.
+bool mem_provider_init_region(struct mem_provider* provider, struct mem_region* region,
+                              void* mem, size_t size, size_t page_size);
+
+// Bytes of the region currently handed out.
+size_t mem_region_get_used_bytes(struct mem_region* region);
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef MEM_STATS_H
+#define MEM_STATS_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+// Number of size classes in mem_stats.class_alloc_counts: one per multiple of
+// 8 bytes from the minimum data size up to 512 bytes, then one per power of
+// two.
+#define MEM_STATS_NUM_CLASSES 126
+
+// Snapshot of the state of the memory used by mem_alloc(). With
+// MEM_THREAD_SAFE this covers the shared heap, the calling thread's cache and
+// large allocations; other threads' caches can't be inspected safely.
+struct mem_stats {
+    // Bytes currently held from the page provider (see mem_provider.h).
+    size_t reserved_bytes;
+    
+    // Usable bytes in live allocations. Requested sizes aren't stored, so
+    // this includes rounding each request up to a multiple of 8 (and at
+    // least BLOCKMEM_MIN_DATA_SIZE).
+    size_t allocated_bytes;
+    
+    // Bytes in free blockmems, available for allocations.
+    size_t free_bytes;
+    
+    // Number of blocks in use. Doesn't include retained blocks.
+    size_t block_count;
+    
+    // Empty blocks kept for reuse rather than returned to the page provider
+    // (see mem_trim()). These are included in reserved_bytes.
+    size_t retained_block_count;
+    size_t retained_bytes;
+    
+    // Number of live allocations in blocks and small pages.
+    size_t alloc_count;
+    
+    // Number of live allocations with memory of their own (see large.h).
+    size_t large_count;
+    
+    // Pages of small allocations held by the heaps (see HEAP_SMALL_PAGES).
+    // Allocations in them are included in alloc_count.
+    size_t small_page_count;
+    
+    // Number of live allocations in blocks, by size class (see
+    // MEM_STATS_NUM_CLASSES).
+    size_t class_alloc_counts[MEM_STATS_NUM_CLASSES];
+    
+    size_t free_count;
+    size_t largest_free_size;
+    
+    // Freed memory waiting to be merged (see HEAP_DEFERRED_COALESCING). This
+    // is also counted in free_count and free_bytes.
+    size_t deferred_count;
+    size_t deferred_bytes;
+    
+    // Freed memory held back from reuse (see MEM_HARDENED), by requested
+    // size. This is still counted as allocated.
+    size_t quarantine_count;
+    size_t quarantine_bytes;
+    
+    // Fraction of free space not in the largest free blockmem: 0 if free
+    // space is all in one piece, approaching 1 as it's split into many.
+    double fragmentation;
+    
+    // Free list searches made so far, and the free blockmems they looked at
+    // (in total, per search on average, and in the longest search).
+    size_t search_count;
+    size_t scan_count;
+    double average_scan_count;
+    size_t max_scan_count;
+};
+
+// Fill 'stats' with the current state of the allocator. This walks every
+// block, so takes time proportional to the number of blockmems.
+void mem_get_stats(struct mem_stats* stats);
+
+// Print a map of every block and the blockmems in it to 'file'.
+void mem_dump_heap(FILE* file);
+
+#endif
@@ -0,0 +1,59 @@
+#include "pages.h"
+
+#include "mem_kernel.h"
+#include "mem_provider.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+static void *kernel_alloc(void *context, size_t size) {
+    (void)context;
+    assert(size % MEM_BLOCK_SIZE == 0);
+    return mem_block_alloc(size / MEM_BLOCK_SIZE);
+}
+
+static void kernel_free(void *context, void *ptr, size_t size) {
+    (void)context;
+    (void)size;
+    mem_block_free(ptr);
+}
+
+const struct mem_provider pages_kernel_provider = { kernel_alloc, kernel_free, NULL, MEM_BLOCK_SIZE };
+
+static struct mem_provider provider = { kernel_alloc, kernel_free, NULL, MEM_BLOCK_SIZE };
+
+// Bytes held from the current provider, updated by any thread.
+static size_t held_bytes;
+
+size_t pages_get_size(void) {
+    return provider.page_size;
+}
+
+size_t pages_round_size(size_t size) {
+    if (size > SIZE_MAX - (provider.page_size - 1)) { return 0; }
+    return (size + (provider.page_size - 1)) & ~(provider.page_size - 1);
+}
+
+void *pages_alloc(size_t size) {
+    assert(size != 0 && (size & (provider.page_size - 1)) == 0);
+    void *ptr = provider.alloc(provider.context, size);
+    if (ptr != NULL) { __atomic_fetch_add(&held_bytes, size, __ATOMIC_RELAXED); }
+    return ptr;
+}
+
+void pages_free(void *ptr, size_t size) {
+    assert(ptr != NULL);
+    __atomic_fetch_sub(&held_bytes, size, __ATOMIC_RELAXED);
+    provider.free(provider.context, ptr, size);
+}
+
+bool pages_set_provider(const struct mem_provider *new_provider) {
+    const size_t page_size = new_provider->page_size;
+    if (page_size < 4096 || (page_size & (page_size - 1)) != 0) { return false; }
+    if (__atomic_load_n(&held_bytes, __ATOMIC_RELAXED) != 0) { return false; }
+    
+    provider = *new_provider;
+    return true;
+}
@@ -0,0 +1,30 @@
+#ifndef PAGES_H
+#define PAGES_H
+
+#include "mem_provider.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// The default provider, which calls mem_block_alloc() and mem_block_free().
+extern const struct mem_provider pages_kernel_provider;
+
+// Get the page size of the current provider.
+size_t pages_get_size(void);
+
+// Round 'size' up to a multiple of the page size. Returns 0 if that
+// overflows.
+size_t pages_round_size(size_t size);
+
+// Returns 'size' bytes (a multiple of the page size) from the current
+// provider, or NULL if there are none.
+void *pages_alloc(size_t size);
+
+// Releases memory from pages_alloc(), given the size it was allocated with.
+void pages_free(void *ptr, size_t size);
+
+// Use 'provider' from now on. Returns false if memory from the current
+// provider is still held or the page size isn't valid.
+bool pages_set_provider(const struct mem_provider *provider);
+
+#endif
@@ -0,0 +1,405 @@
+#include "profile.h"
+
+#include "mem_profile.h"
+#include "pages.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __GLIBC__
+#include <execinfo.h>
+#define HAVE_BACKTRACE
+#endif
+
+#ifdef MEM_THREAD_SAFE
+#include <pthread.h>
+#define THREAD_LOCAL __thread
+#else
+#define THREAD_LOCAL
+#endif
+
+#define PROFILE_SAMPLE_BUCKETS (2 * PROFILE_MAX_SAMPLES)
+#define PROFILE_SITE_BUCKETS (2 * PROFILE_MAX_SITES)
+#define NO_INDEX UINT32_MAX
+
+// Most frames the allocator itself can have at the top of a backtrace, from
+// record_sample() up to the public function.
+#define ALLOCATOR_MAX_FRAME_COUNT 8
+
+// A sampled allocation that hasn't been freed yet.
+struct profile_sample {
+    void *ptr;
+    size_t size;
+    uint32_t site;
+    
+    // Next sample in the same bucket, or the next unused sample.
+    uint32_t next;
+};
+
+// A call stack that made sampled allocations, and the raw totals of its
+// samples.
+struct profile_site {
+    void *frames[PROFILE_MAX_DEPTH];
+    size_t depth;
+    size_t live_count;
+    size_t live_bytes;
+    size_t total_count;
+    size_t total_bytes;
+    uint32_t next;
+};
+
+// Everything recorded by a profile, in one allocation from pages_alloc() so
+// profiling never calls mem_alloc().
+struct profile_tables {
+    // Heads of the chains of samples, by hashed address. These are read
+    // without the lock by profile_free(), so are accessed atomically.
+    uint32_t sample_buckets[PROFILE_SAMPLE_BUCKETS];
+    struct profile_sample samples[PROFILE_MAX_SAMPLES];
+    uint32_t unused_samples;
+    
+    uint32_t site_buckets[PROFILE_SITE_BUCKETS];
+    struct profile_site sites[PROFILE_MAX_SITES];
+    uint32_t site_count;
+    
+    // Site indices sorted by profile_write().
+    uint32_t order[PROFILE_MAX_SITES];
+    
+    size_t dropped_count;
+};
+
+// Created by the first profile_start() and never released, since
+// profile_free() may be reading it without the lock.
+static struct profile_tables *tables;
+
+// Mean bytes allocated between samples. This is read without the lock by
+// profile_alloc(), so is accessed atomically.
+static size_t sample_interval;
+
+#ifdef MEM_THREAD_SAFE
+static pthread_mutex_t profile_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK_PROFILE() pthread_mutex_lock(&profile_mutex)
+#define UNLOCK_PROFILE() pthread_mutex_unlock(&profile_mutex)
+#else
+#define LOCK_PROFILE()
+#define UNLOCK_PROFILE()
+#endif
+
+// Bytes this thread can allocate before the next sample, or zero if it
+// hasn't allocated since profiling started.
+static THREAD_LOCAL size_t bytes_until_sample;
+static THREAD_LOCAL uint64_t random_state;
+
+// Set while this thread is inside the profiler, so allocations made by
+// backtrace() etc. aren't profiled.
+static THREAD_LOCAL bool in_profile;
+
+static uint64_t mix(uint64_t value) {
+    value ^= value >> 33;
+    value *= (uint64_t)0xFF51AFD7ED558CCD;
+    value ^= value >> 33;
+    return value;
+}
+
+static size_t get_sample_bucket(const void *ptr) {
+    return mix((uintptr_t)ptr) % PROFILE_SAMPLE_BUCKETS;
+}
+
+static size_t get_site_bucket(void *const *frames, size_t depth) {
+    uint64_t hash = depth;
+    for (size_t i = 0; i < depth; i++) {
+        hash = mix(hash ^ (uintptr_t)frames[i]);
+    }
+    return hash % PROFILE_SITE_BUCKETS;
+}
+
+static uint64_t next_random(void) {
+    if (random_state == 0) { random_state = mix((uintptr_t)&random_state) | 1; }
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+// Choose the bytes until the next sample from an exponential distribution,
+// which makes every byte allocated equally likely to be sampled (and is the
+// distribution pprof assumes when scaling samples up).
+static size_t choose_bytes_until_sample(void) {
+    const double uniform = ((next_random() >> 11) + 1) / 9007199254740992.0;
+    const double bytes = -log(uniform) * __atomic_load_n(&sample_interval, __ATOMIC_RELAXED);
+    return bytes < 1.0 ? 1 : bytes > (double)(SIZE_MAX / 2) ? SIZE_MAX / 2 : (size_t)bytes;
+}
+
+// Estimate the number of allocations represented by the samples of a site.
+static double get_scale(const struct profile_site *site) {
+    if (site->live_count == 0) { return 0.0; }
+    const double average_size = (double)site->live_bytes / site->live_count;
+    return 1.0 / -expm1(-average_size / sample_interval);
+}
+
+static void clear_tables(void) {
+    for (size_t i = 0; i < PROFILE_SAMPLE_BUCKETS; i++) {
+        __atomic_store_n(&(tables->sample_buckets[i]), NO_INDEX, __ATOMIC_RELAXED);
+    }
+    for (uint32_t i = 0; i < PROFILE_MAX_SAMPLES; i++) {
+        tables->samples[i].next = i + 1 < PROFILE_MAX_SAMPLES ? i + 1 : NO_INDEX;
+    }
+    tables->unused_samples = 0;
+    
+    for (size_t i = 0; i < PROFILE_SITE_BUCKETS; i++) {
+        tables->site_buckets[i] = NO_INDEX;
+    }
+    tables->site_count = 0;
+    tables->dropped_count = 0;
+}
+
+bool profile_start(size_t interval) {
+    if (interval == 0) { return false; }
+    
+    LOCK_PROFILE();
+    if (tables == NULL) {
+        struct profile_tables *new_tables = pages_alloc(pages_round_size(sizeof(struct profile_tables)));
+        __atomic_store_n(&tables, new_tables, __ATOMIC_RELEASE);
+    }
+    if (tables != NULL) { clear_tables(); }
+    __atomic_store_n(&sample_interval, interval, __ATOMIC_RELAXED);
+    UNLOCK_PROFILE();
+    
+    bytes_until_sample = 0;
+    return tables != NULL;
+}
+
+// Find the site for a call stack, adding it if it's new. Returns NO_INDEX if
+// there's no room. Must be called with the lock held.
+static uint32_t get_site(void *const *frames, size_t depth) {
+    const size_t bucket = get_site_bucket(frames, depth);
+    for (uint32_t index = tables->site_buckets[bucket]; index != NO_INDEX;
+         index = tables->sites[index].next) {
+        const struct profile_site *site = &(tables->sites[index]);
+        if (site->depth == depth && memcmp(site->frames, frames, depth * sizeof(void *)) == 0) {
+            return index;
+        }
+    }
+    
+    if (tables->site_count == PROFILE_MAX_SITES) { return NO_INDEX; }
+    
+    const uint32_t index = tables->site_count++;
+    struct profile_site *site = &(tables->sites[index]);
+    memcpy(site->frames, frames, depth * sizeof(void *));
+    site->depth = depth;
+    site->live_count = 0;
+    site->live_bytes = 0;
+    site->total_count = 0;
+    site->total_bytes = 0;
+    site->next = tables->site_buckets[bucket];
+    tables->site_buckets[bucket] = index;
+    return index;
+}
+
+__attribute__((noinline))
+static void record_sample(void *ptr, size_t n, void *call_site) {
+    void *frames[PROFILE_MAX_DEPTH + ALLOCATOR_MAX_FRAME_COUNT];
+    size_t first = 0;
+    size_t depth = 0;
+#ifdef HAVE_BACKTRACE
+    const size_t frame_count = (size_t)backtrace(frames, PROFILE_MAX_DEPTH + ALLOCATOR_MAX_FRAME_COUNT);
+    
+    // The caller's frames start at the public function's return address.
+    // How many of the allocator's come before it depends on the entry
+    // point and on inlining. Failing that, only the profiler's own frames
+    // (record_sample() and profile_alloc()) are left out.
+    while (first < frame_count && frames[first] != call_site) {
+        first++;
+    }
+    if (first == frame_count) { first = frame_count < 2 ? frame_count : 2; }
+    
+    depth = frame_count - first;
+    if (depth > PROFILE_MAX_DEPTH) { depth = PROFILE_MAX_DEPTH; }
+#else
+    (void)call_site;
+#endif
+    
+    LOCK_PROFILE();
+    const uint32_t site_index = get_site(frames + first, depth);
+    const uint32_t sample_index = tables->unused_samples;
+    if (site_index == NO_INDEX || sample_index == NO_INDEX) {
+        tables->dropped_count++;
+        UNLOCK_PROFILE();
+        return;
+    }
+    
+    struct profile_sample *sample = &(tables->samples[sample_index]);
+    tables->unused_samples = sample->next;
+    sample->ptr = ptr;
+    sample->size = n;
+    sample->site = site_index;
+    
+    const size_t bucket = get_sample_bucket(ptr);
+    sample->next = tables->sample_buckets[bucket];
+    __atomic_store_n(&(tables->sample_buckets[bucket]), sample_index, __ATOMIC_RELAXED);
+    
+    struct profile_site *site = &(tables->sites[site_index]);
+    site->live_count++;
+    site->live_bytes += n;
+    site->total_count++;
+    site->total_bytes += n;
+    UNLOCK_PROFILE();
+}
+
+void profile_alloc(void *ptr, size_t n, void *call_site) {
+    if (n < bytes_until_sample) {
+        bytes_until_sample -= n;
+        return;
+    }
+    
+    if (in_profile || __atomic_load_n(&tables, __ATOMIC_ACQUIRE) == NULL) { return; }
+    
+    if (bytes_until_sample == 0) {
+        // First allocation by this thread while profiling.
+        bytes_until_sample = choose_bytes_until_sample();
+        if (n < bytes_until_sample) {
+            bytes_until_sample -= n;
+            return;
+        }
+    }
+    
+    bytes_until_sample = choose_bytes_until_sample();
+    in_profile = true;
+    record_sample(ptr, n, call_site);
+    in_profile = false;
+}
+
+void profile_free(void *ptr) {
+    struct profile_tables *current_tables = __atomic_load_n(&tables, __ATOMIC_ACQUIRE);
+    if (current_tables == NULL || in_profile) { return; }
+    
+    // Almost all memory isn't sampled, so check for an empty bucket without
+    // taking the lock.
+    const size_t bucket = get_sample_bucket(ptr);
+    if (__atomic_load_n(&(current_tables->sample_buckets[bucket]), __ATOMIC_RELAXED) == NO_INDEX) {
+        return;
+    }
+    
+    LOCK_PROFILE();
+    uint32_t *link = &(tables->sample_buckets[bucket]);
+    while (*link != NO_INDEX) {
+        struct profile_sample *sample = &(tables->samples[*link]);
+        if (sample->ptr == ptr) {
+            struct profile_site *site = &(tables->sites[sample->site]);
+            site->live_count--;
+            site->live_bytes -= sample->size;
+            
+            const uint32_t index = *link;
+            __atomic_store_n(link, sample->next, __ATOMIC_RELAXED);
+            sample->next = tables->unused_samples;
+            tables->unused_samples = index;
+            break;
+        }
+        link = &(sample->next);
+    }
+    UNLOCK_PROFILE();
+}
+
+static int compare_live_bytes(const void *a, const void *b) {
+    const size_t a_bytes = tables->sites[*(const uint32_t *)a].live_bytes;
+    const size_t b_bytes = tables->sites[*(const uint32_t *)b].live_bytes;
+    return a_bytes < b_bytes ? 1 : a_bytes > b_bytes ? -1 : 0;
+}
+
+static void write_text(FILE *file) {
+    double total_bytes = 0.0;
+    for (uint32_t i = 0; i < tables->site_count; i++) {
+        const struct profile_site *site = &(tables->sites[i]);
+        total_bytes += site->live_bytes * get_scale(site);
+    }
+    fprintf(file, "heap profile: about %.0f live bytes, sampled every %zu bytes (%zu samples dropped)\n",
+            total_bytes, sample_interval, tables->dropped_count);
+    
+    for (uint32_t i = 0; i < tables->site_count; i++) {
+        const struct profile_site *site = &(tables->sites[tables->order[i]]);
+        if (site->live_count == 0) { continue; }
+        
+        const double scale = get_scale(site);
+        fprintf(file, "\n%.0f bytes in %.0f allocations (%zu samples) from:\n",
+                site->live_bytes * scale, site->live_count * scale, site->live_count);
+        
+        char **symbols = NULL;
+#ifdef HAVE_BACKTRACE
+        symbols = backtrace_symbols(site->frames, site->depth);
+#endif
+        for (size_t j = 0; j < site->depth; j++) {
+            if (symbols != NULL) {
+                fprintf(file, "    %s\n", symbols[j]);
+            } else {
+                fprintf(file, "    %p\n", site->frames[j]);
+            }
+        }
+        free(symbols);
+    }
+}
+
+static void write_pprof(FILE *file) {
+    size_t live_count = 0, live_bytes = 0, total_count = 0, total_bytes = 0;
+    for (uint32_t i = 0; i < tables->site_count; i++) {
+        const struct profile_site *site = &(tables->sites[i]);
+        live_count += site->live_count;
+        live_bytes += site->live_bytes;
+        total_count += site->total_count;
+        total_bytes += site->total_bytes;
+    }
+    fprintf(file, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n",
+            live_count, live_bytes, total_count, total_bytes, sample_interval);
+    
+    for (uint32_t i = 0; i < tables->site_count; i++) {
+        const struct profile_site *site = &(tables->sites[tables->order[i]]);
+        fprintf(file, "%zu: %zu [%zu: %zu] @", site->live_count, site->live_bytes,
+                site->total_count, site->total_bytes);
+        for (size_t j = 0; j < site->depth; j++) {
+            fprintf(file, " %p", site->frames[j]);
+        }
+        fprintf(file, "\n");
+    }
+    
+    // pprof needs the memory map to find the symbols for each address.
+    FILE *maps = fopen("/proc/self/maps", "r");
+    if (maps != NULL) {
+        fprintf(file, "\nMAPPED_LIBRARIES:\n");
+        char buffer[4096];
+        size_t size;
+        while ((size = fread(buffer, 1, sizeof(buffer), maps)) != 0) {
+            fwrite(buffer, 1, size, file);
+        }
+        fclose(maps);
+    }
+}
+
+void profile_write(FILE *file, enum mem_profile_format format) {
+    if (tables == NULL) { return; }
+    
+    in_profile = true;
+    LOCK_PROFILE();
+    for (uint32_t i = 0; i < tables->site_count; i++) {
+        tables->order[i] = i;
+    }
+    qsort(tables->order, tables->site_count, sizeof(uint32_t), compare_live_bytes);
+    
+    if (format == MEM_PROFILE_PPROF) {
+        write_pprof(file);
+    } else {
+        write_text(file);
+    }
+    UNLOCK_PROFILE();
+    in_profile = false;
+}
+
+void profile_lock(void) {
+    LOCK_PROFILE();
+}
+
+void profile_unlock(void) {
+    UNLOCK_PROFILE();
+}
@@ -0,0 +1,44 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "mem_profile.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Limits on what a profile records. Samples beyond these are dropped (and
+// counted as such in the profile).
+#ifndef PROFILE_MAX_DEPTH
+#define PROFILE_MAX_DEPTH 32
+#endif
+
+#ifndef PROFILE_MAX_SAMPLES
+#define PROFILE_MAX_SAMPLES 16384
+#endif
+
+#ifndef PROFILE_MAX_SITES
+#define PROFILE_MAX_SITES 4096
+#endif
+
+// Clear the profile and start sampling roughly one allocation every
+// 'sample_interval' bytes. The profile's memory comes from pages_alloc()
+// on first use and is kept from then on. Returns false if there is none.
+bool profile_start(size_t sample_interval);
+
+// Record an allocation of 'n' bytes at 'ptr', if it's chosen as a sample.
+// 'call_site' is the return address of the allocator's public function, where
+// the caller's part of the call stack begins.
+void profile_alloc(void *ptr, size_t n, void *call_site);
+
+// Forget an allocation that's about to be freed, if it was sampled.
+void profile_free(void *ptr);
+
+void profile_write(FILE *file, enum mem_profile_format format);
+
+// Take and release the lock on the profile (with MEM_THREAD_SAFE), so that
+// fork() can't copy it while it's held.
+void profile_lock(void);
+void profile_unlock(void);
+
+#endif
@@ -0,0 +1,341 @@
+#include "small.h"
+
+#include "blockmem.h"
+#include "freelist.h"
+#include "mem_stats.h"
+#include "pages.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef MEM_THREAD_SAFE
+#include <pthread.h>
+#endif
+
+// Stored at the start of every small page, followed by its objects.
+struct small_page {
+    // Heap the page belongs to, or NULL while it's free.
+    struct heap *heap;
+    
+    // Neighbours in one of the lists of a heap's pages, or in the free pages.
+    struct small_page *prev;
+    struct small_page *next;
+    
+    // Freed objects, linked through their first word.
+    void *free_objs;
+    
+    // Offset from the page of the first object never handed out.
+    uint32_t unused_offset;
+    
+    uint32_t obj_size;
+    uint32_t alloc_count;
+    uint32_t capacity;
+};
+
+_Static_assert(sizeof(struct small_page) % 8 == 0, "Objects must be 8-byte aligned");
+_Static_assert(SMALL_MAX_SIZE % 8 == 0 && SMALL_MAX_SIZE > 0, "Invalid SMALL_MAX_SIZE");
+
+// Small pages are recognised from their address by a two-level radix tree of
+// bitmaps with a bit per page, covering 48-bit addresses. Nodes are only
+// ever added, so the tree can be read without a lock.
+#define PAGEMAP_LEVEL_BITS 12
+#define PAGEMAP_SIZE ((size_t)1 << PAGEMAP_LEVEL_BITS)
+
+static uint64_t **pagemap[PAGEMAP_SIZE];
+
+// Unused pages, linked through 'next'.
+static struct small_page *free_pages;
+
+// Bytes held from pages_alloc() for pages and for the page map.
+static size_t run_bytes;
+static size_t pagemap_bytes;
+
+#ifdef MEM_THREAD_SAFE
+static pthread_mutex_t small_mutex = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK_SMALL() pthread_mutex_lock(&small_mutex)
+#define UNLOCK_SMALL() pthread_mutex_unlock(&small_mutex)
+#else
+#define LOCK_SMALL()
+#define UNLOCK_SMALL()
+#endif
+
+static struct small_page *get_page(const void *ptr) {
+    return (struct small_page *)((uintptr_t)ptr & ~(uintptr_t)(SMALL_PAGE_SIZE - 1));
+}
+
+static size_t get_class(size_t obj_size) {
+    return obj_size / 8 - 1;
+}
+
+static bool is_full(const struct small_page *page) {
+    return page->alloc_count == page->capacity;
+}
+
+// Get zeroed memory for a node of the page map. Must be called with the lock
+// held.
+static void *alloc_pagemap_node(size_t size) {
+    const size_t alloc_size = pages_round_size(size);
+    void *node = pages_alloc(alloc_size);
+    if (node == NULL) { return NULL; }
+    
+    memset(node, 0, size);
+    pagemap_bytes += alloc_size;
+    return node;
+}
+
+// Get the bitmap word covering 'page_number', adding nodes to the page map
+// if 'create' is set. Returns NULL if there is no such word.
+static uint64_t *get_pagemap_word(uintptr_t page_number, bool create) {
+    const size_t top_index = page_number >> (2 * PAGEMAP_LEVEL_BITS);
+    if (top_index >= PAGEMAP_SIZE) { return NULL; }
+    
+    uint64_t **mid = __atomic_load_n(&pagemap[top_index], __ATOMIC_ACQUIRE);
+    if (mid == NULL) {
+        if (!create) { return NULL; }
+        mid = alloc_pagemap_node(PAGEMAP_SIZE * sizeof(uint64_t *));
+        if (mid == NULL) { return NULL; }
+        __atomic_store_n(&pagemap[top_index], mid, __ATOMIC_RELEASE);
+    }
+    
+    const size_t mid_index = (page_number >> PAGEMAP_LEVEL_BITS) & (PAGEMAP_SIZE - 1);
+    uint64_t *leaf = __atomic_load_n(&mid[mid_index], __ATOMIC_ACQUIRE);
+    if (leaf == NULL) {
+        if (!create) { return NULL; }
+        leaf = alloc_pagemap_node(PAGEMAP_SIZE / 8);
+        if (leaf == NULL) { return NULL; }
+        __atomic_store_n(&mid[mid_index], leaf, __ATOMIC_RELEASE);
+    }
+    
+    return &leaf[(page_number & (PAGEMAP_SIZE - 1)) / 64];
+}
+
+// Take memory for more pages from the kernel and add them to the free pages.
+// Must be called with the lock held.
+static bool add_run(void) {
+    const size_t run_size = pages_round_size((SMALL_RUN_PAGES + 1) * SMALL_PAGE_SIZE);
+    uint8_t *run = pages_alloc(run_size);
+    if (run == NULL) { return false; }
+    
+    // Pages must be aligned so they can be found from the objects in them.
+    const uintptr_t first_page = ((uintptr_t)run + (SMALL_PAGE_SIZE - 1)) >> SMALL_PAGE_SHIFT;
+    const uintptr_t end_page = ((uintptr_t)run + run_size) >> SMALL_PAGE_SHIFT;
+    
+    // Make room in the page map before marking anything, so memory that
+    // can't be mapped is returned without ever looking like a small page.
+    for (uintptr_t page_number = first_page; page_number < end_page; page_number++) {
+        if (get_pagemap_word(page_number, true) == NULL) {
+            pages_free(run, run_size);
+            return false;
+        }
+    }
+    
+    for (uintptr_t page_number = end_page; page_number-- > first_page;) {
+        uint64_t *word = get_pagemap_word(page_number, false);
+        __atomic_fetch_or(word, (uint64_t)1 << (page_number % 64), __ATOMIC_RELAXED);
+        
+        struct small_page *page = (struct small_page *)(page_number << SMALL_PAGE_SHIFT);
+        page->heap = NULL;
+        page->next = free_pages;
+        free_pages = page;
+    }
+    
+    run_bytes += run_size;
+    return true;
+}
+
+static struct small_page *take_page(void) {
+    LOCK_SMALL();
+    if (free_pages == NULL && !add_run()) {
+        UNLOCK_SMALL();
+        return NULL;
+    }
+    
+    struct small_page *page = free_pages;
+    free_pages = page->next;
+    UNLOCK_SMALL();
+    return page;
+}
+
+static void release_page(struct small_page *page) {
+    assert(page->alloc_count == 0);
+    page->heap = NULL;
+    
+    LOCK_SMALL();
+    page->next = free_pages;
+    free_pages = page;
+    UNLOCK_SMALL();
+}
+
+static void push_page(struct small_page **list, struct small_page *page) {
+    page->prev = NULL;
+    page->next = *list;
+    if (*list != NULL) { (*list)->prev = page; }
+    *list = page;
+}
+
+static void remove_page(struct small_page **list, struct small_page *page) {
+    if (page->prev != NULL) { page->prev->next = page->next; }
+    if (page->next != NULL) { page->next->prev = page->prev; }
+    if (page == *list) { *list = page->next; }
+}
+
+void small_init(struct small_pages *pages) {
+    for (size_t i = 0; i < SMALL_CLASS_COUNT; i++) {
+        pages->lists[i] = NULL;
+    }
+    pages->full_pages = NULL;
+}
+
+void *small_alloc(struct small_pages *pages, struct heap *heap, size_t n) {
+    assert(n > 0 && n <= SMALL_MAX_SIZE);
+    
+    const size_t obj_size = (n + 7) & ~(size_t)7;
+    struct small_page **list = &(pages->lists[get_class(obj_size)]);
+    struct small_page *page = *list;
+    if (page == NULL) {
+        page = take_page();
+        if (page == NULL) { return NULL; }
+        
+        page->heap = heap;
+        page->free_objs = NULL;
+        page->unused_offset = sizeof(struct small_page);
+        page->obj_size = obj_size;
+        page->alloc_count = 0;
+        page->capacity = (SMALL_PAGE_SIZE - sizeof(struct small_page)) / obj_size;
+        push_page(list, page);
+    }
+    
+    void *obj = page->free_objs;
+    if (obj != NULL) {
+        page->free_objs = *(void **)obj;
+    } else {
+        obj = (uint8_t *)page + page->unused_offset;
+        page->unused_offset += obj_size;
+    }
+    page->alloc_count++;
+    
+    if (is_full(page)) {
+        remove_page(list, page);
+        push_page(&(pages->full_pages), page);
+    }
+    return obj;
+}
+
+void small_free(struct small_pages *pages, void *ptr) {
+    struct small_page *page = get_page(ptr);
+    assert(page->alloc_count > 0 && "Already freed");
+    
+    struct small_page **list = &(pages->lists[get_class(page->obj_size)]);
+    if (is_full(page)) {
+        remove_page(&(pages->full_pages), page);
+        push_page(list, page);
+    }
+    
+    *(void **)ptr = page->free_objs;
+    page->free_objs = ptr;
+    page->alloc_count--;
+    
+    // Keep the last page of each size when it empties, so alternately
+    // allocating and freeing doesn't pass pages back and forth.
+    if (page->alloc_count == 0 && (page->prev != NULL || page->next != NULL)) {
+        remove_page(list, page);
+        release_page(page);
+    }
+}
+
+void small_trim(struct small_pages *pages) {
+    for (size_t i = 0; i < SMALL_CLASS_COUNT; i++) {
+        struct small_page *page = pages->lists[i];
+        if (page != NULL && page->alloc_count == 0) {
+            assert(page->next == NULL);
+            remove_page(&(pages->lists[i]), page);
+            release_page(page);
+        }
+    }
+}
+
+static void release_list(struct small_page **list) {
+    struct small_page *page = *list;
+    while (page != NULL) {
+        struct small_page *next = page->next;
+        page->alloc_count = 0;
+        release_page(page);
+        page = next;
+    }
+    *list = NULL;
+}
+
+void small_release_all(struct small_pages *pages) {
+    for (size_t i = 0; i < SMALL_CLASS_COUNT; i++) {
+        release_list(&(pages->lists[i]));
+    }
+    release_list(&(pages->full_pages));
+}
+
+void small_lock(void) {
+    LOCK_SMALL();
+}
+
+void small_unlock(void) {
+    UNLOCK_SMALL();
+}
+
+bool small_is_allocation(const void *ptr) {
+    const uintptr_t page_number = (uintptr_t)ptr >> SMALL_PAGE_SHIFT;
+    const uint64_t *word = get_pagemap_word(page_number, false);
+    return word != NULL && ((__atomic_load_n(word, __ATOMIC_RELAXED) >> (page_number % 64)) & 1);
+}
+
+size_t small_get_usable_size(void *ptr) {
+    return get_page(ptr)->obj_size;
+}
+
+struct heap *small_get_owner(void *ptr) {
+    return get_page(ptr)->heap;
+}
+
+static void add_page_stats(struct small_page *page, struct mem_stats *stats) {
+    const size_t data_size = page->obj_size < BLOCKMEM_MIN_DATA_SIZE ?
+        BLOCKMEM_MIN_DATA_SIZE : page->obj_size;
+    stats->small_page_count++;
+    stats->alloc_count += page->alloc_count;
+    stats->allocated_bytes += (size_t)page->alloc_count * page->obj_size;
+    stats->class_alloc_counts[freelist_class_for_size(data_size)] += page->alloc_count;
+}
+
+void small_add_stats(struct small_pages *pages, struct mem_stats *stats) {
+    for (size_t i = 0; i < SMALL_CLASS_COUNT; i++) {
+        for (struct small_page *page = pages->lists[i]; page != NULL; page = page->next) {
+            add_page_stats(page, stats);
+        }
+    }
+    for (struct small_page *page = pages->full_pages; page != NULL; page = page->next) {
+        add_page_stats(page, stats);
+    }
+}
+
+void small_add_reserved_stats(struct mem_stats *stats) {
+    LOCK_SMALL();
+    stats->reserved_bytes += run_bytes + pagemap_bytes;
+    UNLOCK_SMALL();
+}
+
+static void dump_page(struct small_page *page, FILE *file) {
+    fprintf(file, "small page %p: %u-byte objects, %u of %u allocated\n", (void *)page,
+            page->obj_size, page->alloc_count, page->capacity);
+}
+
+void small_dump(struct small_pages *pages, FILE *file) {
+    for (size_t i = 0; i < SMALL_CLASS_COUNT; i++) {
+        for (struct small_page *page = pages->lists[i]; page != NULL; page = page->next) {
+            dump_page(page, file);
+        }
+    }
+    for (struct small_page *page = pages->full_pages; page != NULL; page = page->next) {
+        dump_page(page, file);
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef SMALL_H
+#define SMALL_H
+
+#include "mem_stats.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Allocations of up to SMALL_MAX_SIZE bytes (a multiple of 8) can be packed
+// into pages holding objects of a single size, with no header per object.
+// The size and owner of an object are found from the header at the start of
+// its page (see HEAP_SMALL_PAGES).
+#ifndef SMALL_MAX_SIZE
+#define SMALL_MAX_SIZE 64
+#endif
+
+#define SMALL_CLASS_COUNT (SMALL_MAX_SIZE / 8)
+
+#define SMALL_PAGE_SHIFT 12
+#define SMALL_PAGE_SIZE ((size_t)1 << SMALL_PAGE_SHIFT)
+
+// Pages are taken from pages_alloc() this many at a time, and are never
+// released; pages left empty by one heap are reused by any other.
+#ifndef SMALL_RUN_PAGES
+#define SMALL_RUN_PAGES 16
+#endif
+
+struct heap;
+struct small_page;
+
+// The small pages of one heap. A zeroed struct has no pages.
+struct small_pages {
+    // Pages with room for another object, by object size.
+    struct small_page *lists[SMALL_CLASS_COUNT];
+    
+    // Pages of every size with no room left.
+    struct small_page *full_pages;
+};
+
+// Construct an empty set of pages.
+void small_init(struct small_pages *pages);
+
+// Returns a pointer to 'n' bytes (1 to SMALL_MAX_SIZE) in one of the pages,
+// which belong to 'heap'. Returns NULL if no memory is available.
+void *small_alloc(struct small_pages *pages, struct heap *heap, size_t n);
+
+// Releases memory allocated by small_alloc() from the same pages.
+void small_free(struct small_pages *pages, void *ptr);
+
+// Release the pages kept while empty, so that other heaps can use them.
+void small_trim(struct small_pages *pages);
+
+// Release every page, whatever is still allocated in it, for use by other
+// heaps.
+void small_release_all(struct small_pages *pages);
+
+// Take and release the lock on the pages shared by every heap (with
+// MEM_THREAD_SAFE), so that fork() can't copy it while it's held.
+void small_lock(void);
+void small_unlock(void);
+
+// Query if memory was allocated by small_alloc(). Any pointer can be passed,
+// and this doesn't read the memory it points to.
+bool small_is_allocation(const void *ptr);
+
+// Get the number of bytes usable in memory returned by small_alloc().
+size_t small_get_usable_size(void *ptr);
+
+// Get the heap that memory returned by small_alloc() belongs to.
+struct heap *small_get_owner(void *ptr);
+
+// Add the pages and live objects to 'stats'.
+void small_add_stats(struct small_pages *pages, struct mem_stats *stats);
+
+// Add the memory held for small pages by every heap to 'stats'.
+void small_add_reserved_stats(struct mem_stats *stats);
+
+// Print each page and its objects to 'file'.
+void small_dump(struct small_pages *pages, FILE *file);
+
+#endif
@@ -2,19 +2,24 @@
 #define CALLCOUNTER_HPP
 
 /**
- * \brief Copy constructor and destructor call counter.
+ * \brief Copy constructor, move constructor and destructor call counter.
  *
  * Used for unit tests.
  */
 class CallCounter {
 public:
 	CallCounter()
-	: copyConstructorCallCount_(0), destructorCallCount_(0) { }
+	: copyConstructorCallCount_(0), moveConstructorCallCount_(0),
+	destructorCallCount_(0) { }
 	
 	size_t copyConstructorCallCount() {
 		return copyConstructorCallCount_;
 	}
 	
+	size_t moveConstructorCallCount() {
+		return moveConstructorCallCount_;
+	}
+	
 	size_t destructorCallCount() {
 		return destructorCallCount_;
 	}
@@ -23,12 +28,17 @@ public:
 		copyConstructorCallCount_++;
 	}
 	
+	void recordMoveConstructorCall() {
+		moveConstructorCallCount_++;
+	}
+	
 	void recordDestructorCall() {
 		destructorCallCount_++;
 	}
 	
 private:
 	size_t copyConstructorCallCount_;
+	size_t moveConstructorCallCount_;
 	size_t destructorCallCount_;
 	
 };
@@ -1,12 +1,19 @@
 #ifndef CHECK_HPP
 #define CHECK_HPP
 
+#include <cstdio>
+#include <exception>
+
 // A function for printing a value. You add other overloads for different types
 // and CHECK_*() will work for those types.
 void printValue(size_t value) {
 	printf("%zu", value);
 }
 
+void printValue(const void* value) {
+	printf("%p", value);
+}
+
 // Not using assert() as it is disabled when NDEBUG is defined; we can rely on
 // this function to always be enabled.
 template <typename A, typename B>
@@ -0,0 +1,204 @@
+// Times growing arrays of trivially copyable elements one push_back() at a
+// time, and copying them, with dynamic_array and std::vector<>. Then compares
+// growth policies, and dynamic_array with small_dynamic_array on lots of small
+// arrays.
+#include "dynamic_array.hpp"
+#include "small_dynamic_array.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+// Elements pushed on to each array.
+const size_t NUM_ELEMENTS = 1000000;
+
+// Each benchmark is run this many times, taking the fastest.
+const size_t NUM_RUNS = 20;
+
+// A plain struct, as an example of a larger trivially copyable element.
+struct Point {
+	double x, y, z;
+};
+
+template <typename Element>
+Element makeElement(size_t i);
+
+template <>
+int makeElement<int>(size_t i) {
+	return int(i);
+}
+
+template <>
+Point makeElement<Point>(size_t i) {
+	Point point = { double(i), double(i) + 1, double(i) + 2 };
+	return point;
+}
+
+// Stops the compiler optimizing away the arrays.
+volatile size_t sink;
+
+template <typename Array, typename Element>
+double timePushBack() {
+	double fastest = 1e9;
+	for (size_t run = 0; run < NUM_RUNS; run++) {
+		const std::chrono::steady_clock::time_point start =
+			std::chrono::steady_clock::now();
+		
+		Array array;
+		for (size_t i = 0; i < NUM_ELEMENTS; i++) {
+			array.push_back(makeElement<Element>(i));
+		}
+		sink = array.size();
+		
+		const std::chrono::duration<double> time =
+			std::chrono::steady_clock::now() - start;
+		fastest = std::min(fastest, time.count());
+	}
+	return fastest * 1e9 / NUM_ELEMENTS;
+}
+
+template <typename Array, typename Element>
+double timeCopy() {
+	Array array;
+	for (size_t i = 0; i < NUM_ELEMENTS; i++) {
+		array.push_back(makeElement<Element>(i));
+	}
+	
+	double fastest = 1e9;
+	for (size_t run = 0; run < NUM_RUNS; run++) {
+		const std::chrono::steady_clock::time_point start =
+			std::chrono::steady_clock::now();
+		
+		Array arrayCopy(array);
+		sink = *reinterpret_cast<const unsigned char*>(
+			&arrayCopy[NUM_ELEMENTS / 2]);
+		
+		const std::chrono::duration<double> time =
+			std::chrono::steady_clock::now() - start;
+		fastest = std::min(fastest, time.count());
+	}
+	return fastest * 1e9 / NUM_ELEMENTS;
+}
+
+template <typename Element>
+void runBenchmarks(const char* name) {
+	printf("%-8s %-13s %10.2f %10.2f\n", name, "dynamic_array",
+	       timePushBack<dynamic_array<Element>, Element>(),
+	       timeCopy<dynamic_array<Element>, Element>());
+	printf("%-8s %-13s %10.2f %10.2f\n", name, "std::vector",
+	       timePushBack<std::vector<Element>, Element>(),
+	       timeCopy<std::vector<Element>, Element>());
+}
+
+// Times push_back() of ints with a growth policy, and reports how much of the
+// storage is in use on average as the array grows.
+template <typename GrowthPolicy>
+void runGrowthBenchmark(const char* name) {
+	typedef dynamic_array<int, malloc_allocator<int>, GrowthPolicy> Array;
+	
+	Array array;
+	double used = 0;
+	for (size_t i = 0; i < NUM_ELEMENTS; i++) {
+		array.push_back(int(i));
+		used += double(array.size()) / array.capacity();
+	}
+	
+	printf("%-22s %10.2f %9.0f%%\n", name, timePushBack<Array, int>(),
+	       100.0 * used / NUM_ELEMENTS);
+}
+
+// Arrays in the small arrays benchmark, each holding up to
+// MAX_SMALL_ELEMENTS elements.
+const size_t NUM_SMALL_ARRAYS = 1000000;
+const size_t MAX_SMALL_ELEMENTS = 8;
+
+// Number of allocations made by CountingAllocator.
+size_t allocationCount = 0;
+
+// malloc_allocator, counting allocations (including reallocations).
+template <typename T>
+class CountingAllocator : public malloc_allocator<T> {
+public:
+	T* allocate(size_t n) {
+		allocationCount++;
+		return malloc_allocator<T>::allocate(n);
+	}
+	
+	T* reallocate(T* ptr, size_t oldCount, size_t newCount) {
+		allocationCount++;
+		return malloc_allocator<T>::reallocate(ptr, oldCount, newCount);
+	}
+	
+};
+
+// Fills lots of arrays of 0 to MAX_SMALL_ELEMENTS ints, stored one after
+// another (as they might be in a larger structure), and then sums them all.
+template <typename Array>
+void runSmallArraysBenchmark(const char* name) {
+	double fastestFill = 1e9, fastestSum = 1e9;
+	size_t allocations = 0;
+	for (size_t run = 0; run < NUM_RUNS; run++) {
+		dynamic_array<Array> arrays;
+		arrays.resize(NUM_SMALL_ARRAYS);
+		allocationCount = 0;
+		
+		const std::chrono::steady_clock::time_point start =
+			std::chrono::steady_clock::now();
+		
+		for (size_t i = 0; i < NUM_SMALL_ARRAYS; i++) {
+			const size_t count = (i * 7) % (MAX_SMALL_ELEMENTS + 1);
+			for (size_t j = 0; j < count; j++) {
+				arrays[i].push_back(int(i + j));
+			}
+		}
+		
+		const std::chrono::steady_clock::time_point filled =
+			std::chrono::steady_clock::now();
+		
+		size_t sum = 0;
+		for (size_t i = 0; i < NUM_SMALL_ARRAYS; i++) {
+			for (size_t j = 0; j < arrays[i].size(); j++) {
+				sum += size_t(arrays[i][j]);
+			}
+		}
+		sink = sum;
+		
+		const std::chrono::duration<double> fillTime = filled - start;
+		const std::chrono::duration<double> sumTime =
+			std::chrono::steady_clock::now() - filled;
+		fastestFill = std::min(fastestFill, fillTime.count());
+		fastestSum = std::min(fastestSum, sumTime.count());
+		allocations = allocationCount;
+	}
+	
+	printf("%-26s %10.2f %10.2f %12.2f %8zu\n", name,
+	       fastestFill * 1e9 / NUM_SMALL_ARRAYS,
+	       fastestSum * 1e9 / NUM_SMALL_ARRAYS,
+	       double(allocations) / NUM_SMALL_ARRAYS, sizeof(Array));
+}
+
+int main() {
+	printf("Nanoseconds per element for %zu elements:\n\n", NUM_ELEMENTS);
+	printf("%-8s %-13s %10s %10s\n", "element", "array", "push_back", "copy");
+	runBenchmarks<int>("int");
+	runBenchmarks<Point>("Point");
+	
+	printf("\nNanoseconds per int pushed, and storage used, by growth policy:\n\n");
+	printf("%-22s %10s %10s\n", "policy", "push_back", "used");
+	runGrowthBenchmark<doubling_growth>("doubling_growth");
+	runGrowthBenchmark<one_and_a_half_growth>("one_and_a_half_growth");
+	runGrowthBenchmark<size_class_growth>("size_class_growth");
+	
+	printf("\nNanoseconds per array for %zu arrays of 0 to %zu ints:\n\n",
+	       NUM_SMALL_ARRAYS, MAX_SMALL_ELEMENTS);
+	printf("%-26s %10s %10s %12s %8s\n", "array", "fill", "sum",
+	       "allocations", "bytes");
+	runSmallArraysBenchmark<dynamic_array<int, CountingAllocator<int> > >(
+		"dynamic_array");
+	runSmallArraysBenchmark<small_dynamic_array<int, 4,
+		CountingAllocator<int> > >("small_dynamic_array<4>");
+	runSmallArraysBenchmark<small_dynamic_array<int, 8,
+		CountingAllocator<int> > >("small_dynamic_array<8>");
+	return 0;
+}
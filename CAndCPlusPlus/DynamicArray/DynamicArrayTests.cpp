@@ -3,6 +3,7 @@
 #include "dynamic_array.hpp"
 
 #include <cstdio>
+#include <cstdlib>
 #include <vector>
 
 // Macros like 'CHECK_EQ' to check for specific conditions in unit tests and
@@ -12,6 +13,22 @@
 // A 'fake' element type that we use for unit testing.
 #include "FakeElementType.hpp"
 
+// The small buffer variant.
+#include "small_dynamic_array.hpp"
+
+// Allocator using the C memory allocator.
+#include "mem_allocator.hpp"
+#include "mem_kernel.h"
+
+// The C memory allocator gets its blocks from these, as in its own tests.
+extern "C" void* mem_block_alloc(size_t n) {
+	return malloc(n * MEM_BLOCK_SIZE);
+}
+
+extern "C" void mem_block_free(void* ptr) {
+	free(ptr);
+}
+
 // Typedef a function pointer so it is easier to use.
 typedef void (*TestFunctionType)();
 
@@ -19,8 +36,9 @@ typedef void (*TestFunctionType)();
 typedef std::pair<const char*, TestFunctionType> TestType;
 
 void runTests(const std::vector<TestType>& tests) {
-	// In C++11 onwards you can use 'for(auto t: tests)'! We're sticking to
-	// C++03 in this code but you can use C++11 in your own code/answers.
+	// In C++11 onwards you can use 'for(auto t: tests)'! We're mostly
+	// sticking to C++03 in this code but you can use C++11 in your own
+	// code/answers.
 	std::vector<TestType>::const_iterator it;
 	for (it = tests.begin(); it != tests.end(); ++it) {
 		const TestType& t = *it;
@@ -42,7 +60,8 @@ void testPushBack() {
 	{
 	        dynamic_array<FakeElementType> array;
 		
-		array.push_back(FakeElementType(counter, 10));
+		const FakeElementType element(counter, 10);
+		array.push_back(element);
 		
 		CHECK_EQ(array.size(), 1);
 		CHECK_EQ(array[0].id(), 10);
@@ -55,6 +74,58 @@ void testPushBack() {
 	CHECK_EQ(counter.destructorCallCount(), 1);
 }
 
+void testPushBackMove() {
+	CallCounter counter;
+	
+	{
+	        dynamic_array<FakeElementType> array;
+		
+		// Temporaries are moved rather than copied.
+		array.push_back(FakeElementType(counter, 10));
+		
+		CHECK_EQ(array.size(), 1);
+		CHECK_EQ(array[0].id(), 10);
+		
+		CHECK_EQ(counter.copyConstructorCallCount(), 0);
+		CHECK_EQ(counter.moveConstructorCallCount(), 1);
+		CHECK_EQ(counter.destructorCallCount(), 0);
+	}
+	
+	CHECK_EQ(counter.copyConstructorCallCount(), 0);
+	CHECK_EQ(counter.moveConstructorCallCount(), 1);
+	CHECK_EQ(counter.destructorCallCount(), 1);
+}
+
+void testEmplaceBack() {
+	CallCounter counter;
+	
+	{
+	        dynamic_array<FakeElementType> array;
+		
+		// Elements are constructed in place, so there is nothing to
+		// copy or move (until the array grows).
+		array.emplace_back(counter, 10);
+		array.emplace_back(counter, 20);
+		
+		CHECK_EQ(array.size(), 2);
+		CHECK_EQ(array[0].id(), 10);
+		CHECK_EQ(array[1].id(), 20);
+		
+		CHECK_EQ(counter.copyConstructorCallCount(), 0);
+		CHECK_EQ(counter.moveConstructorCallCount(), 0);
+		
+		// Copying an element of the array is safe even if the array
+		// has to grow to make room for it.
+		array.emplace_back(array[0]);
+		
+		CHECK_EQ(array.size(), 3);
+		CHECK_EQ(array[2].id(), 10);
+		
+		CHECK_EQ(counter.copyConstructorCallCount(), 1);
+		CHECK_EQ(counter.moveConstructorCallCount(), 2);
+	}
+}
+
 void testPopBack() {
 	CallCounter counter;
 	
@@ -67,11 +138,11 @@ void testPopBack() {
 		
 		CHECK_EQ(array.size(), 0);
 		
-		CHECK_EQ(counter.copyConstructorCallCount(), 1);
+		CHECK_EQ(counter.moveConstructorCallCount(), 1);
 		CHECK_EQ(counter.destructorCallCount(), 1);
 	}
 	
-	CHECK_EQ(counter.copyConstructorCallCount(), 1);
+	CHECK_EQ(counter.moveConstructorCallCount(), 1);
 	CHECK_EQ(counter.destructorCallCount(), 1);
 }
 
@@ -117,7 +188,7 @@ void testSelfAssign() {
 		CHECK_EQ(array[0].id(), 10);
 		CHECK_EQ(array[1].id(), 20);
 		
-		CHECK_EQ(counter.copyConstructorCallCount(), 2);
+		CHECK_EQ(counter.moveConstructorCallCount(), 2);
 		CHECK_EQ(counter.destructorCallCount(), 0);
 		
 		array = array;
@@ -129,11 +200,12 @@ void testSelfAssign() {
 		// An oddity of our self-assign implementation is that we
 		// unnecessarily invoke copy constructors and destructors;
 		// that's OK as long as it works.
-		CHECK_EQ(counter.copyConstructorCallCount(), 4);
+		CHECK_EQ(counter.copyConstructorCallCount(), 2);
+		CHECK_EQ(counter.moveConstructorCallCount(), 2);
 		CHECK_EQ(counter.destructorCallCount(), 2);
 	}
 	
-	CHECK_EQ(counter.copyConstructorCallCount(), 4);
+	CHECK_EQ(counter.copyConstructorCallCount(), 2);
 	CHECK_EQ(counter.destructorCallCount(), 4);
 }
 
@@ -157,21 +229,82 @@ void testCopy() {
 		CHECK_EQ(arrayCopy[0].id(), 10);
 		CHECK_EQ(arrayCopy[1].id(), 20);
 		
-		CHECK_EQ(counter.copyConstructorCallCount(), 4);
+		CHECK_EQ(counter.copyConstructorCallCount(), 2);
+		CHECK_EQ(counter.moveConstructorCallCount(), 2);
 		CHECK_EQ(counter.destructorCallCount(), 0);
 	}
 	
-	CHECK_EQ(counter.copyConstructorCallCount(), 4);
+	CHECK_EQ(counter.copyConstructorCallCount(), 2);
 	CHECK_EQ(counter.destructorCallCount(), 4);
 }
 
+void testMove() {
+	CallCounter counter;
+	
+	{
+	        dynamic_array<FakeElementType> array;
+		array.push_back(FakeElementType(counter, 10));
+		array.push_back(FakeElementType(counter, 20));
+		
+		// The storage is handed over, so no elements are copied,
+		// moved or destroyed.
+	        dynamic_array<FakeElementType> arrayMoved(std::move(array));
+		
+		CHECK_EQ(array.size(), 0);
+		CHECK_EQ(arrayMoved.size(), 2);
+		CHECK_EQ(arrayMoved[0].id(), 10);
+		CHECK_EQ(arrayMoved[1].id(), 20);
+		
+		CHECK_EQ(counter.copyConstructorCallCount(), 0);
+		CHECK_EQ(counter.moveConstructorCallCount(), 2);
+		CHECK_EQ(counter.destructorCallCount(), 0);
+		
+		// The moved-from array can still be used.
+		array.push_back(FakeElementType(counter, 30));
+		CHECK_EQ(array.size(), 1);
+		CHECK_EQ(array[0].id(), 30);
+	}
+	
+	CHECK_EQ(counter.copyConstructorCallCount(), 0);
+	CHECK_EQ(counter.destructorCallCount(), 3);
+}
+
+void testMoveAssign() {
+	CallCounter counter;
+	
+	{
+	        dynamic_array<FakeElementType> array;
+		array.push_back(FakeElementType(counter, 10));
+		array.push_back(FakeElementType(counter, 20));
+		
+	        dynamic_array<FakeElementType> other;
+		other.push_back(FakeElementType(counter, 30));
+		
+		// The old element of 'other' is destroyed.
+		other = std::move(array);
+		
+		CHECK_EQ(array.size(), 0);
+		CHECK_EQ(other.size(), 2);
+		CHECK_EQ(other[0].id(), 10);
+		CHECK_EQ(other[1].id(), 20);
+		
+		CHECK_EQ(counter.copyConstructorCallCount(), 0);
+		CHECK_EQ(counter.moveConstructorCallCount(), 3);
+		CHECK_EQ(counter.destructorCallCount(), 1);
+	}
+	
+	CHECK_EQ(counter.copyConstructorCallCount(), 0);
+	CHECK_EQ(counter.destructorCallCount(), 3);
+}
+
 void testHugeArray() {
 	CallCounter counter;
 	
 	const size_t NUM_ELEMENTS = 10000;
 	
-	// We'll get lots of copies as the array grows.
-	const size_t NUM_EXPECTED_COPIES = 26356;
+	// We'll get lots of moves as the array grows, but no copies. The
+	// capacity doubles from 2 to 16384, moving 2 + 4 + ... + 8192 elements.
+	const size_t NUM_EXPECTED_MOVES = NUM_ELEMENTS + 16382;
 	
 	{
 	        dynamic_array<FakeElementType> array;
@@ -189,13 +322,121 @@ void testHugeArray() {
 			CHECK_EQ(array[i].id(), i);
 		}
 		
-		CHECK_EQ(counter.copyConstructorCallCount(), NUM_EXPECTED_COPIES);
+		CHECK_EQ(counter.copyConstructorCallCount(), 0);
+		CHECK_EQ(counter.moveConstructorCallCount(), NUM_EXPECTED_MOVES);
 		CHECK_EQ(counter.destructorCallCount(),
-		         NUM_EXPECTED_COPIES - NUM_ELEMENTS);
+		         NUM_EXPECTED_MOVES - NUM_ELEMENTS);
+	}
+	
+	CHECK_EQ(counter.copyConstructorCallCount(), 0);
+	CHECK_EQ(counter.moveConstructorCallCount(), NUM_EXPECTED_MOVES);
+	CHECK_EQ(counter.destructorCallCount(), NUM_EXPECTED_MOVES);
+}
+
+// Like FakeElementType, but its move constructor isn't noexcept, so
+// dynamic_array must copy it when growing to avoid losing elements if a move
+// throws.
+class ThrowingMoveElementType : public FakeElementType {
+public:
+	ThrowingMoveElementType(CallCounter& counter, size_t id)
+	: FakeElementType(counter, id) { }
+	
+	ThrowingMoveElementType(const ThrowingMoveElementType& other)
+	: FakeElementType(other) { }
+	
+	ThrowingMoveElementType(ThrowingMoveElementType&& other)
+	: FakeElementType(std::move(other)) { }
+	
+};
+
+void testGrowCopiesIfMoveMayThrow() {
+	CallCounter counter;
+	
+	{
+	        dynamic_array<ThrowingMoveElementType> array;
+		
+		array.push_back(ThrowingMoveElementType(counter, 10));
+		array.push_back(ThrowingMoveElementType(counter, 20));
+		
+		// Growing copies the first two elements.
+		array.push_back(ThrowingMoveElementType(counter, 30));
+		
+		CHECK_EQ(array.size(), 3);
+		CHECK_EQ(array[0].id(), 10);
+		CHECK_EQ(array[2].id(), 30);
+		
+		CHECK_EQ(counter.copyConstructorCallCount(), 2);
+		CHECK_EQ(counter.moveConstructorCallCount(), 3);
+	}
+}
+
+void testTrivialElements() {
+	const size_t NUM_ELEMENTS = 10000;
+	
+	// ints are grown with realloc() and copied with memcpy().
+	dynamic_array<int> array;
+	for (size_t i = 0; i < NUM_ELEMENTS; i++) {
+		array.push_back(int(i));
 	}
 	
-	CHECK_EQ(counter.copyConstructorCallCount(), NUM_EXPECTED_COPIES);
-	CHECK_EQ(counter.destructorCallCount(), NUM_EXPECTED_COPIES);
+	dynamic_array<int> arrayCopy(array);
+	CHECK_EQ(arrayCopy.size(), NUM_ELEMENTS);
+	for (size_t i = 0; i < NUM_ELEMENTS; i++) {
+		CHECK_EQ(size_t(array[i]), i);
+		CHECK_EQ(size_t(arrayCopy[i]), i);
+	}
+	
+	arrayCopy.resize(NUM_ELEMENTS + 10, 7);
+	arrayCopy.resize(NUM_ELEMENTS + 5);
+	CHECK_EQ(arrayCopy.size(), NUM_ELEMENTS + 5);
+	CHECK_EQ(size_t(arrayCopy[NUM_ELEMENTS - 1]), NUM_ELEMENTS - 1);
+	CHECK_EQ(size_t(arrayCopy[NUM_ELEMENTS + 4]), 7);
+	
+	// The new elements can be copies of one that growing moves.
+	array.resize(NUM_ELEMENTS * 4, array[1]);
+	CHECK_EQ(size_t(array[NUM_ELEMENTS * 4 - 1]), 1);
+}
+
+// Like FakeElementType, but marked as safe to relocate with memcpy().
+class RelocatableElementType : public FakeElementType {
+public:
+	RelocatableElementType(CallCounter& counter, size_t id)
+	: FakeElementType(counter, id) { }
+	
+};
+
+template <>
+struct is_trivially_relocatable<RelocatableElementType> : std::true_type { };
+
+void testHugeArrayRelocatable() {
+	CallCounter counter;
+	
+	const size_t NUM_ELEMENTS = 10000;
+	
+	// Growing doesn't move the existing elements, but each time the array
+	// grows (14 times) the new element is moved once more.
+	const size_t NUM_EXPECTED_MOVES = NUM_ELEMENTS + 14;
+	
+	{
+	        dynamic_array<RelocatableElementType> array;
+		
+		for (size_t i = 0; i < NUM_ELEMENTS; i++) {
+			array.push_back(RelocatableElementType(counter, i));
+		}
+		
+		CHECK_EQ(array.size(), NUM_ELEMENTS);
+		
+		for (size_t i = 0; i < NUM_ELEMENTS; i++) {
+			CHECK_EQ(array[i].id(), i);
+		}
+		
+		CHECK_EQ(counter.copyConstructorCallCount(), 0);
+		CHECK_EQ(counter.moveConstructorCallCount(), NUM_EXPECTED_MOVES);
+		CHECK_EQ(counter.destructorCallCount(),
+		         NUM_EXPECTED_MOVES - NUM_ELEMENTS);
+	}
+	
+	CHECK_EQ(counter.destructorCallCount(), NUM_EXPECTED_MOVES);
 }
 
 void testHugeArrayReserve() {
@@ -222,26 +463,526 @@ void testHugeArrayReserve() {
 			CHECK_EQ(array[i].id(), i);
 		}
 		
-		// reserve() prevents any extra copies since we never have to
+		// reserve() prevents any extra moves since we never have to
 		// grow.
-		CHECK_EQ(counter.copyConstructorCallCount(), NUM_ELEMENTS);
+		CHECK_EQ(counter.copyConstructorCallCount(), 0);
+		CHECK_EQ(counter.moveConstructorCallCount(), NUM_ELEMENTS);
 		CHECK_EQ(counter.destructorCallCount(), 0);
 	}
 	
-	CHECK_EQ(counter.copyConstructorCallCount(), NUM_ELEMENTS);
+	CHECK_EQ(counter.moveConstructorCallCount(), NUM_ELEMENTS);
 	CHECK_EQ(counter.destructorCallCount(), NUM_ELEMENTS);
 }
 
+// Counts of allocate() and deallocate() calls made by CountingAllocator.
+struct AllocationCounts {
+	AllocationCounts()
+	: allocateCallCount(0), deallocateCallCount(0) { }
+	
+	size_t allocateCallCount, deallocateCallCount;
+};
+
+// A stateful allocator, which the standard propagation rules don't let
+// containers replace: copies of it are equal only to each other.
+template <typename T>
+class CountingAllocator {
+public:
+	typedef T value_type;
+	
+	// 'tag' tells apart allocators that are equal, and isn't compared.
+	explicit CountingAllocator(AllocationCounts& counts, size_t tag = 0)
+	: counts_(&counts), tag_(tag) { }
+	
+	T* allocate(size_t n) {
+		counts_->allocateCallCount++;
+		return static_cast<T*>(malloc(sizeof(T) * n));
+	}
+	
+	void deallocate(T* ptr, size_t) {
+		counts_->deallocateCallCount++;
+		free(ptr);
+	}
+	
+	AllocationCounts* counts() const {
+		return counts_;
+	}
+	
+	size_t tag() const {
+		return tag_;
+	}
+	
+private:
+	AllocationCounts* counts_;
+	size_t tag_;
+	
+};
+
+template <typename T>
+bool operator==(const CountingAllocator<T>& a, const CountingAllocator<T>& b) {
+	return a.counts() == b.counts();
+}
+
+template <typename T>
+bool operator!=(const CountingAllocator<T>& a, const CountingAllocator<T>& b) {
+	return a.counts() != b.counts();
+}
+
+// A CountingAllocator that goes with the elements on copy assignment.
+template <typename T>
+class CopyPropagatingAllocator : public CountingAllocator<T> {
+public:
+	typedef std::true_type propagate_on_container_copy_assignment;
+	
+	explicit CopyPropagatingAllocator(AllocationCounts& counts)
+	: CountingAllocator<T>(counts) { }
+	
+};
+
+void testCustomAllocator() {
+	CallCounter counter;
+	AllocationCounts counts, otherCounts;
+	
+	{
+		typedef dynamic_array<FakeElementType,
+		                      CountingAllocator<FakeElementType> > ArrayType;
+		
+		ArrayType array((CountingAllocator<FakeElementType>(counts)));
+		array.push_back(FakeElementType(counter, 10));
+		array.push_back(FakeElementType(counter, 20));
+		array.push_back(FakeElementType(counter, 30));
+		CHECK_EQ(counts.allocateCallCount, 2);
+		
+		// Copies use the same allocator.
+		ArrayType arrayCopy(array);
+		CHECK_EQ(arrayCopy.get_allocator().counts(), &counts);
+		CHECK_EQ(counts.allocateCallCount, 3);
+		
+		// Each array keeps its own allocator, so the elements have
+		// to be moved into storage from 'other's allocator.
+		ArrayType other((CountingAllocator<FakeElementType>(otherCounts)));
+		other = std::move(array);
+		CHECK_EQ(other.get_allocator().counts(), &otherCounts);
+		CHECK_EQ(otherCounts.allocateCallCount, 1);
+		CHECK_EQ(other.size(), 3);
+		CHECK_EQ(other[0].id(), 10);
+		CHECK_EQ(other[2].id(), 30);
+		
+		// Copy assignment doesn't replace the allocator either.
+		other = arrayCopy;
+		CHECK_EQ(other.get_allocator().counts(), &otherCounts);
+		CHECK_EQ(otherCounts.allocateCallCount, 2);
+		CHECK_EQ(other[1].id(), 20);
+		
+		// Nor does move assignment, even when the storage can be
+		// taken because the allocators are equal.
+		ArrayType same((CountingAllocator<FakeElementType>(counts, 1)));
+		const FakeElementType* const first = &arrayCopy[0];
+		same = std::move(arrayCopy);
+		CHECK_EQ(same.get_allocator().tag(), 1);
+		CHECK_EQ(&same[0], first);
+		CHECK_EQ(arrayCopy.size(), 0);
+		
+		CHECK_EQ(counter.copyConstructorCallCount(), 6);
+	}
+	
+	CHECK_EQ(counts.deallocateCallCount, counts.allocateCallCount);
+	CHECK_EQ(otherCounts.deallocateCallCount, otherCounts.allocateCallCount);
+	CHECK_EQ(counter.destructorCallCount(),
+	         counter.copyConstructorCallCount() +
+	         counter.moveConstructorCallCount());
+}
+
+void testMemAllocator() {
+	CallCounter counter;
+	mem_heap_t* const heap = mem_heap_create();
+	
+	{
+		typedef mem_allocator<FakeElementType> AllocatorType;
+		
+		dynamic_array<FakeElementType, AllocatorType> array(
+			(AllocatorType(heap)));
+		array.push_back(FakeElementType(counter, 0));
+		const FakeElementType* const first = &array[0];
+		
+		// The heap has room after the storage, so it grows in place
+		// without moving the element.
+		array.reserve(50);
+		CHECK_EQ(&array[0], first);
+		CHECK_EQ(counter.moveConstructorCallCount(), 1);
+		
+		for (size_t i = 1; i < 50; i++) {
+			array.push_back(FakeElementType(counter, i));
+		}
+		CHECK_EQ(array.get_allocator().heap(), heap);
+		for (size_t i = 0; i < 50; i++) {
+			CHECK_EQ(array[i].id(), i);
+		}
+	}
+	
+	CHECK_EQ(counter.destructorCallCount(), counter.moveConstructorCallCount());
+	mem_heap_destroy(heap);
+	
+	// The heap behind mem_alloc() can grow in place too.
+	dynamic_array<int, mem_allocator<int> > array;
+	array.push_back(1);
+	const int* const first = &array[0];
+	array.reserve(50);
+	CHECK_EQ(&array[0], first);
+	CHECK_EQ(size_t(array[0]), 1);
+}
+
+void testReserveAndShrink() {
+	CallCounter counter;
+	
+	{
+	        dynamic_array<FakeElementType> array;
+		CHECK_EQ(array.capacity(), 0);
+		
+		// reserve() allocates exactly what it's asked for.
+		array.reserve(100);
+		CHECK_EQ(array.capacity(), 100);
+		
+		for (size_t i = 0; i < 10; i++) {
+			array.push_back(FakeElementType(counter, i));
+		}
+		CHECK_EQ(array.capacity(), 100);
+		
+		// shrink_to_fit() gives back the rest, moving the elements.
+		array.shrink_to_fit();
+		CHECK_EQ(array.capacity(), 10);
+		CHECK_EQ(array.size(), 10);
+		for (size_t i = 0; i < 10; i++) {
+			CHECK_EQ(array[i].id(), i);
+		}
+		CHECK_EQ(counter.moveConstructorCallCount(), 20);
+		CHECK_EQ(counter.destructorCallCount(), 10);
+		
+		// clear() destroys the elements but keeps the storage.
+		array.clear();
+		CHECK_EQ(array.size(), 0);
+		CHECK_EQ(array.capacity(), 10);
+		CHECK_EQ(counter.destructorCallCount(), 20);
+		
+		array.shrink_to_fit();
+		CHECK_EQ(array.capacity(), 0);
+		
+		array.push_back(FakeElementType(counter, 30));
+		CHECK_EQ(array[0].id(), 30);
+		CHECK_EQ(array.capacity(), 2);
+	}
+	
+	CHECK_EQ(counter.destructorCallCount(), 21);
+}
+
+// Returns the capacities an array has as it grows to 'size' elements.
+template <typename Array>
+std::vector<size_t> growthCapacities(size_t size) {
+	std::vector<size_t> capacities;
+	Array array;
+	for (size_t i = 0; i < size; i++) {
+		array.push_back(int(i));
+		if (capacities.empty() || capacities.back() != array.capacity()) {
+			capacities.push_back(array.capacity());
+		}
+	}
+	return capacities;
+}
+
+// Allocator whose allocations are rounded up to 64-byte size classes.
+template <typename T>
+class BinnedAllocator : public malloc_allocator<T> {
+public:
+	size_t good_size(size_t bytes) const {
+		return (bytes + 63) & ~size_t(63);
+	}
+	
+};
+
+void testGrowthPolicies() {
+	const size_t doubling[] = { 2, 4, 8, 16, 32, 64, 128 };
+	const std::vector<size_t> doublingCapacities =
+		growthCapacities<dynamic_array<int> >(100);
+	CHECK_EQ(doublingCapacities.size(), 7);
+	for (size_t i = 0; i < doublingCapacities.size(); i++) {
+		CHECK_EQ(doublingCapacities[i], doubling[i]);
+	}
+	
+	const size_t oneAndAHalf[] = { 2, 3, 4, 6, 9, 13, 19, 28, 42, 63, 94, 141 };
+	const std::vector<size_t> oneAndAHalfCapacities = growthCapacities<
+		dynamic_array<int, malloc_allocator<int>, one_and_a_half_growth> >(100);
+	CHECK_EQ(oneAndAHalfCapacities.size(), 12);
+	for (size_t i = 0; i < oneAndAHalfCapacities.size(); i++) {
+		CHECK_EQ(oneAndAHalfCapacities[i], oneAndAHalf[i]);
+	}
+	
+	// The first allocation fills a whole 64-byte size class.
+	const size_t sizeClass[] = { 16, 32, 64, 128 };
+	const std::vector<size_t> sizeClassCapacities = growthCapacities<
+		dynamic_array<int, BinnedAllocator<int>, size_class_growth> >(100);
+	CHECK_EQ(sizeClassCapacities.size(), 4);
+	for (size_t i = 0; i < sizeClassCapacities.size(); i++) {
+		CHECK_EQ(sizeClassCapacities[i], sizeClass[i]);
+	}
+	
+	// Large allocations from mem_allocator fill their pages.
+	dynamic_array<int, mem_allocator<int>, size_class_growth> array;
+	for (size_t i = 0; i < 100000; i++) {
+		array.push_back(int(i));
+	}
+	const size_t bytes = array.capacity() * sizeof(int);
+	CHECK_EQ(mem_good_size(bytes), bytes);
+	CHECK_EQ(size_t(array[99999]), 99999);
+	
+	// resize() grows to the size asked for if that's beyond what the
+	// policy would grow to.
+	dynamic_array<int> resized;
+	resized.resize(3);
+	CHECK_EQ(resized.capacity(), 3);
+	resized.resize(4);
+	CHECK_EQ(resized.capacity(), 6);
+}
+
+template <typename Array>
+bool isInline(Array& array) {
+	const char* const element = reinterpret_cast<const char*>(&array[0]);
+	const char* const object = reinterpret_cast<const char*>(&array);
+	return element >= object && element < object + sizeof(array);
+}
+
+void testSmallArray() {
+	CallCounter counter;
+	AllocationCounts counts;
+	
+	{
+		typedef small_dynamic_array<FakeElementType, 4,
+		                            CountingAllocator<FakeElementType> > ArrayType;
+		
+		ArrayType array((CountingAllocator<FakeElementType>(counts)));
+		for (size_t i = 0; i < 4; i++) {
+			array.push_back(FakeElementType(counter, i));
+		}
+		
+		// The first four elements are kept inside the object.
+		CHECK_EQ(counts.allocateCallCount, 0);
+		CHECK_EQ(isInline(array), true);
+		CHECK_EQ(counter.moveConstructorCallCount(), 4);
+		
+		// The fifth moves them all to allocated storage.
+		array.push_back(FakeElementType(counter, 4));
+		CHECK_EQ(counts.allocateCallCount, 1);
+		CHECK_EQ(isInline(array), false);
+		CHECK_EQ(counter.moveConstructorCallCount(), 9);
+		CHECK_EQ(counter.destructorCallCount(), 4);
+		
+		for (size_t i = 0; i < 5; i++) {
+			CHECK_EQ(array[i].id(), i);
+		}
+		
+		size_t i = 0;
+		for (ArrayType::iterator it = array.begin(); it != array.end(); ++it) {
+			CHECK_EQ(it->id(), i++);
+		}
+		CHECK_EQ(i, 5);
+		
+		array.pop_back();
+		array.resize(2, FakeElementType(counter, 100));
+		CHECK_EQ(array.size(), 2);
+		array.resize(3, FakeElementType(counter, 100));
+		CHECK_EQ(array.size(), 3);
+		CHECK_EQ(array[2].id(), 100);
+		CHECK_EQ(counts.allocateCallCount, 1);
+		
+		// The elements fit inline again.
+		array.shrink_to_fit();
+		CHECK_EQ(isInline(array), true);
+		CHECK_EQ(array.capacity(), 4);
+		CHECK_EQ(counts.deallocateCallCount, 1);
+		CHECK_EQ(array[2].id(), 100);
+		
+		array.reserve(10);
+		CHECK_EQ(array.capacity(), 10);
+		array.clear();
+		CHECK_EQ(array.size(), 0);
+	}
+	
+	CHECK_EQ(counts.deallocateCallCount, 2);
+	CHECK_EQ(counter.destructorCallCount(),
+	         counter.copyConstructorCallCount() +
+	         counter.moveConstructorCallCount());
+}
+
+void testSmallArrayCopyAndMove() {
+	CallCounter counter;
+	
+	{
+		typedef small_dynamic_array<FakeElementType, 2> ArrayType;
+		
+		ArrayType small;
+		small.push_back(FakeElementType(counter, 10));
+		ArrayType large;
+		for (size_t i = 0; i < 3; i++) {
+			large.push_back(FakeElementType(counter, i));
+		}
+		
+		// Copies are inline if they fit.
+		ArrayType smallCopy(small);
+		ArrayType largeCopy(large);
+		CHECK_EQ(isInline(smallCopy), true);
+		CHECK_EQ(isInline(largeCopy), false);
+		CHECK_EQ(counter.copyConstructorCallCount(), 4);
+		
+		// Inline elements have to be moved...
+		const size_t moves = counter.moveConstructorCallCount();
+		ArrayType smallMoved(std::move(small));
+		CHECK_EQ(counter.moveConstructorCallCount(), moves + 1);
+		CHECK_EQ(small.size(), 0);
+		CHECK_EQ(smallMoved[0].id(), 10);
+		
+		// ...but allocated storage is just taken.
+		const FakeElementType* const first = &large[0];
+		ArrayType largeMoved(std::move(large));
+		CHECK_EQ(counter.moveConstructorCallCount(), moves + 1);
+		CHECK_EQ(&largeMoved[0], first);
+		CHECK_EQ(large.size(), 0);
+		
+		// Assignment in both directions.
+		smallCopy = largeCopy;
+		CHECK_EQ(smallCopy.size(), 3);
+		CHECK_EQ(smallCopy[2].id(), 2);
+		largeCopy = smallMoved;
+		CHECK_EQ(largeCopy.size(), 1);
+		CHECK_EQ(largeCopy[0].id(), 10);
+		
+		smallMoved.swap(largeMoved);
+		CHECK_EQ(smallMoved.size(), 3);
+		CHECK_EQ(largeMoved.size(), 1);
+		CHECK_EQ(largeMoved[0].id(), 10);
+		
+		// The moved-from arrays can still be used.
+		large.push_back(FakeElementType(counter, 30));
+		CHECK_EQ(large[0].id(), 30);
+		CHECK_EQ(isInline(large), true);
+	}
+	
+	CHECK_EQ(counter.destructorCallCount(),
+	         counter.copyConstructorCallCount() +
+	         counter.moveConstructorCallCount());
+	
+	// Move assigning allocated storage over allocated storage gives the
+	// old storage back.
+	AllocationCounts counts;
+	{
+		typedef small_dynamic_array<int, 2, CountingAllocator<int> > ArrayType;
+		
+		ArrayType a((CountingAllocator<int>(counts)));
+		ArrayType b((CountingAllocator<int>(counts)));
+		for (int i = 0; i < 10; i++) {
+			a.push_back(i);
+			b.push_back(i + 10);
+		}
+		
+		const int* const first = &b[0];
+		a = std::move(b);
+		CHECK_EQ(&a[0], first);
+		CHECK_EQ(a[9], 19);
+		CHECK_EQ(b.size(), 0);
+		CHECK_EQ(b.capacity(), 2);
+	}
+	
+	CHECK_EQ(counts.deallocateCallCount, counts.allocateCallCount);
+	
+	// Copy assignment takes the other array's allocator if it says so.
+	AllocationCounts otherCounts;
+	{
+		typedef small_dynamic_array<int, 2, CopyPropagatingAllocator<int> > ArrayType;
+		
+		ArrayType a((CopyPropagatingAllocator<int>(counts)));
+		ArrayType b((CopyPropagatingAllocator<int>(otherCounts)));
+		for (int i = 0; i < 10; i++) {
+			a.push_back(i);
+			b.push_back(i + 10);
+		}
+		
+		const size_t allocateCallCount = otherCounts.allocateCallCount;
+		a = b;
+		CHECK_EQ(a.get_allocator().counts(), &otherCounts);
+		CHECK_EQ(otherCounts.allocateCallCount, allocateCallCount + 1);
+		CHECK_EQ(a.size(), 10);
+		CHECK_EQ(a[9], 19);
+	}
+	
+	CHECK_EQ(counts.deallocateCallCount, counts.allocateCallCount);
+	CHECK_EQ(otherCounts.deallocateCallCount, otherCounts.allocateCallCount);
+	
+	// Elements whose moves may throw are copied into allocated storage,
+	// so taking the copy can't fail part way.
+	{
+		small_dynamic_array<ThrowingMoveElementType, 2> a;
+		small_dynamic_array<ThrowingMoveElementType, 2> b;
+		a.push_back(ThrowingMoveElementType(counter, 1));
+		b.push_back(ThrowingMoveElementType(counter, 2));
+		a = b;
+		CHECK_EQ(a.size(), 1);
+		CHECK_EQ(a[0].id(), 2);
+		CHECK_EQ(isInline(a), false);
+	}
+	
+	CHECK_EQ(counter.destructorCallCount(),
+	         counter.copyConstructorCallCount() +
+	         counter.moveConstructorCallCount());
+}
+
+void testSmallArrayTrivialElements() {
+	small_dynamic_array<int, 8> array;
+	for (size_t i = 0; i < 1000; i++) {
+		array.push_back(int(i));
+		if (i == 7) CHECK_EQ(isInline(array), true);
+	}
+	
+	small_dynamic_array<int, 8> arrayCopy(array);
+	for (size_t i = 0; i < 1000; i++) {
+		CHECK_EQ(size_t(arrayCopy[i]), i);
+	}
+	
+	arrayCopy.resize(3);
+	small_dynamic_array<int, 8> arrayMoved(std::move(arrayCopy));
+	CHECK_EQ(arrayMoved.size(), 3);
+	CHECK_EQ(size_t(arrayMoved[2]), 2);
+	
+	// The new elements can be copies of one that growing moves.
+	array.resize(4000, array[1]);
+	CHECK_EQ(size_t(array[3999]), 1);
+}
+
 int main() {
 	std::vector<TestType> tests;
 	tests.push_back(TestType("empty", testEmptyConstructor));
 	tests.push_back(TestType("push_back()", testPushBack));
+	tests.push_back(TestType("push_back() move", testPushBackMove));
+	tests.push_back(TestType("emplace_back()", testEmplaceBack));
 	tests.push_back(TestType("pop_back()", testPopBack));
 	tests.push_back(TestType("resize()", testResize));
 	tests.push_back(TestType("self assign", testSelfAssign));
 	tests.push_back(TestType("copy", testCopy));
+	tests.push_back(TestType("move", testMove));
+	tests.push_back(TestType("move assign", testMoveAssign));
 	tests.push_back(TestType("huge array", testHugeArray));
+	tests.push_back(TestType("grow copies if move may throw",
+	                         testGrowCopiesIfMoveMayThrow));
 	tests.push_back(TestType("huge array reserve()", testHugeArrayReserve));
+	tests.push_back(TestType("trivial elements", testTrivialElements));
+	tests.push_back(TestType("huge array relocatable",
+	                         testHugeArrayRelocatable));
+	tests.push_back(TestType("custom allocator", testCustomAllocator));
+	tests.push_back(TestType("mem_allocator", testMemAllocator));
+	tests.push_back(TestType("reserve() and shrink_to_fit()",
+	                         testReserveAndShrink));
+	tests.push_back(TestType("growth policies", testGrowthPolicies));
+	tests.push_back(TestType("small array", testSmallArray));
+	tests.push_back(TestType("small array copy and move",
+	                         testSmallArrayCopyAndMove));
+	tests.push_back(TestType("small array trivial elements",
+	                         testSmallArrayTrivialElements));
 	
 	runTests(tests);
 	return 0;
@@ -20,6 +20,13 @@ public:
 		counter_.recordCopyConstructorCall();
 	}
 	
+	// Moved-to objects count as copies below, since they are also created
+	// by dynamic_array.
+	FakeElementType(FakeElementType&& other) noexcept
+	: counter_(other.counter_), id_(other.id()), isCopy_(true) {
+		counter_.recordMoveConstructorCall();
+	}
+	
 	~FakeElementType() {
 		// Only count destructor calls of copies, since originals will
 		// be created by the tests.
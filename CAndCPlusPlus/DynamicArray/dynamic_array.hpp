@@ -3,7 +3,214 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/**
+ * \brief Whether elements of type T can be moved to new memory with memcpy().
+ *
+ * If so dynamic_array grows with realloc(), which may not have to copy at
+ * all, and doesn't call move constructors or destructors when it does. This is
+ * true for trivially copyable types; specialize it for other types that can be
+ * relocated this way (i.e. that don't point into themselves or get pointed to
+ * by anything that would need updating), for example:
+ *
+ *   template <>
+ *   struct is_trivially_relocatable<MyString> : std::true_type { };
+ */
+template <typename T>
+struct is_trivially_relocatable : std::is_trivially_copyable<T> { };
+
+/**
+ * \brief Default allocator for dynamic_array, using malloc() and free().
+ *
+ * Unlike std::allocator<> it can reallocate(), so arrays of trivially
+ * relocatable elements grow with realloc().
+ */
+template <typename T>
+class malloc_allocator {
+public:
+	typedef T value_type;
+	
+	malloc_allocator() { }
+	
+	template <typename U>
+	malloc_allocator(const malloc_allocator<U>&) { }
+	
+	T* allocate(size_t n) {
+		if (n > SIZE_MAX / sizeof(T)) throw std::bad_alloc();
+		T* const ptr = static_cast<T*>(malloc(sizeof(T) * n));
+		if (ptr == NULL && n > 0) throw std::bad_alloc();
+		return ptr;
+	}
+	
+	void deallocate(T* ptr, size_t) {
+		free(ptr);
+	}
+	
+	/**
+	 * \brief Move the bytes of 'ptr' (storage for 'oldCount' elements)
+	 * to storage for 'newCount' elements, as realloc() does.
+	 */
+	T* reallocate(T* ptr, size_t, size_t newCount) {
+		if (newCount > SIZE_MAX / sizeof(T)) throw std::bad_alloc();
+		// Only used for trivially relocatable elements. Casting to void*
+		// silences -Wclass-memaccess, which warns about realloc() of a type
+		// that isn't trivially copyable.
+		void* const newPtr = realloc(static_cast<void*>(ptr),
+		                             sizeof(T) * newCount);
+		if (newPtr == NULL) throw std::bad_alloc();
+		return static_cast<T*>(newPtr);
+	}
+	
+	/**
+	 * \brief Get the number of bytes malloc() makes usable when asked for
+	 * 'bytes' (at least 'bytes').
+	 */
+	size_t good_size(size_t bytes) const {
+#ifdef __GLIBC__
+		// glibc hands out chunks of a multiple of 16 bytes (at least
+		// 32), including 8 bytes of its own. (Large chunks come from
+		// mmap() and are rounded to pages, so this can underestimate.)
+		if (bytes > SIZE_MAX - 32) return bytes;
+		return std::max<size_t>((bytes + 8 + 15) & ~size_t(15), 32) - 8;
+#else
+		return bytes;
+#endif
+	}
+	
+};
+
+template <typename T, typename U>
+bool operator==(const malloc_allocator<T>&, const malloc_allocator<U>&) {
+	return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const malloc_allocator<T>&, const malloc_allocator<U>&) {
+	return false;
+}
+
+// Calls to the optional allocator members described for dynamic_array, with
+// fallbacks for allocators that don't have them. The int/long argument makes
+// the first overload preferred when both are viable.
+namespace dynamic_array_detail {
+	
+	// Smallest capacity the growth policies below grow an array to.
+	const size_t MIN_CAPACITY = 2;
+	
+	template <typename Allocator, typename T>
+	auto expand(Allocator& allocator, T* ptr, size_t oldCount,
+	            size_t newCount, int)
+	-> decltype(allocator.expand(ptr, oldCount, newCount)) {
+		return allocator.expand(ptr, oldCount, newCount);
+	}
+	
+	template <typename Allocator, typename T>
+	bool expand(Allocator&, T*, size_t, size_t, long) {
+		return false;
+	}
+	
+	template <typename Allocator, typename T>
+	auto reallocate(Allocator& allocator, T* ptr, size_t, size_t oldCount,
+	                size_t newCount, int)
+	-> decltype(allocator.reallocate(ptr, oldCount, newCount)) {
+		return allocator.reallocate(ptr, oldCount, newCount);
+	}
+	
+	template <typename Allocator, typename T>
+	T* reallocate(Allocator& allocator, T* ptr, size_t size, size_t oldCount,
+	              size_t newCount, long) {
+		T* const newPtr = std::allocator_traits<Allocator>::allocate(
+			allocator, newCount);
+		if (size > 0) {
+			memcpy(static_cast<void*>(newPtr), static_cast<void*>(ptr),
+			       sizeof(T) * size);
+		}
+		if (ptr != NULL) {
+			std::allocator_traits<Allocator>::deallocate(allocator, ptr,
+			                                             oldCount);
+		}
+		return newPtr;
+	}
+	
+	template <typename Allocator>
+	auto good_size(const Allocator& allocator, size_t bytes, int)
+	-> decltype(allocator.good_size(bytes)) {
+		return allocator.good_size(bytes);
+	}
+	
+	template <typename Allocator>
+	size_t good_size(const Allocator&, size_t bytes, long) {
+		return bytes;
+	}
+	
+}
+
+/**
+ * \brief Growth policy multiplying the capacity by 2.
+ *
+ * A growth policy decides the capacity a full array grows to when an element
+ * is added, or when it's resized beyond its capacity, with:
+ *
+ *   template <typename Allocator>
+ *   static size_t next_capacity(const Allocator& allocator, size_t capacity,
+ *                               size_t minCapacity, size_t elementSize);
+ *
+ * which must return at least 'minCapacity'. Growing by a constant factor keeps
+ * the cost of push_back() constant on average; a smaller factor wastes less
+ * space but moves the elements more often. The policies here give an empty
+ * array room for at least two elements, so it doesn't reallocate for
+ * each of its first few elements.
+ */
+struct doubling_growth {
+	template <typename Allocator>
+	static size_t next_capacity(const Allocator&, size_t capacity,
+	                            size_t minCapacity, size_t) {
+		return std::max(std::max(capacity * 2, minCapacity),
+		                dynamic_array_detail::MIN_CAPACITY);
+	}
+};
+
+/**
+ * \brief Growth policy multiplying the capacity by 1.5.
+ *
+ * Wastes a quarter of the storage on average, rather than a third, and lets
+ * the allocator reuse storage freed by earlier growth for later growth.
+ */
+struct one_and_a_half_growth {
+	template <typename Allocator>
+	static size_t next_capacity(const Allocator&, size_t capacity,
+	                            size_t minCapacity, size_t) {
+		return std::max(std::max(capacity + capacity / 2, minCapacity),
+		                dynamic_array_detail::MIN_CAPACITY);
+	}
+};
+
+/**
+ * \brief Growth policy doubling the capacity, then rounding it up to fill the
+ * allocator's size class.
+ *
+ * Uses the allocator's good_size(bytes) if it has one, returning the number
+ * of bytes it makes usable when asked for 'bytes', so the array gets to use
+ * the space the allocator would otherwise round up to and waste.
+ */
+struct size_class_growth {
+	template <typename Allocator>
+	static size_t next_capacity(const Allocator& allocator, size_t capacity,
+	                            size_t minCapacity, size_t elementSize) {
+		const size_t newCapacity = doubling_growth::next_capacity(
+			allocator, capacity, minCapacity, elementSize);
+		if (newCapacity > SIZE_MAX / elementSize) return newCapacity;
+		return dynamic_array_detail::good_size(
+			allocator, newCapacity * elementSize, 0) / elementSize;
+	}
+};
 
 /**
  * \brief Dynamically resizable array.
@@ -15,74 +222,191 @@
  * implementation (generally left un-fixed for brevity) which you should
  * consider how to address.
  *
- * NOTE: This class is designed for pre-C++11 and as such doesn't provide move
- *       operations.
+ * Elements are moved rather than copied where possible (i.e. when growing,
+ * unless the element's move constructor might throw), so elements that own
+ * heap memory aren't deep copied every time the array grows. Trivially
+ * copyable elements (and others marked with is_trivially_relocatable<>) are
+ * handled in bulk, with realloc() and memcpy().
+ *
+ * Storage comes from 'Allocator', through std::allocator_traits<>, so
+ * stateful allocators and the standard propagation rules are supported (but
+ * not fancy pointers). Beyond the standard requirements an allocator may
+ * provide either of:
+ *
+ *   bool expand(T* ptr, size_t oldCount, size_t newCount);
+ *   T* reallocate(T* ptr, size_t oldCount, size_t newCount);
+ *
+ * expand() grows storage without moving it, returning false if it can't; the
+ * array tries it first whatever the element type. reallocate() moves the
+ * storage's bytes as realloc() does, and is only used for trivially
+ * relocatable elements.
+ *
+ * How far the array grows when it runs out of room is up to 'GrowthPolicy'
+ * (see doubling_growth). reserve() and shrink_to_fit() set the capacity
+ * exactly, for arrays that need a predictable footprint.
  */
-template <typename T>
-class dynamic_array {
+template <typename T, typename Allocator = malloc_allocator<T>,
+          typename GrowthPolicy = doubling_growth>
+class dynamic_array : private Allocator {
+	typedef std::allocator_traits<Allocator> alloc_traits;
+	
+	static_assert(std::is_same<typename Allocator::value_type, T>::value,
+	              "Allocator must allocate elements of type T");
+	static_assert(std::is_same<typename alloc_traits::pointer, T*>::value,
+	              "Allocator must use plain pointers");
+	
 public:
+	typedef Allocator allocator_type;
+	
 	/**
 	 * \brief Create an empty dynamic array.
 	 */
 	dynamic_array()
-	: size_(0),
+	: Allocator(),
+	size_(0),
+	capacity_(0),
+	data_(NULL) { }
+	
+	/**
+	 * \brief Create an empty dynamic array using the given allocator.
+	 */
+	explicit dynamic_array(const Allocator& allocator)
+	: Allocator(allocator),
+	size_(0),
 	capacity_(0),
 	data_(NULL) { }
 	
 	/**
 	 * \brief Copy from another dynamic array instance.
+	 *
+	 * The allocator is copied as the allocator chooses (usually it's simply
+	 * copied).
 	 */
-	dynamic_array(const dynamic_array<T>& array)
-	: size_(array.size()),
-	capacity_(array.size()) {
-		// FIXME: Doesn't check if malloc() returns NULL.
-		// TODO: How could a caller pass a custom allocator?
-		T* const ptr = static_cast<T*>(malloc(sizeof(T) * capacity_));
-		for (size_t i = 0; i < array.size(); i++) {
-			// Uses placement new to call copy constructor.
-			// FIXME: Doesn't handle copy constructors throwing!
-			new(&ptr[i]) T(array[i]);
-		}
-		data_ = ptr;
+	dynamic_array(const dynamic_array<T, Allocator, GrowthPolicy>& array)
+	: dynamic_array(array,
+	                alloc_traits::select_on_container_copy_construction(
+	                	array.allocatorRef())) { }
+	
+	/**
+	 * \brief Copy from another dynamic array instance, using the given
+	 * allocator.
+	 */
+	dynamic_array(const dynamic_array<T, Allocator, GrowthPolicy>& array,
+	              const Allocator& allocator)
+	: Allocator(allocator),
+	size_(0),
+	capacity_(0),
+	data_(NULL) {
+		if (array.size() == 0) return;
+		data_ = alloc_traits::allocate(allocatorRef(), array.size());
+		capacity_ = array.size();
+		copyElements(array, std::is_trivially_copyable<T>());
+	}
+	
+	/**
+	 * \brief Move from another dynamic array instance.
+	 *
+	 * Takes the other array's storage (and a copy of its allocator, to free
+	 * it with), leaving it empty.
+	 */
+	dynamic_array(dynamic_array<T, Allocator, GrowthPolicy>&& array) noexcept
+	: Allocator(std::move(array.allocatorRef())),
+	size_(array.size_),
+	capacity_(array.capacity_),
+	data_(array.data_) {
+		array.size_ = 0;
+		array.capacity_ = 0;
+		array.data_ = NULL;
 	}
 	
 	/**
 	 * \brief Assign from another dynamic array instance.
 	 */
-	dynamic_array<T>& operator=(const dynamic_array<T>& array) {
+	dynamic_array<T, Allocator, GrowthPolicy>& operator=(
+			const dynamic_array<T, Allocator, GrowthPolicy>& array) {
 		// Copy and then swap.
 		//
 		// This both safely handles self-assignment and provides strong
 		// exception safety (means if this method throws we guarantee
 		// the dynamic_array object remains in its original state).
-		dynamic_array<T> arrayCopy(array);
-		swap(arrayCopy);
+		//
+		// The copy uses the allocator we should end up with, so swapping
+		// allocators too is always correct.
+		dynamic_array<T, Allocator, GrowthPolicy> arrayCopy(array,
+			alloc_traits::propagate_on_container_copy_assignment::value ?
+			array.allocatorRef() : allocatorRef());
+		swapAll(arrayCopy);
+		return *this;
+	}
+	
+	/**
+	 * \brief Move-assign from another dynamic array instance.
+	 *
+	 * Our old elements are destroyed and the other array is left empty,
+	 * unless our allocators differ and ours stays with us. Then our
+	 * allocator can't free the other array's storage, so the elements are
+	 * moved across one at a time.
+	 */
+	dynamic_array<T, Allocator, GrowthPolicy>& operator=(
+			dynamic_array<T, Allocator, GrowthPolicy>&& array)
+			noexcept(alloc_traits::propagate_on_container_move_assignment::value ||
+			         alloc_traits::is_always_equal::value) {
+		if (alloc_traits::propagate_on_container_move_assignment::value) {
+			// Move and then swap, for the same reasons as above.
+			dynamic_array<T, Allocator, GrowthPolicy> arrayMoved(std::move(array));
+			swapAll(arrayMoved);
+			return *this;
+		}
+		
+		// Our allocator stays with us. If it's equal to the other
+		// array's, it can free the other array's storage.
+		if (allocatorRef() == array.allocatorRef()) {
+			dynamic_array<T, Allocator, GrowthPolicy> arrayMoved(std::move(array));
+			swapStorage(arrayMoved);
+			return *this;
+		}
+		
+		dynamic_array<T, Allocator, GrowthPolicy> arrayMoved(allocatorRef());
+		arrayMoved.reserve(array.size());
+		for (size_t i = 0; i < array.size(); i++) {
+			arrayMoved.emplace_back(std::move(array[i]));
+		}
+		swapStorage(arrayMoved);
 		return *this;
 	}
 	
 	/**
 	 * \brief Swap fields with another dynamic array instance.
+	 *
+	 * Allocators are only swapped if the allocator says they should be;
+	 * otherwise they must be equal, since each array's storage must still be
+	 * freed by its own allocator.
 	 */
-	void swap(dynamic_array<T>& array) {
-		std::swap(size_, array.size_);
-		std::swap(capacity_, array.capacity_);
-		std::swap(data_, array.data_);
+	void swap(dynamic_array<T, Allocator, GrowthPolicy>& array) {
+		assert(alloc_traits::propagate_on_container_swap::value ||
+		       allocatorRef() == array.allocatorRef());
+		swapStorage(array);
+		if (alloc_traits::propagate_on_container_swap::value) {
+			using std::swap;
+			swap(allocatorRef(), array.allocatorRef());
+		}
 	}
 	
 	/**
 	 * \brief Destroy this array instance.
 	 */
 	~dynamic_array() {
-		// Call destructors.
-		// We do this in **reverse** order of construction.
-		for (size_t i = 0; i < size(); i++) {
-			const size_t revPosition = size() - i - 1;
-			// We can rely on destructors NOT throwing, so this is
-			// OK.
-			data_[revPosition].~T();
+		destroyElements(0);
+		if (data_ != NULL) {
+			alloc_traits::deallocate(allocatorRef(), data_, capacity_);
 		}
-		// TODO: How could a caller pass a custom allocator?
-		free(data_);
+	}
+	
+	/**
+	 * \brief Get a copy of the allocator.
+	 */
+	Allocator get_allocator() const {
+		return allocatorRef();
 	}
 	
 	/**
@@ -109,37 +433,41 @@ public:
 	}
 	
 	/**
-	 * \brief Increase capacity of array.
+	 * \brief Get the number of elements the array can hold without
+	 * allocating more storage.
+	 */
+	size_t capacity() const {
+		return capacity_;
+	}
+	
+	/**
+	 * \brief Increase capacity of array to exactly 'newCapacity'.
 	 */
 	void reserve(const size_t newCapacity) {
 		if (newCapacity <= capacity_) {
 			return;
 		}
 		
-		// Allocate a larger array.
-		capacity_ = newCapacity * 2;
-		
-		// FIXME: Doesn't check if malloc() returns NULL.
-		// TODO: How could a caller pass a custom allocator?
-		T* const newData = static_cast<T*>(malloc(sizeof(T) * capacity_));
-		for (size_t i = 0; i < size(); i++) {
-			// Uses placement new to call copy constructor.
-			// FIXME: Doesn't handle copy constructors throwing!
-			new(&newData[i]) T(data_[i]);
+		grow(newCapacity);
+	}
+	
+	/**
+	 * \brief Reduce capacity of array to its size, freeing the rest of
+	 * the storage.
+	 */
+	void shrink_to_fit() {
+		if (capacity_ == size()) {
+			return;
 		}
 		
-		// Destroy existing array.
-		// We do this in **reverse** order of construction.
-		for (size_t i = 0; i < size(); i++) {
-			const size_t revPosition = size() - i - 1;
-			// We can rely on destructors NOT throwing, so this is
-			// OK.
-			data_[revPosition].~T();
+		if (size() == 0) {
+			alloc_traits::deallocate(allocatorRef(), data_, capacity_);
+			data_ = NULL;
+			capacity_ = 0;
+			return;
 		}
-		// TODO: How could a caller pass a custom allocator?
-		free(data_);
 		
-		data_ = newData;
+		reallocate(size(), RelocateWithMemcpy());
 	}
 	
 	/**
@@ -149,24 +477,34 @@ public:
 	 * 'value'.
 	 */
 	void resize(size_t newSize, const T& value = T()) {
-		// Increase capacity (if we're expanding the array).
-		reserve(newSize);
+		// Increase capacity (if we're expanding the array). Growing may
+		// move or free the element 'value' refers to, if it's one of
+		// ours, so the new slots are then filled from a copy of it.
+		if (newSize > capacity_) {
+			if (isElement(value)) {
+				const T copy(value);
+				resize(newSize, copy);
+				return;
+			}
+			grow(nextCapacity(newSize));
+		}
 		
-		// Call copy constructors (if we're expanding the array).
-		for (size_t i = size(); i < newSize; i++) {
-			// Uses placement new to call copy constructor.
-			// FIXME: Doesn't handle copy constructors throwing!
-			new(&data_[i]) T(value);
+		// Call copy constructors (if we're expanding the array), undoing
+		// them if one throws.
+		size_t i = size();
+		try {
+			for (; i < newSize; i++) {
+				alloc_traits::construct(allocatorRef(), &data_[i], value);
+			}
+		} catch (...) {
+			while (i > size()) {
+				alloc_traits::destroy(allocatorRef(), &data_[--i]);
+			}
+			throw;
 		}
 		
 		// Call destructors (if we're shrinking the array).
-		// We do this in **reverse** order of construction.
-		for (size_t i = newSize; i < size(); i++) {
-			const size_t revPosition = size() - i - 1;
-			// We can rely on destructors NOT throwing, so this is
-			// OK.
-			data_[revPosition].~T();
-		}
+		destroyElements(newSize);
 		
 		size_ = newSize;
 	}
@@ -175,7 +513,46 @@ public:
 	 * \brief Append element to back of array.
 	 */
 	void push_back(const T& element) {
-		resize(size() + 1, element);
+		emplace_back(element);
+	}
+	
+	/**
+	 * \brief Append element to back of array, moving from it.
+	 */
+	void push_back(T&& element) {
+		emplace_back(std::move(element));
+	}
+	
+	/**
+	 * \brief Construct an element in place at the back of the array.
+	 *
+	 * 'args' are passed to the element's constructor, so no temporary
+	 * element needs to be copied or moved.
+	 */
+	template <typename... Args>
+	void emplace_back(Args&&... args) {
+		if (size() == capacity_) {
+			// Growing in place leaves any element 'args' refers to
+			// where it is.
+			const size_t newCapacity = nextCapacity(size() + 1);
+			if (!expand(newCapacity)) {
+				growAndEmplaceBack(newCapacity, RelocateWithMemcpy(),
+				                   std::forward<Args>(args)...);
+				return;
+			}
+		}
+		
+		alloc_traits::construct(allocatorRef(), &data_[size_],
+		                        std::forward<Args>(args)...);
+		size_++;
+	}
+	
+	/**
+	 * \brief Remove all elements, keeping the storage.
+	 */
+	void clear() {
+		destroyElements(0);
+		size_ = 0;
 	}
        
 	/**
@@ -185,7 +562,7 @@ public:
 		assert(size() > 0);
 		size_--;
 		// We can rely on destructors NOT throwing, so this is OK.
-		data_[size_].~T();
+		alloc_traits::destroy(allocatorRef(), &data_[size_]);
 	}
 	
 	/**
@@ -208,6 +585,194 @@ public:
 	}
 	
 private:
+	// Selects the overloads below that relocate elements with realloc()
+	// (std::true_type) or by moving them one at a time (std::false_type).
+	typedef std::integral_constant<bool, is_trivially_relocatable<T>::value>
+		RelocateWithMemcpy;
+	
+	// The allocator is a (private) base class rather than a field, so an
+	// empty one like malloc_allocator takes no space.
+	Allocator& allocatorRef() {
+		return *this;
+	}
+	
+	const Allocator& allocatorRef() const {
+		return *this;
+	}
+	
+	/**
+	 * \brief Swap elements and storage with another array, but not
+	 * allocators.
+	 */
+	void swapStorage(dynamic_array<T, Allocator, GrowthPolicy>& array) {
+		std::swap(size_, array.size_);
+		std::swap(capacity_, array.capacity_);
+		std::swap(data_, array.data_);
+	}
+	
+	/**
+	 * \brief Swap everything with another array, including allocators.
+	 */
+	void swapAll(dynamic_array<T, Allocator, GrowthPolicy>& array) {
+		swapStorage(array);
+		using std::swap;
+		swap(allocatorRef(), array.allocatorRef());
+	}
+	
+	/**
+	 * \brief Copy construct another array's elements into our (empty)
+	 * storage.
+	 */
+	void copyElements(const dynamic_array<T, Allocator, GrowthPolicy>& array,
+	                  std::false_type) {
+		for (; size_ < array.size(); size_++) {
+			// If this throws the destructor destroys the elements
+			// copied so far.
+			alloc_traits::construct(allocatorRef(), &data_[size_],
+			                        array[size_]);
+		}
+	}
+	
+	void copyElements(const dynamic_array<T, Allocator, GrowthPolicy>& array,
+	                  std::true_type) {
+		memcpy(data_, array.data_, sizeof(T) * array.size());
+		size_ = array.size();
+	}
+	
+	/**
+	 * \brief Destroy the elements from 'newSize' onwards.
+	 */
+	void destroyElements(const size_t newSize) {
+		// Nothing to do, so don't walk the elements.
+		if (std::is_trivially_destructible<T>::value) {
+			return;
+		}
+		
+		// We do this in **reverse** order of construction.
+		for (size_t i = newSize; i < size(); i++) {
+			const size_t revPosition = size() - (i - newSize) - 1;
+			// We can rely on destructors NOT throwing, so this is
+			// OK.
+			alloc_traits::destroy(allocatorRef(), &data_[revPosition]);
+		}
+	}
+	
+	/**
+	 * \brief Whether 'value' is one of our elements.
+	 */
+	bool isElement(const T& value) const {
+		return &value >= data_ && &value < data_ + size_;
+	}
+	
+	/**
+	 * \brief Get the capacity to grow to for at least 'minCapacity'
+	 * elements, from the growth policy.
+	 */
+	size_t nextCapacity(const size_t minCapacity) const {
+		return GrowthPolicy::next_capacity(allocatorRef(), capacity_,
+		                                   minCapacity, sizeof(T));
+	}
+	
+	/**
+	 * \brief Grow the storage to exactly 'newCapacity' elements, in place
+	 * if possible.
+	 */
+	void grow(const size_t newCapacity) {
+		if (!expand(newCapacity)) {
+			reallocate(newCapacity, RelocateWithMemcpy());
+		}
+	}
+	
+	/**
+	 * \brief Try to grow the storage to 'newCapacity' elements without
+	 * moving it, if the allocator can.
+	 */
+	bool expand(const size_t newCapacity) {
+		if (data_ == NULL ||
+		    !dynamic_array_detail::expand(allocatorRef(), data_, capacity_,
+		                                  newCapacity, 0)) {
+			return false;
+		}
+		capacity_ = newCapacity;
+		return true;
+	}
+	
+	/**
+	 * \brief Move the elements into new storage and free the old storage.
+	 *
+	 * Elements are only moved if that can't throw; otherwise they're
+	 * copied, so a throwing copy would leave the existing elements intact.
+	 */
+	void moveElementsTo(T* const newData) {
+		for (size_t i = 0; i < size(); i++) {
+			// Calls move (or copy) constructor.
+			// FIXME: Doesn't handle copy constructors throwing!
+			alloc_traits::construct(allocatorRef(), &newData[i],
+			                        std::move_if_noexcept(data_[i]));
+		}
+		
+		// Destroy existing array.
+		destroyElements(0);
+		if (data_ != NULL) {
+			alloc_traits::deallocate(allocatorRef(), data_, capacity_);
+		}
+	}
+	
+	/**
+	 * \brief Change the capacity, moving the elements to new storage.
+	 */
+	void reallocate(const size_t newCapacity, std::false_type) {
+		T* const newData = alloc_traits::allocate(allocatorRef(), newCapacity);
+		moveElementsTo(newData);
+		data_ = newData;
+		capacity_ = newCapacity;
+	}
+	
+	/**
+	 * \brief Relocate the elements with the allocator's reallocate() (which
+	 * can often extend the existing storage rather than copying it), or
+	 * memcpy().
+	 */
+	void reallocate(const size_t newCapacity, std::true_type) {
+		data_ = dynamic_array_detail::reallocate(allocatorRef(), data_, size_,
+		                                         capacity_, newCapacity, 0);
+		capacity_ = newCapacity;
+	}
+	
+	/**
+	 * \brief Grow the array and construct a new element at the back.
+	 */
+	template <typename... Args>
+	void growAndEmplaceBack(const size_t newCapacity, std::false_type,
+	                        Args&&... args) {
+		// Construct the new element before moving the existing ones,
+		// since 'args' may refer to one of them.
+		T* const newData = alloc_traits::allocate(allocatorRef(), newCapacity);
+		try {
+			alloc_traits::construct(allocatorRef(), &newData[size_],
+			                        std::forward<Args>(args)...);
+		} catch (...) {
+			alloc_traits::deallocate(allocatorRef(), newData, newCapacity);
+			throw;
+		}
+		moveElementsTo(newData);
+		data_ = newData;
+		capacity_ = newCapacity;
+		size_++;
+	}
+	
+	template <typename... Args>
+	void growAndEmplaceBack(const size_t newCapacity, std::true_type,
+	                        Args&&... args) {
+		// Reallocating may free the existing elements, which 'args'
+		// may refer to, so construct the new element first.
+		T element(std::forward<Args>(args)...);
+		reallocate(newCapacity, std::true_type());
+		alloc_traits::construct(allocatorRef(), &data_[size_],
+		                        std::move(element));
+		size_++;
+	}
+	
 	// Separate size and capacity fields mean we can avoid having to
 	// re-allocate the underlying storage when each element is added.
 	size_t size_, capacity_;
@@ -215,4 +780,4 @@ private:
 	
 };
  
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,110 @@
+#ifndef MEMALLOCATOR_HPP
+#define MEMALLOCATOR_HPP
+
+#include "mem.h"
+#include "mem_heap.h"
+
+#include <cstdint>
+#include <new>
+#include <type_traits>
+
+/**
+ * \brief Allocator using the C memory allocator (C/MemoryAllocator).
+ *
+ * Allocates from a mem_heap_t, or from mem_alloc()'s heap if none is given.
+ * It can expand() storage in place, so a dynamic_array using it often grows
+ * without moving its elements at all, and tells size_class_growth how much
+ * space each allocation really gets.
+ *
+ * The allocator follows its storage: it's copied, moved and swapped along
+ * with the container (a heap must still only be used by one thread at a
+ * time).
+ */
+template <typename T>
+class mem_allocator {
+	// The C allocator only aligns memory to 8 bytes.
+	static_assert(alignof(T) <= 8, "mem_allocator can't align T");
+	
+public:
+	typedef T value_type;
+	typedef std::true_type propagate_on_container_copy_assignment;
+	typedef std::true_type propagate_on_container_move_assignment;
+	typedef std::true_type propagate_on_container_swap;
+	
+	/**
+	 * \brief Allocate from the heap behind mem_alloc().
+	 */
+	mem_allocator()
+	: heap_(NULL) { }
+	
+	/**
+	 * \brief Allocate from 'heap', which must outlive any storage
+	 * allocated from it.
+	 */
+	explicit mem_allocator(mem_heap_t* heap)
+	: heap_(heap) { }
+	
+	template <typename U>
+	mem_allocator(const mem_allocator<U>& allocator)
+	: heap_(allocator.heap()) { }
+	
+	/**
+	 * \brief Get the heap being allocated from (NULL for mem_alloc()'s).
+	 */
+	mem_heap_t* heap() const {
+		return heap_;
+	}
+	
+	T* allocate(size_t n) {
+		if (n == 0) return NULL;
+		if (n > SIZE_MAX / sizeof(T)) throw std::bad_alloc();
+		void* const ptr = heap_ != NULL ?
+			mem_heap_alloc(heap_, sizeof(T) * n) : mem_alloc(sizeof(T) * n);
+		if (ptr == NULL) throw std::bad_alloc();
+		return static_cast<T*>(ptr);
+	}
+	
+	void deallocate(T* ptr, size_t) {
+		if (heap_ != NULL) {
+			mem_heap_free(heap_, ptr);
+		} else {
+			mem_free(ptr);
+		}
+	}
+	
+	/**
+	 * \brief Grow storage to 'newCount' elements without moving it.
+	 *
+	 * Returns false if there isn't room after it.
+	 */
+	bool expand(T* ptr, size_t, size_t newCount) {
+		if (newCount > SIZE_MAX / sizeof(T)) return false;
+		return heap_ != NULL ?
+			mem_heap_resize(heap_, ptr, sizeof(T) * newCount) :
+			mem_resize(ptr, sizeof(T) * newCount);
+	}
+	
+	/**
+	 * \brief Get the number of bytes an allocation of 'bytes' makes usable,
+	 * for size_class_growth.
+	 */
+	size_t good_size(size_t bytes) const {
+		return mem_good_size(bytes);
+	}
+	
+private:
+	mem_heap_t* heap_;
+	
+};
+
+template <typename T, typename U>
+bool operator==(const mem_allocator<T>& a, const mem_allocator<U>& b) {
+	return a.heap() == b.heap();
+}
+
+template <typename T, typename U>
+bool operator!=(const mem_allocator<T>& a, const mem_allocator<U>& b) {
+	return a.heap() != b.heap();
+}
+
+#endif
@@ -0,0 +1,540 @@
+#ifndef SMALLDYNAMICARRAY_HPP
+#define SMALLDYNAMICARRAY_HPP
+
+#include "dynamic_array.hpp"
+
+/**
+ * \brief Dynamically resizable array that keeps up to N elements inside the
+ * object itself.
+ *
+ * Has the same interface as dynamic_array, but only allocates storage once
+ * it grows beyond N elements, so arrays that usually stay small cost no
+ * allocations, and their elements sit next to the array object in memory
+ * (e.g. in the enclosing object or array of arrays) rather than somewhere
+ * else on the heap.
+ *
+ * The price is a larger object, and moving an array whose elements are
+ * inline has to move each element rather than just taking the storage.
+ *
+ * Storage beyond N elements comes from 'Allocator', and grows as
+ * 'GrowthPolicy' says, as for dynamic_array. The allocator stays with the
+ * array on copy and move assignment unless its propagate_on_container_* types
+ * say otherwise.
+ */
+template <typename T, size_t N, typename Allocator = malloc_allocator<T>,
+          typename GrowthPolicy = doubling_growth>
+class small_dynamic_array : private Allocator {
+	typedef std::allocator_traits<Allocator> alloc_traits;
+	
+	static_assert(N > 0, "Use dynamic_array for arrays with no inline storage");
+	static_assert(std::is_same<typename Allocator::value_type, T>::value,
+	              "Allocator must allocate elements of type T");
+	static_assert(std::is_same<typename alloc_traits::pointer, T*>::value,
+	              "Allocator must use plain pointers");
+	
+public:
+	typedef Allocator allocator_type;
+	
+	/**
+	 * \brief Create an empty dynamic array.
+	 */
+	small_dynamic_array()
+	: Allocator(),
+	size_(0),
+	capacity_(N),
+	data_(inlineData()) { }
+	
+	/**
+	 * \brief Create an empty dynamic array using the given allocator.
+	 */
+	explicit small_dynamic_array(const Allocator& allocator)
+	: Allocator(allocator),
+	size_(0),
+	capacity_(N),
+	data_(inlineData()) { }
+	
+	/**
+	 * \brief Copy from another dynamic array instance.
+	 */
+	small_dynamic_array(const small_dynamic_array<T, N, Allocator, GrowthPolicy>& array)
+	: Allocator(alloc_traits::select_on_container_copy_construction(
+		array.allocatorRef())),
+	size_(0),
+	capacity_(N),
+	data_(inlineData()) {
+		appendCopies(array);
+	}
+	
+	/**
+	 * \brief Move from another dynamic array instance.
+	 *
+	 * Allocated storage is taken from the other array; inline elements
+	 * are moved one at a time. Either way the other array is left empty.
+	 */
+	small_dynamic_array(small_dynamic_array<T, N, Allocator, GrowthPolicy>&& array)
+			noexcept(std::is_nothrow_move_constructible<T>::value)
+	: Allocator(std::move(array.allocatorRef())),
+	size_(0),
+	capacity_(N),
+	data_(inlineData()) {
+		takeElements(array);
+	}
+	
+	/**
+	 * \brief Assign from another dynamic array instance.
+	 */
+	small_dynamic_array<T, N, Allocator, GrowthPolicy>& operator=(
+			const small_dynamic_array<T, N, Allocator, GrowthPolicy>& array) {
+		if (this == &array) return *this;
+		
+		// Copy first, so if a copy constructor throws we're left in
+		// our original state. The copy uses the allocator we should end
+		// up with. If moving an element may throw, the copy is kept in
+		// allocated storage, so taking it below can't throw.
+		small_dynamic_array<T, N, Allocator, GrowthPolicy> arrayCopy(
+			alloc_traits::propagate_on_container_copy_assignment::value ?
+			array.allocatorRef() : allocatorRef());
+		if (!std::is_nothrow_move_constructible<T>::value &&
+		    array.size() <= N) {
+			arrayCopy.grow(N + 1);
+		}
+		arrayCopy.appendCopies(array);
+		
+		destroyElements(0);
+		size_ = 0;
+		releaseStorage();
+		if (alloc_traits::propagate_on_container_copy_assignment::value) {
+			allocatorRef() = array.allocatorRef();
+		}
+		takeElements(arrayCopy);
+		return *this;
+	}
+	
+	/**
+	 * \brief Move-assign from another dynamic array instance.
+	 *
+	 * Our old elements are destroyed and the other array is left empty.
+	 */
+	small_dynamic_array<T, N, Allocator, GrowthPolicy>& operator=(
+			small_dynamic_array<T, N, Allocator, GrowthPolicy>&& array) {
+		if (this == &array) return *this;
+		
+		destroyElements(0);
+		size_ = 0;
+		
+		if (alloc_traits::propagate_on_container_move_assignment::value) {
+			// Our storage must go back to the allocator it came from.
+			releaseStorage();
+			allocatorRef() = array.allocatorRef();
+		}
+		
+		if (allocatorRef() == array.allocatorRef()) {
+			// takeElements() expects the inline storage.
+			releaseStorage();
+			takeElements(array);
+			return *this;
+		}
+		
+		// Our allocator can't free the other array's storage, so the
+		// elements are moved across into storage of our own.
+		reserve(array.size());
+		for (size_t i = 0; i < array.size(); i++) {
+			alloc_traits::construct(allocatorRef(), &data_[i],
+			                        std::move(array[i]));
+			size_++;
+		}
+		array.destroyElements(0);
+		array.size_ = 0;
+		return *this;
+	}
+	
+	/**
+	 * \brief Swap contents with another dynamic array instance.
+	 *
+	 * Allocators must be equal unless they propagate on move assignment.
+	 */
+	void swap(small_dynamic_array<T, N, Allocator, GrowthPolicy>& array) {
+		small_dynamic_array<T, N, Allocator, GrowthPolicy> arrayMoved(std::move(array));
+		array = std::move(*this);
+		*this = std::move(arrayMoved);
+	}
+	
+	/**
+	 * \brief Destroy this array instance.
+	 */
+	~small_dynamic_array() {
+		destroyElements(0);
+		releaseStorage();
+	}
+	
+	/**
+	 * \brief Get a copy of the allocator.
+	 */
+	Allocator get_allocator() const {
+		return allocatorRef();
+	}
+	
+	/**
+	 * \brief Get the current array size.
+	 */
+	size_t size() const {
+		return size_;
+	}
+	
+	/**
+	 * \brief Access an element by index.
+	 */
+	T& operator[](size_t index) {
+		assert(index < size());
+		return data_[index];
+	}
+	
+	/**
+	 * \brief Access an element by index (const overload).
+	 */
+	const T& operator[](size_t index) const {
+		assert(index < size());
+		return data_[index];
+	}
+	
+	/**
+	 * \brief Get the number of elements the array can hold without
+	 * allocating more storage (at least N).
+	 */
+	size_t capacity() const {
+		return capacity_;
+	}
+	
+	/**
+	 * \brief Increase capacity of array to exactly 'newCapacity'.
+	 *
+	 * Does nothing while the elements fit in the inline storage.
+	 */
+	void reserve(const size_t newCapacity) {
+		if (newCapacity <= capacity_) {
+			return;
+		}
+		
+		grow(newCapacity);
+	}
+	
+	/**
+	 * \brief Reduce capacity of array to its size, or to the inline
+	 * storage if the elements fit in it, freeing the rest of the storage.
+	 */
+	void shrink_to_fit() {
+		if (isInline() || capacity_ == size()) {
+			return;
+		}
+		
+		if (size() <= N) {
+			relocate(inlineData(), N);
+		} else {
+			relocate(allocateStorage(size()), size());
+		}
+	}
+	
+	/**
+	 * \brief Resize the array to contain 'newSize' elements.
+	 *
+	 * If the new array size is larger fill the new slots with copies of
+	 * 'value'.
+	 */
+	void resize(size_t newSize, const T& value = T()) {
+		// Increase capacity (if we're expanding the array). Growing may
+		// move or free the element 'value' refers to, if it's one of
+		// ours, so the new slots are then filled from a copy of it.
+		if (newSize > capacity_) {
+			if (isElement(value)) {
+				const T copy(value);
+				resize(newSize, copy);
+				return;
+			}
+			grow(nextCapacity(newSize));
+		}
+		
+		// Call copy constructors (if we're expanding the array), undoing
+		// them if one throws.
+		size_t i = size();
+		try {
+			for (; i < newSize; i++) {
+				alloc_traits::construct(allocatorRef(), &data_[i], value);
+			}
+		} catch (...) {
+			while (i > size()) {
+				alloc_traits::destroy(allocatorRef(), &data_[--i]);
+			}
+			throw;
+		}
+		
+		// Call destructors (if we're shrinking the array).
+		destroyElements(newSize);
+		
+		size_ = newSize;
+	}
+	
+	/**
+	 * \brief Append element to back of array.
+	 */
+	void push_back(const T& element) {
+		emplace_back(element);
+	}
+	
+	/**
+	 * \brief Append element to back of array, moving from it.
+	 */
+	void push_back(T&& element) {
+		emplace_back(std::move(element));
+	}
+	
+	/**
+	 * \brief Construct an element in place at the back of the array.
+	 */
+	template <typename... Args>
+	void emplace_back(Args&&... args) {
+		if (size() == capacity_) {
+			const size_t newCapacity = nextCapacity(size() + 1);
+			if (!expand(newCapacity)) {
+				// Construct the new element before moving the existing
+				// ones, since 'args' may refer to one of them.
+				T* const newData = allocateStorage(newCapacity);
+				try {
+					alloc_traits::construct(
+						allocatorRef(), &newData[size_],
+						std::forward<Args>(args)...);
+				} catch (...) {
+					alloc_traits::deallocate(allocatorRef(),
+					                         newData, newCapacity);
+					throw;
+				}
+				relocate(newData, newCapacity);
+				size_++;
+				return;
+			}
+		}
+		
+		alloc_traits::construct(allocatorRef(), &data_[size_],
+		                        std::forward<Args>(args)...);
+		size_++;
+	}
+	
+	/**
+	 * \brief Remove all elements, keeping the storage.
+	 */
+	void clear() {
+		destroyElements(0);
+		size_ = 0;
+	}
+	
+	/**
+	 * \brief Remove last element.
+	 */
+	void pop_back() {
+		assert(size() > 0);
+		size_--;
+		// We can rely on destructors NOT throwing, so this is OK.
+		alloc_traits::destroy(allocatorRef(), &data_[size_]);
+	}
+	
+	/**
+	 * \brief Dynamic Array Iterator Type
+	 */
+	typedef T* iterator;
+	
+	/**
+	 * \brief Get iterator referring to beginning of array.
+	 */
+	iterator begin() {
+		return data_;
+	}
+	
+	/**
+	 * \brief Get iterator referring to end of array.
+	 */
+	iterator end() {
+		return data_ + size();
+	}
+	
+private:
+	// Selects the overloads below that move elements with memcpy()
+	// (std::true_type) or one at a time (std::false_type).
+	typedef std::integral_constant<bool, is_trivially_relocatable<T>::value>
+		RelocateWithMemcpy;
+	
+	// The allocator is a (private) base class rather than a field, so an
+	// empty one like malloc_allocator takes no space.
+	Allocator& allocatorRef() {
+		return *this;
+	}
+	
+	const Allocator& allocatorRef() const {
+		return *this;
+	}
+	
+	T* inlineData() {
+		return reinterpret_cast<T*>(&inline_);
+	}
+	
+	bool isInline() const {
+		return data_ == reinterpret_cast<const T*>(&inline_);
+	}
+	
+	/**
+	 * \brief Allocate storage for 'capacity' elements.
+	 */
+	T* allocateStorage(const size_t capacity) {
+		return alloc_traits::allocate(allocatorRef(), capacity);
+	}
+	
+	/**
+	 * \brief Give back allocated storage, going back to the inline
+	 * storage. The elements must already have been destroyed.
+	 */
+	void releaseStorage() {
+		if (!isInline()) {
+			alloc_traits::deallocate(allocatorRef(), data_, capacity_);
+			data_ = inlineData();
+			capacity_ = N;
+		}
+	}
+	
+	/**
+	 * \brief Copy construct another array's elements on to our back.
+	 */
+	void appendCopies(const small_dynamic_array<T, N, Allocator, GrowthPolicy>& array) {
+		reserve(array.size());
+		for (size_t i = 0; i < array.size(); i++) {
+			// If this throws the destructor destroys the elements
+			// copied so far.
+			alloc_traits::construct(allocatorRef(), &data_[size_], array[i]);
+			size_++;
+		}
+	}
+	
+	/**
+	 * \brief Take another array's elements, when we're empty and using
+	 * the inline storage, leaving the other array empty.
+	 */
+	void takeElements(small_dynamic_array<T, N, Allocator, GrowthPolicy>& array) {
+		if (!array.isInline()) {
+			data_ = array.data_;
+			capacity_ = array.capacity_;
+			size_ = array.size_;
+			array.data_ = array.inlineData();
+			array.capacity_ = N;
+			array.size_ = 0;
+			return;
+		}
+		
+		moveElements(array.data_, array.size(), data_, RelocateWithMemcpy());
+		size_ = array.size_;
+		array.size_ = 0;
+	}
+	
+	/**
+	 * \brief Destroy the elements from 'newSize' onwards.
+	 */
+	void destroyElements(const size_t newSize) {
+		// Nothing to do, so don't walk the elements.
+		if (std::is_trivially_destructible<T>::value) {
+			return;
+		}
+		
+		// We do this in **reverse** order of construction.
+		for (size_t i = newSize; i < size(); i++) {
+			const size_t revPosition = size() - (i - newSize) - 1;
+			// We can rely on destructors NOT throwing, so this is
+			// OK.
+			alloc_traits::destroy(allocatorRef(), &data_[revPosition]);
+		}
+	}
+	
+	/**
+	 * \brief Move 'count' elements from 'from' into uninitialized
+	 * 'to', destroying the originals.
+	 */
+	void moveElements(T* const from, const size_t count, T* const to,
+	                  std::false_type) {
+		for (size_t i = 0; i < count; i++) {
+			// Calls move (or copy) constructor.
+			// FIXME: Doesn't handle copy constructors throwing!
+			alloc_traits::construct(allocatorRef(), &to[i],
+			                        std::move_if_noexcept(from[i]));
+		}
+		if (std::is_trivially_destructible<T>::value) {
+			return;
+		}
+		for (size_t i = count; i > 0; i--) {
+			alloc_traits::destroy(allocatorRef(), &from[i - 1]);
+		}
+	}
+	
+	void moveElements(T* const from, const size_t count, T* const to,
+	                  std::true_type) {
+		if (count > 0) {
+			memcpy(static_cast<void*>(to), static_cast<void*>(from),
+			       sizeof(T) * count);
+		}
+	}
+	
+	/**
+	 * \brief Whether 'value' is one of our elements.
+	 */
+	bool isElement(const T& value) const {
+		return &value >= data_ && &value < data_ + size_;
+	}
+	
+	/**
+	 * \brief Get the capacity to grow to for at least 'minCapacity'
+	 * elements, from the growth policy.
+	 */
+	size_t nextCapacity(const size_t minCapacity) const {
+		return GrowthPolicy::next_capacity(allocatorRef(), capacity_,
+		                                   minCapacity, sizeof(T));
+	}
+	
+	/**
+	 * \brief Grow the storage to exactly 'newCapacity' elements, in place
+	 * if possible.
+	 */
+	void grow(const size_t newCapacity) {
+		if (!expand(newCapacity)) {
+			relocate(allocateStorage(newCapacity), newCapacity);
+		}
+	}
+	
+	/**
+	 * \brief Try to grow allocated storage to 'newCapacity' elements
+	 * without moving it, if the allocator can.
+	 */
+	bool expand(const size_t newCapacity) {
+		if (isInline() ||
+		    !dynamic_array_detail::expand(allocatorRef(), data_, capacity_,
+		                                  newCapacity, 0)) {
+			return false;
+		}
+		capacity_ = newCapacity;
+		return true;
+	}
+	
+	/**
+	 * \brief Move the elements into new storage (allocated, or the inline
+	 * storage), releasing the old storage.
+	 */
+	void relocate(T* const newData, const size_t newCapacity) {
+		moveElements(data_, size(), newData, RelocateWithMemcpy());
+		releaseStorage();
+		data_ = newData;
+		capacity_ = newCapacity;
+	}
+	
+	size_t size_, capacity_;
+	T* data_;
+	
+	// Raw memory for the first N elements, which are constructed and
+	// destroyed as they're added and removed.
+	typename std::aligned_storage<sizeof(T) * N, alignof(T)>::type inline_;
+	
+};
+
+#endif